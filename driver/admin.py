@@ -53,7 +53,8 @@ class IHEXParser(object):
 	def __init__(self, ihexfile, imagesize):
 		image = [0xFF] * imagesize
 		try:
-			lines = file(ihexfile, "rb").readlines()
+			with open(ihexfile, "r") as f:
+				lines = f.readlines()
 			hiAddr = 0
 			for line in lines:
 				line = line.strip()
@@ -87,7 +88,7 @@ class IHEXParser(object):
 					if len(image) < addr + count:
 						raise CNCCException("Ihex data outside of image bounds")
 					for i in range(9, 9 + count * 2, 2):
-						image[(i - 9) / 2 + addr] = int(line[i:i+2], 16)
+						image[(i - 9) // 2 + addr] = int(line[i:i+2], 16)
 					continue
 				raise CNCCException("Invalid ihex file format (unsup type %d)" % recordType)
 		except (ValueError) as e:
@@ -172,11 +173,93 @@ def handle_exitboot(context, arg):
 		raise CNCCException("Failed to exit CPU bootloader. "
 			"The USB device did not reconnect.")
 
-def __flashImage(context, ihexfile, offset, size, pageSize, targetMCU):
-	cncc = context.getCNCC()
-	p = IHEXParser(ihexfile, size)
-	for pageAddr in range(offset, size, pageSize):
-		page = p.image[pageAddr:pageAddr+min(pageSize, size - pageAddr)]
+def __flashStreamAck(cncc, pageAddr, seqno):
+	reply = cncc.controlReply(timeoutMs=2500)
+	if not reply.isOK():
+		# The error may also be about the previous page,
+		# which was programmed in the background.
+		raise CNCCException("Failed to flash near page 0x%04X: %s" %\
+				    (pageAddr, str(reply)))
+	if reply.seqno != seqno:
+		raise CNCCException("Got invalid reply sequence number: %d vs %d" %\
+				    (seqno, reply.seqno))
+
+def __flashProgWait(cncc):
+	# Wait for the background programming of the last page.
+	while True:
+		reply = cncc.controlMsgSyncReply(ControlMsgBootProgstatus())
+		if reply.id == ControlReply.REPLY_ERROR and\
+		   reply.code == ControlReplyError.CTLERR_COMMAND:
+			return # The bootloader flashes synchronously.
+		if reply.id != ControlReply.REPLY_VAL16:
+			raise CNCCException("Failed to read the programming "
+					    "status: %s" % str(reply))
+		if reply.value == ControlMsgBootProgstatus.BOOT_PROG_FAILED:
+			raise CNCCException("Failed to flash the last page")
+		if reply.value != ControlMsgBootProgstatus.BOOT_PROG_BUSY:
+			return
+
+def __changedPages(cncc, image, pageAddrs, pageSize, targetMCU):
+	# Returns the pages whose flash CRC does not match the image.
+	changed = []
+	for i in range(0, len(pageAddrs), ControlMsgBootPagecrc.MAX_PAGES):
+		addrs = pageAddrs[i:i+ControlMsgBootPagecrc.MAX_PAGES]
+		msg = ControlMsgBootPagecrc(addrs[0], len(addrs), targetMCU)
+		reply = cncc.controlMsgSyncReply(msg, timeoutMs=2500)
+		if reply.id == ControlReply.REPLY_ERROR and\
+		   reply.code == ControlReplyError.CTLERR_COMMAND:
+			return pageAddrs # Old bootloader. Flash everything.
+		if reply.id != ControlReply.REPLY_PAGECRC or\
+		   reply.address != addrs[0] or len(reply.crcs) != len(addrs):
+			raise CNCCException("Failed to read the page CRCs: %s" %\
+					    str(reply))
+		for (pageAddr, crc) in zip(addrs, reply.crcs):
+			page = image[pageAddr:pageAddr+pageSize]
+			page.extend([0xFF] * (pageSize - len(page)))
+			if crc != ControlMsgBootPagecrc.pageCrc(page):
+				changed.append(pageAddr)
+	return changed
+
+def __flashImageStream(cncc, image, pageAddrs, pageSize, targetMCU,
+		       encoding=ControlMsgBootStreamstart.BOOT_STREAM_RLE):
+	# Returns False, if the bootloader does not support streaming.
+	msg = ControlMsgBootStreamstart(targetMCU, encoding)
+	reply = cncc.controlMsgSyncReply(msg)
+	if reply.id == ControlReply.REPLY_ERROR and\
+	   reply.code == ControlReplyError.CTLERR_COMMAND:
+		return False
+	if not reply.isOK():
+		raise CNCCException("Failed to start the flash stream: %s" % str(reply))
+	# Bootloaders without encodings reply "Ok" and expect raw data.
+	encoding = ControlMsgBootStreamstart.BOOT_STREAM_RAW
+	if reply.id == ControlReply.REPLY_VAL16:
+		encoding = reply.value
+	# The pages are acknowledged after flashing.
+	# Keep up to WINDOW pages in flight.
+	inFlight = []
+	for pageAddr in pageAddrs:
+		if len(inFlight) >= ControlMsgBootStreamdata.WINDOW:
+			__flashStreamAck(cncc, *inFlight.pop(0))
+		page = image[pageAddr:pageAddr+pageSize]
+		page.extend([0xFF] * (pageSize - len(page)))
+		pageCrc = crc8Buf(0, page) ^ 0xFF
+		chunks = ControlMsgBootStreamdata.chunks(page, encoding)
+		for (i, (chunkOffset, chunk)) in enumerate(chunks):
+			last = i == len(chunks) - 1
+			msg = ControlMsgBootStreamdata(pageAddr + chunkOffset, chunk,
+						       pageCrc if last else 0)
+			# This blocks while the device flashes a page.
+			cncc.controlMsg(msg, timeoutMs=2500)
+		inFlight.append( (pageAddr, msg.seqno) )
+	while inFlight:
+		__flashStreamAck(cncc, *inFlight.pop(0))
+	__flashProgWait(cncc)
+	return True
+
+def __flashImageLegacy(cncc, image, pageAddrs, pageSize, targetMCU):
+	# Old bootloader. Write the page buffer in chunks.
+	for pageAddr in pageAddrs:
+		page = image[pageAddr:pageAddr+pageSize]
 		for chunkOffset in range(0, len(page), ControlMsgBootWritebuf.DATA_MAX_BYTES):
 			chunkSize = min(ControlMsgBootWritebuf.DATA_MAX_BYTES,
 					len(page) - chunkOffset)
@@ -191,6 +274,22 @@ def __flashImage(context, ihexfile, offset, size, pageSize, targetMCU):
 		if not reply.isOK():
 			raise CNCCException("Failed to flash page: %s" % str(reply))
 
+def __flashImage(context, ihexfile, offset, size, pageSize, targetMCU):
+	cncc = context.getCNCC()
+	p = IHEXParser(ihexfile, size)
+	pageAddrs = list(range(offset, size, pageSize))
+	changed = __changedPages(cncc, p.image, pageAddrs, pageSize, targetMCU)
+	print("%d of %d pages changed" % (len(changed), len(pageAddrs)))
+	if not changed:
+		return
+	start = time.time()
+	if not __flashImageStream(cncc, p.image, changed, pageSize, targetMCU):
+		__flashImageLegacy(cncc, p.image, changed, pageSize, targetMCU)
+	seconds = max(time.time() - start, 0.001)
+	nrBytes = len(changed) * pageSize
+	print("Flashed %d bytes in %.2f s (%.1f kB/s)" %\
+	      (nrBytes, seconds, nrBytes / seconds / 1024))
+
 def handle_flash_cpu(context, ihexfile):
 	print("Flashing CPU image")
 	__flashImage(context, ihexfile, 0, CPU_APP_SIZE, CPU_PAGE_SIZE,
@@ -201,12 +300,95 @@ def handle_flash_coprocessor(context, ihexfile):
 	__flashImage(context, ihexfile, 0, COPROC_APP_SIZE, COPROC_PAGE_SIZE,
 		     ControlMsg.TARGET_COPROC)
 
+def handle_irqtrace(context, arg):
+	cncc = context.getCNCC()
+	entries = []
+	index = 0
+	while True:
+		msg = ControlMsgGetirqtrace(index)
+		reply = cncc.controlMsgSyncReply(msg)
+		if reply.id != ControlReply.REPLY_IRQTRACE:
+			raise CNCCException("Failed to read the IRQ trace table "
+				"(firmware built with IRQTRACE=1?): %s" % str(reply))
+		if index >= reply.nrSites:
+			break
+		entries.append(reply)
+		index += 1
+	entries.sort(key=lambda e: e.maxUsec, reverse=True)
+	print("IRQs-disabled critical sections (byte address, longest first):")
+	for e in entries:
+		print("  0x%04X   max %5d us   %5d calls" %\
+		      (e.site * 2, e.maxUsec, e.calls))
+	if reply.lost:
+		print("%d sections from untracked call sites" % reply.lost)
+
+def handle_irqtrace_reset(context, arg):
+	cncc = context.getCNCC()
+	msg = ControlMsgGetirqtrace(0xFF, ControlMsgGetirqtrace.IRQTRACE_FLG_RESET)
+	reply = cncc.controlMsgSyncReply(msg)
+	if reply.id != ControlReply.REPLY_IRQTRACE:
+		raise CNCCException("Failed to reset the IRQ trace table: %s" % str(reply))
+
+def handle_loophist(context, arg):
+	cncc = context.getCNCC()
+	tables = (
+		(ControlMsgGetloophist.LOOPHIST_LOOP, "Main loop iteration time"),
+		(ControlMsgGetloophist.LOOPHIST_WDT, "Watchdog reset gap"),
+		(ControlMsgGetloophist.LOOPHIST_CULPRIT, "Long iterations by stage"),
+	)
+	for table, name in tables:
+		msg = ControlMsgGetloophist(table)
+		reply = cncc.controlMsgSyncReply(msg)
+		if reply.id != ControlReply.REPLY_LOOPHIST:
+			raise CNCCException("Failed to read the main loop "
+				"histogram: %s" % str(reply))
+		print("%s:" % name)
+		for i, value in enumerate(reply.values):
+			if table == ControlMsgGetloophist.LOOPHIST_CULPRIT:
+				label = ControlReplyLoophist.STAGE_NAMES[i]
+			else:
+				label = ControlReplyLoophist.bucketName(i)
+			print("  %-18s %5d" % (label, value))
+
+def handle_loophist_reset(context, arg):
+	cncc = context.getCNCC()
+	msg = ControlMsgGetloophist(ControlMsgGetloophist.LOOPHIST_LOOP,
+				    ControlMsgGetloophist.LOOPHIST_FLG_RESET)
+	reply = cncc.controlMsgSyncReply(msg)
+	if reply.id != ControlReply.REPLY_LOOPHIST:
+		raise CNCCException("Failed to reset the main loop "
+			"histogram: %s" % str(reply))
+
+def handle_sram(context, arg):
+	cncc = context.getCNCC()
+	reply = cncc.controlMsgSyncReply(ControlMsgGetsram())
+	if reply.id != ControlReply.REPLY_SRAM:
+		raise CNCCException("Failed to read the SRAM usage: %s" % str(reply))
+	# The simulator does not know the static and stack sizes.
+	unknown = lambda v: ("%5d" % v) if reply.stackMax else "unknown"
+	print("SRAM usage (bytes):")
+	print("  total SRAM         %5d" % reply.ramSize)
+	print("  .data and .bss     %s" % unknown(reply.staticSize))
+	print("    irq queue        %5d" % reply.irqQueueSize)
+	print("    debug ringbuffer %5d" % reply.dbgRingSize)
+	print("    lcd buffer       %5d" % reply.lcdSize)
+	print("    usb buffers      %5d" % reply.usbSize)
+	print("    uart buffer      %5d" % reply.uartSize)
+	print("  stack high-water   %s" % unknown(reply.stackMax))
+	print("  never used         %s" % unknown(reply.stackUnused))
+
 def usage():
 	print("admin.py [OPTIONS]")
 	print("")
 	print(" -c|--cpu-context            Find out the CPU context (boot or app)")
 	print("")
 	print(" -V|--verbose-debug BOOL     Enable/disable verbose debugging messages.")
+	print(" -I|--irqtrace               Dump the IRQ-disabled tracer table")
+	print("                             (Firmware built with IRQTRACE=1)")
+	print(" --irqtrace-reset            Clear the IRQ-disabled tracer table")
+	print(" -L|--loophist               Dump the main loop latency histograms")
+	print(" --loophist-reset            Clear the main loop latency histograms")
+	print(" -S|--sram                   Show the SRAM and stack usage")
 	print("")
 	print(" -b|--enterboot              Enter the CPU and coproc bootloader")
 	print(" -x|--exitboot               Exit the CPU and coproc bootloader")
@@ -218,8 +400,10 @@ def main():
 
 	try:
 		(opts, args) = getopt.getopt(sys.argv[1:],
-			"hcV:bxf:F:",
-			[ "help", "cpu-context", "verbose-debug=", "enterboot", "exitboot",
+			"hcV:ILSbxf:F:",
+			[ "help", "cpu-context", "verbose-debug=", "irqtrace",
+			  "irqtrace-reset", "loophist", "loophist-reset", "sram",
+			  "enterboot", "exitboot",
 			  "flash-cpu=", "flash-coproc=", ])
 	except getopt.GetoptError:
 		usage()
@@ -232,6 +416,16 @@ def main():
 			actions.append( ["cpu-context", v] )
 		if o in ("-V", "--verbose-debug"):
 			actions.append( ["verbose-debug", v] )
+		if o in ("-I", "--irqtrace"):
+			actions.append( ["irqtrace", v] )
+		if o == "--irqtrace-reset":
+			actions.append( ["irqtrace-reset", v] )
+		if o in ("-L", "--loophist"):
+			actions.append( ["loophist", v] )
+		if o == "--loophist-reset":
+			actions.append( ["loophist-reset", v] )
+		if o in ("-S", "--sram"):
+			actions.append( ["sram", v] )
 		if o in ("-b", "--enterboot"):
 			actions.append( ["enterboot", v] )
 		if o in ("-x", "--exitboot"):
@@ -244,6 +438,11 @@ def main():
 	handlers = {
 		"cpu-context"	: handle_cpu_context,
 		"verbose-debug"	: handle_verbose_debug,
+		"irqtrace"	: handle_irqtrace,
+		"irqtrace-reset": handle_irqtrace_reset,
+		"loophist"	: handle_loophist,
+		"loophist-reset": handle_loophist_reset,
+		"sram"		: handle_sram,
 		"enterboot"	: handle_enterboot,
 		"exitboot"	: handle_exitboot,
 		"flash-cpu"	: handle_flash_cpu,
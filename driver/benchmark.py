@@ -0,0 +1,439 @@
+#!/usr/bin/env python3
+"""
+#   CNC-remote-control
+#   Host driver benchmark suite
+#
+#   Copyright (C) 2026 agent <agent@local>
+#
+#   This program is free software; you can redistribute it and/or
+#   modify it under the terms of the GNU General Public License
+#   version 2 as published by the Free Software Foundation.
+#
+#   This program is distributed in the hope that it will be useful,
+#   but WITHOUT ANY WARRANTY; without even the implied warranty of
+#   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+#   GNU General Public License for more details.
+"""
+
+# Runs the driver against the firmware simulator:
+#
+#   make -C firmware/cpu-firmware/sim
+#   PYTHONPATH=firmware/cpu-firmware/sim ./driver/benchmark.py
+#
+# The results are written as JSON. "wall" numbers are host time and
+# measure the driver's own cost. "virtual" numbers are simulator time
+# and measure the protocol as the device sees it. Against a real device
+# there are only wall numbers, and the benchmarks that need the
+# simulator's button and jog wheel inputs are skipped.
+
+import sys
+import os
+import time
+import json
+import getopt
+import random
+import tempfile
+import types
+import contextlib
+
+# Run the simulator as fast as possible.
+os.environ.setdefault("CNCC_SIM_FAST", "1")
+
+import usb
+from cnccontrol_driver import *
+
+
+RESULT_FORMAT	= 1
+
+class FakeHalComponent(dict):
+	"Stand-in for a LinuxCNC HAL component. Pins are dict items."
+
+	def __init__(self, name):
+		dict.__init__(self)
+		self.name = name
+
+	def newpin(self, name, halType, direction):
+		self[name] = 0
+
+	def newparam(self, name, halType, direction):
+		self[name] = 0
+
+	def ready(self):
+		pass
+
+def importHalModule():
+	# The HAL module only loads the "hal" module from LinuxCNC.
+	hal = types.ModuleType("hal")
+	hal.component = FakeHalComponent
+	for name in ("HAL_BIT", "HAL_U32", "HAL_S32", "HAL_FLOAT",
+		     "HAL_IN", "HAL_OUT", "HAL_RO", "HAL_RW"):
+		setattr(hal, name, name)
+	sys.modules["hal"] = hal
+	import linuxcnchal_cnccontrol
+	return linuxcnchal_cnccontrol
+
+class Stopwatch(object):
+	"Measures host time and, with the simulator, virtual time."
+
+	def __init__(self, sim):
+		self.sim = sim
+
+	def __enter__(self):
+		self.wallStart = time.perf_counter()
+		if self.sim:
+			self.virtStart = self.sim.now()
+		return self
+
+	def __exit__(self, excType, excValue, traceback):
+		self.wall = time.perf_counter() - self.wallStart
+		if self.sim:
+			self.virtual = (self.sim.now() - self.virtStart) / 1e6
+
+	def rates(self, count, unit="per_sec"):
+		# Returns the result dict for count operations.
+		result = {
+			"count"			: count,
+			"wall_" + unit		: count / max(self.wall, 1e-9),
+			"wall_us_each"		: self.wall * 1e6 / max(count, 1),
+		}
+		if self.sim:
+			result["virtual_" + unit] = count / max(self.virtual, 1e-9)
+			result["virtual_us_each"] = self.virtual * 1e6 / max(count, 1)
+		return result
+
+	def durations(self, count=1):
+		# Returns the result dict for count runs of the operation.
+		result = {
+			"count"			: count,
+			"wall_ms"		: self.wall * 1e3 / max(count, 1),
+		}
+		if self.sim:
+			result["virtual_ms"] = self.virtual * 1e3 / max(count, 1)
+		return result
+
+class Context(object):
+	def __init__(self, count, flashImage):
+		self.count = count
+		self.flashImage = flashImage
+		self.sim = usb.simulator() if hasattr(usb, "simulator") else None
+		self.cncc = None
+
+	def getCNCC(self):
+		if not self.cncc:
+			self.cncc = CNCControl()
+			if not self.cncc.probe():
+				raise CNCCException("Did not find CNC "
+					"Control device on USB bus")
+			self.cncc.deviceReset()
+		return self.cncc
+
+	def simRun(self, msec):
+		self.sim.run(msec * 1000)
+
+	def simPress(self, button):
+		self.sim.press(button)
+		self.simRun(100)
+		self.sim.press(button, False)
+		self.simRun(100)
+
+def bench_roundtrip(ctx):
+	# Synchronous message round trips through controlMsgSyncReply().
+	cncc = ctx.getCNCC()
+	for i in range(10):
+		cncc.controlMsgSyncReply(ControlMsgPing())
+	with Stopwatch(ctx.sim) as sw:
+		for i in range(ctx.count):
+			reply = cncc.controlMsgSyncReply(ControlMsgPing())
+			if not reply.isOK():
+				raise CNCCException("Ping failed: %s" % str(reply))
+	return sw.rates(ctx.count)
+
+def bench_events(ctx):
+	# Interrupt events through eventWait(), from jog wheel turns.
+	if not ctx.sim:
+		return None
+	cncc = ctx.getCNCC()
+	if not cncc.deviceIsTurnedOn():
+		ctx.simPress("onoff")
+	cncc.setEnabledAxes(["x"])
+	cncc.setIncrementAtIndex(0, 0.1)
+	while cncc.eventWait():
+		pass
+
+	events = [0]
+	jogEvents = [0]
+	handleInterrupt = cncc._CNCControl__handleInterrupt
+	def countingHandler(rawData):
+		events[0] += 1
+		if ControlIrq.parseRaw(rawData).id == ControlIrq.IRQ_JOG:
+			jogEvents[0] += 1
+		handleInterrupt(rawData)
+	cncc._CNCControl__handleInterrupt = countingHandler
+	try:
+		with Stopwatch(ctx.sim) as sw:
+			# The firmware merges the detents of one poll into
+			# one event. Turn the wheel one detent per event.
+			for i in range(ctx.count):
+				ctx.sim.jog(1)
+				while jogEvents[0] <= i:
+					if not cncc.eventWait(timeoutMs=100):
+						raise CNCCException("Jog event %d "
+							"timed out" % i)
+	finally:
+		del cncc._CNCControl__handleInterrupt
+	result = sw.rates(events[0])
+	result["jog_events"] = jogEvents[0]
+	return result
+
+def bench_update_pins(ctx):
+	# HAL pin update cost, depending on the number of enabled axes.
+	halmod = importHalModule()
+	cncc = halmod.CNCControlHAL("cnccontrol-bench")
+	if not cncc.probe():
+		raise CNCCException("Did not find CNC Control device on USB bus")
+	cncc.deviceReset()
+	h = cncc.h
+	h["machine.on"] = 1
+	h["machine.mode.jog"] = 1
+	h["feed-override.max-value"] = 1.0
+	# __updatePins() only reads the device state.
+	cncc.deviceIsOn = True
+	updatePins = cncc._CNCControlHAL__updatePins
+
+	perAxes = {}
+	for nrAxes in range(1, len(ALL_AXES) + 1):
+		axes = ALL_AXES[:nrAxes]
+		for ax in axes:
+			h["axis.%s.enable" % ax] = 1
+		cncc.setEnabledAxes(list(axes))
+		total = 0.0
+		for i in range(ctx.count):
+			for ax in axes:
+				h["axis.%s.pos.user-coords" % ax] = i * 0.001
+			cncc.tk.update()
+			start = time.perf_counter()
+			updatePins()
+			total += time.perf_counter() - start
+		perAxes[nrAxes] = total * 1e6 / ctx.count
+
+	# Least squares line through the per-call costs
+	n = len(perAxes)
+	sx = sum(perAxes.keys())
+	sy = sum(perAxes.values())
+	sxx = sum(x * x for x in perAxes.keys())
+	sxy = sum(x * y for x, y in perAxes.items())
+	slope = (n * sxy - sx * sy) / (n * sxx - sx * sx)
+	return {
+		"count"			: ctx.count,
+		"wall_us_each"		: dict((str(k), v) for k, v in perAxes.items()),
+		"wall_us_per_axis"	: slope,
+		"wall_us_base"		: (sy - slope * sx) / n,
+	}
+
+def bench_reconnect(ctx):
+	# Time from an unplugged to a probed and usable device.
+	cncc = ctx.getCNCC()
+	count = max(ctx.count // 100, 3)
+	with Stopwatch(ctx.sim) as sw:
+		for i in range(count):
+			if not cncc.reconnect():
+				raise CNCCException("Failed to reconnect")
+			cncc.deviceReset()
+	return sw.durations(count)
+
+def generateImage(filename, size, seed=0):
+	# Write a random ihex image. Not a working firmware!
+	rand = random.Random(seed)
+	with open(filename, "w") as f:
+		for addr in range(0, size, 16):
+			data = [ rand.randrange(256) for i in range(min(16, size - addr)) ]
+			record = [ len(data), addr >> 8, addr & 0xFF, 0 ] + data
+			f.write(":%s%02X\n" % ("".join("%02X" % b for b in record),
+					       -sum(record) & 0xFF))
+		f.write(":00000001FF\n")
+
+def flashTime(ctx, ihexfile, size, pageSize, targetMCU):
+	# Image flash time through admin.py's __flashImage().
+	import admin
+	flashImage = getattr(admin, "__flashImage")
+
+	with tempfile.TemporaryDirectory() as tmpdir:
+		if not ihexfile:
+			ihexfile = os.path.join(tmpdir, "image.ihex")
+			generateImage(ihexfile, size)
+		actx = admin.Context()
+		admin.handle_enterboot(actx, None)
+		with Stopwatch(ctx.sim) as sw:
+			flashImage(actx, ihexfile, 0, size, pageSize, targetMCU)
+		admin.handle_exitboot(actx, None)
+	# The device re-enumerated.
+	ctx.cncc = None
+
+	result = sw.durations()
+	result["pages"] = size // pageSize
+	result["wall_bytes_per_sec"] = size / max(sw.wall, 1e-9)
+	if ctx.sim:
+		result["virtual_bytes_per_sec"] = size / max(sw.virtual, 1e-9)
+	return result
+
+def bench_flash(ctx):
+	if not ctx.sim and not ctx.flashImage:
+		return None # Would overwrite the device firmware.
+	import admin
+	return flashTime(ctx, ctx.flashImage, admin.CPU_APP_SIZE,
+			 admin.CPU_PAGE_SIZE, ControlMsg.TARGET_CPU)
+
+def bench_flash_coproc(ctx):
+	# Through the CPU bootloader to the coprocessor bootloader.
+	if not ctx.sim:
+		return None # Would overwrite the coprocessor firmware.
+	import admin
+	return flashTime(ctx, None, admin.COPROC_APP_SIZE,
+			 admin.COPROC_PAGE_SIZE, ControlMsg.TARGET_COPROC)
+
+def bench_flash_encodings(ctx):
+	# Stream size versus flash time of each stream encoding.
+	# "legacy" is the WRITEBUF/FLASHPG page write without streaming.
+	# The generated image is half random data and half erased flash.
+	if not ctx.sim and not ctx.flashImage:
+		return None # Would overwrite the device firmware.
+	import admin
+	flashImageStream = getattr(admin, "__flashImageStream")
+	flashImageLegacy = getattr(admin, "__flashImageLegacy")
+	pageAddrs = list(range(0, admin.CPU_APP_SIZE, admin.CPU_PAGE_SIZE))
+
+	results = {}
+	with tempfile.TemporaryDirectory() as tmpdir:
+		ihexfile = ctx.flashImage
+		if not ihexfile:
+			ihexfile = os.path.join(tmpdir, "image.ihex")
+			generateImage(ihexfile, admin.CPU_APP_SIZE // 2)
+		image = admin.IHEXParser(ihexfile, admin.CPU_APP_SIZE).image
+		actx = admin.Context()
+		admin.handle_enterboot(actx, None)
+		cncc = actx.getCNCC()
+
+		stream = [0, 0]
+		controlMsg = cncc.controlMsg
+		def countingControlMsg(msg, *args, **kwargs):
+			if msg.id in (ControlMsg.CONTROL_BOOT_STREAMDATA,
+				      ControlMsg.CONTROL_BOOT_WRITEBUF):
+				stream[0] += 1
+				stream[1] += msg.size
+			return controlMsg(msg, *args, **kwargs)
+		cncc.controlMsg = countingControlMsg
+		try:
+			for (name, encoding) in (
+					("legacy", None),
+					("raw", ControlMsgBootStreamstart.BOOT_STREAM_RAW),
+					("rle", ControlMsgBootStreamstart.BOOT_STREAM_RLE)):
+				stream[:] = [0, 0]
+				with Stopwatch(ctx.sim) as sw:
+					if encoding is None:
+						flashImageLegacy(cncc, image, pageAddrs,
+								 admin.CPU_PAGE_SIZE,
+								 ControlMsg.TARGET_CPU)
+					elif not flashImageStream(cncc, image, pageAddrs,
+								admin.CPU_PAGE_SIZE,
+								ControlMsg.TARGET_CPU,
+								encoding):
+						raise CNCCException("The bootloader does "
+							"not support streaming")
+				result = sw.durations()
+				result["messages"] = stream[0]
+				result["stream_bytes"] = stream[1]
+				result["ratio"] = stream[1] / len(image)
+				results[name] = result
+		finally:
+			del cncc.controlMsg
+		admin.handle_exitboot(actx, None)
+	# The device re-enumerated.
+	ctx.cncc = None
+
+	results["image_bytes"] = len(image)
+	return results
+
+BENCHMARKS = (
+	("roundtrip",	bench_roundtrip),
+	("events",	bench_events),
+	("update-pins",	bench_update_pins),
+	("reconnect",	bench_reconnect),
+	("flash",	bench_flash),
+	("flash-encodings", bench_flash_encodings),
+	("flash-coproc", bench_flash_coproc),
+)
+
+def usage():
+	print("benchmark.py [OPTIONS]")
+	print("")
+	print(" -b|--bench NAME             Run only this benchmark. Can be repeated.")
+	print("                             %s" % ", ".join(b[0] for b in BENCHMARKS))
+	print(" -n|--count N                Operations per benchmark (default 1000)")
+	print(" -o|--output FILE            Write the results to FILE instead of stdout")
+	print(" -F|--flash-image IHEX       Image for the flash benchmark.")
+	print("                             Required to run it on a real device.")
+
+def main():
+	selected = []
+	count = 1000
+	output = None
+	flashImage = None
+
+	try:
+		(opts, args) = getopt.getopt(sys.argv[1:],
+			"hb:n:o:F:",
+			[ "help", "bench=", "count=", "output=", "flash-image=", ])
+	except getopt.GetoptError:
+		usage()
+		return 1
+	for (o, v) in opts:
+		if o in ("-h", "--help"):
+			usage()
+			return 0
+		if o in ("-b", "--bench"):
+			if v not in (b[0] for b in BENCHMARKS):
+				print("Unknown benchmark: %s" % v)
+				return 1
+			selected.append(v)
+		if o in ("-n", "--count"):
+			try:
+				count = max(int(v), 1)
+			except ValueError:
+				print("Invalid count: %s" % v)
+				return 1
+		if o in ("-o", "--output"):
+			output = v
+		if o in ("-F", "--flash-image"):
+			flashImage = v
+
+	results = {}
+	try:
+		# Progress messages go to stderr. stdout is for the results.
+		with contextlib.redirect_stdout(sys.stderr):
+			ctx = Context(count, flashImage)
+			for name, func in BENCHMARKS:
+				if selected and name not in selected:
+					continue
+				print("Running benchmark: %s" % name)
+				result = func(ctx)
+				results[name] = result if result is not None else\
+						{ "skipped" : True }
+	except (CNCCException, usb.USBError) as e:
+		print("CNC Control exception: %s" % str(e), file=sys.stderr)
+		return 1
+
+	doc = {
+		"format"	: RESULT_FORMAT,
+		"device"	: "simulator" if ctx.sim else "usb",
+		"results"	: results,
+	}
+	text = json.dumps(doc, indent=1, sort_keys=True) + "\n"
+	if output:
+		with open(output, "w") as f:
+			f.write(text)
+	else:
+		sys.stdout.write(text)
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
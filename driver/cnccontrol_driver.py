@@ -11,6 +11,10 @@ import sys
 import usb
 import errno
 import time
+import math
+import struct
+import json
+import re
 from datetime import datetime, timedelta
 
 
@@ -50,6 +54,20 @@ def crc8Buf(crc, iterable):
 		crc = crc8(crc, b)
 	return crc
 
+def crc16(crc, data):
+	crc = crc ^ data
+	for i in range(0, 8):
+		if crc & 0x0001:
+			crc = (crc >> 1) ^ 0xA001
+		else:
+			crc >>= 1
+	return crc & 0xFFFF
+
+def crc16Buf(crc, iterable):
+	for b in iterable:
+		crc = crc16(crc, b)
+	return crc
+
 class CNCCException(Exception):
 	@classmethod
 	def info(cls, message):
@@ -144,10 +162,20 @@ class ControlMsg:
 	CONTROL_AXISENABLE		= 6
 	CONTROL_ESTOPUPDATE		= 7
 	CONTROL_SETINCREMENT		= 8
+	CONTROL_GETSTATS		= 9
+	CONTROL_GETIRQTRACE		= 10
+	CONTROL_GETLOOPHIST		= 11
+	CONTROL_GETTIME			= 12
+	CONTROL_GETSRAM			= 13
 	CONTROL_ENTERBOOT		= 0xA0
 	CONTROL_EXITBOOT		= 0xA1
 	CONTROL_BOOT_WRITEBUF		= 0xA2
 	CONTROL_BOOT_FLASHPG		= 0xA3
+	CONTROL_BOOT_EEPWRITE		= 0xA4
+	CONTROL_BOOT_STREAMSTART	= 0xA5
+	CONTROL_BOOT_STREAMDATA		= 0xA6
+	CONTROL_BOOT_PROGSTATUS		= 0xA7
+	CONTROL_BOOT_PAGECRC		= 0xA8
 
 	# Flags
 	CONTROL_FLG_BOOTLOADER		= 0x80
@@ -186,6 +214,8 @@ class ControlMsgDevflags(ControlMsg):
 	DEVICE_FLG_TWOHANDEN	= (1 << 3)
 	DEVICE_FLG_USBLOGMSG	= (1 << 4)
 	DEVICE_FLG_G53COORDS	= (1 << 5)
+	DEVICE_FLG_USBLOGTOK	= (1 << 6)
+	DEVICE_FLG_USBSTREAM	= (1 << 7)
 
 	def __init__(self, devFlagsMask, devFlagsSet, hdrFlags=0, hdrSeqno=0):
 		ControlMsg.__init__(self, ControlMsg.CONTROL_DEVFLAGS,
@@ -282,6 +312,55 @@ class ControlMsgSetincrement(ControlMsg):
 		raw.append(self.index & 0xFF)
 		return raw
 
+class ControlMsgGetstats(ControlMsg):
+	def __init__(self, hdrFlags=0, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_GETSTATS,
+				    hdrFlags, hdrSeqno)
+
+class ControlMsgGetirqtrace(ControlMsg):
+	IRQTRACE_FLG_RESET	= 1 << 0
+
+	def __init__(self, index, flags=0, hdrFlags=0, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_GETIRQTRACE,
+				    hdrFlags, hdrSeqno)
+		self.index = index
+		self.irqtraceFlags = flags
+
+	def getRaw(self):
+		raw = ControlMsg.getRaw(self)
+		raw.append(self.index & 0xFF)
+		raw.append(self.irqtraceFlags & 0xFF)
+		return raw
+
+class ControlMsgGetloophist(ControlMsg):
+	LOOPHIST_LOOP		= 0
+	LOOPHIST_WDT		= 1
+	LOOPHIST_CULPRIT	= 2
+
+	LOOPHIST_FLG_RESET	= 1 << 0
+
+	def __init__(self, table, flags=0, hdrFlags=0, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_GETLOOPHIST,
+				    hdrFlags, hdrSeqno)
+		self.table = table
+		self.loophistFlags = flags
+
+	def getRaw(self):
+		raw = ControlMsg.getRaw(self)
+		raw.append(self.table & 0xFF)
+		raw.append(self.loophistFlags & 0xFF)
+		return raw
+
+class ControlMsgGettime(ControlMsg):
+	def __init__(self, hdrFlags=0, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_GETTIME,
+				    hdrFlags, hdrSeqno)
+
+class ControlMsgGetsram(ControlMsg):
+	def __init__(self, hdrFlags=0, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_GETSRAM,
+				    hdrFlags, hdrSeqno)
+
 class ControlMsgEnterboot(ControlMsg):
 	ENTERBOOT_MAGIC0		= 0xB0
 	ENTERBOOT_MAGIC1		= 0x07
@@ -352,13 +431,151 @@ class ControlMsgBootFlashpg(ControlMsg):
 		raw.append(self.target & 0xFF)
 		return raw
 
+class ControlMsgBootStreamstart(ControlMsg):
+	# Encodings
+	BOOT_STREAM_RAW		= 0
+	BOOT_STREAM_RLE		= 1
+
+	def __init__(self, target, encoding=BOOT_STREAM_RAW,
+		     hdrFlags=ControlMsg.CONTROL_FLG_BOOTLOADER, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_BOOT_STREAMSTART,
+				    hdrFlags, hdrSeqno)
+		self.target = target
+		self.encoding = encoding
+
+	def getRaw(self):
+		raw = ControlMsg.getRaw(self)
+		raw.append(self.target & 0xFF)
+		raw.append(self.encoding & 0xFF)
+		return raw
+
+class ControlMsgBootStreamdata(ControlMsg):
+	DATA_MAX_BYTES	= 56
+	WINDOW		= 2	# Max pages in flight
+
+	def __init__(self, address, data, pageCrc=0,
+		     hdrFlags=ControlMsg.CONTROL_FLG_BOOTLOADER, hdrSeqno=0):
+		# pageCrc is the CRC of the whole page, for the last chunk.
+		ControlMsg.__init__(self, ControlMsg.CONTROL_BOOT_STREAMDATA,
+				    hdrFlags, hdrSeqno)
+		self.address = address
+		self.size = len(data)
+		self.crc = pageCrc
+		nrPadding = ControlMsgBootStreamdata.DATA_MAX_BYTES - len(data)
+		if nrPadding < 0:
+			CNCCException.error("ControlMsg-BootStreamdata: invalid data length %d" %\
+				(len(data)))
+		self.data = bytearray(data)
+		self.data.extend([0] * nrPadding)
+
+	def getRaw(self):
+		raw = ControlMsg.getRaw(self)
+		raw.extend( [self.address & 0xFF, (self.address >> 8) & 0xFF] )
+		raw.append(self.size & 0xFF)
+		raw.append(self.crc & 0xFF)
+		raw.extend(self.data)
+		return raw
+
+	@staticmethod
+	def rleTokens(page):
+		# Returns the list of (run, data) of the page.
+		# A run repeats data[0]. Else data are literal bytes.
+		tokens = []
+		literal = bytearray()
+		i = 0
+		while i < len(page):
+			run = 1
+			while i + run < len(page) and run < 0x81 and\
+			      page[i + run] == page[i]:
+				run += 1
+			if run >= 3:
+				if literal:
+					tokens.append( (False, literal) )
+					literal = bytearray()
+				tokens.append( (True, page[i:i+run]) )
+				i += run
+			else:
+				literal.append(page[i])
+				i += 1
+		if literal:
+			tokens.append( (False, literal) )
+		return tokens
+
+	@staticmethod
+	def chunks(page, encoding):
+		# Returns the list of (page offset, encoded data) messages of the page.
+		maxBytes = ControlMsgBootStreamdata.DATA_MAX_BYTES
+		if encoding == ControlMsgBootStreamstart.BOOT_STREAM_RAW:
+			return [ (offset, page[offset:offset+maxBytes])
+				 for offset in range(0, len(page), maxBytes) ]
+		RLE_RUN = 0x80
+		chunks = [ (0, bytearray()) ]
+		offset = 0
+		for (run, data) in ControlMsgBootStreamdata.rleTokens(page):
+			while data:
+				# Split literals to fill up the message.
+				# Tokens do not cross messages.
+				space = maxBytes - len(chunks[-1][1])
+				if space < 2:
+					chunks.append( (offset, bytearray()) )
+					space = maxBytes
+				if run:
+					count = len(data)
+					chunks[-1][1].extend( [RLE_RUN | (count - 2), data[0]] )
+				else:
+					count = min(len(data), space - 1, 0x80)
+					chunks[-1][1].append(count - 1)
+					chunks[-1][1].extend(data[:count])
+				data = data[count:]
+				offset += count
+		return chunks
+
+class ControlMsgBootProgstatus(ControlMsg):
+	# Page programming status. REPLY_VAL16 value.
+	BOOT_PROG_IDLE		= 0
+	BOOT_PROG_BUSY		= 1
+	BOOT_PROG_FAILED	= 2
+
+	def __init__(self, hdrFlags=ControlMsg.CONTROL_FLG_BOOTLOADER, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_BOOT_PROGSTATUS,
+				    hdrFlags, hdrSeqno)
+
+class ControlMsgBootPagecrc(ControlMsg):
+	MAX_PAGES	= 28	# Max pages per message
+
+	def __init__(self, address, count, target,
+		     hdrFlags=ControlMsg.CONTROL_FLG_BOOTLOADER, hdrSeqno=0):
+		ControlMsg.__init__(self, ControlMsg.CONTROL_BOOT_PAGECRC,
+				    hdrFlags, hdrSeqno)
+		self.address = address
+		self.count = count
+		self.target = target
+
+	def getRaw(self):
+		raw = ControlMsg.getRaw(self)
+		raw.extend( [self.address & 0xFF, (self.address >> 8) & 0xFF] )
+		raw.append(self.count & 0xFF)
+		raw.append(self.target & 0xFF)
+		return raw
+
+	@staticmethod
+	def pageCrc(page):
+		# The CRC the device returns for the page data.
+		return crc16Buf(0xFFFF, page)
+
 class ControlReply:
-	MAX_SIZE		= 6
+	MAX_SIZE		= 64
 
 	# IDs
 	REPLY_OK		= 0
 	REPLY_ERROR		= 1
 	REPLY_VAL16		= 2
+	REPLY_STATS		= 3
+	REPLY_IRQTRACE		= 4
+	REPLY_LOOPHIST		= 5
+	REPLY_STREAM		= 6
+	REPLY_SRAM		= 7
+	REPLY_PAGECRC		= 8
 
 	def __init__(self, id, flags, seqno):
 		self.id = id
@@ -382,6 +599,24 @@ class ControlReply:
 			elif id == ControlReply.REPLY_VAL16:
 				return ControlReplyVal16(raw[0] | (raw[1] << 8),
 							 hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_STATS:
+				return ControlReplyStats(raw,
+							 hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_IRQTRACE:
+				return ControlReplyIrqtrace(raw,
+							    hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_LOOPHIST:
+				return ControlReplyLoophist(raw,
+							    hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_STREAM:
+				return ControlReplyStream(raw[0], raw[1], raw[2:],
+							  hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_SRAM:
+				return ControlReplySram(raw,
+							hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlReply.REPLY_PAGECRC:
+				return ControlReplyPagecrc(raw,
+							   hdrFlags=flags, hdrSeqno=seqno)
 			else:
 				CNCCException.error("Unknown ControlReply ID: %d" % id)
 		except (IndexError, KeyError):
@@ -415,6 +650,7 @@ class ControlReplyError(ControlReply):
 	CTLERR_CONTEXT		= 6
 	CTLERR_CHECKSUM		= 7
 	CTLERR_CMDFAIL		= 8
+	CTLERR_SEQUENCE		= 9
 
 	def __init__(self, code, hdrFlags=0, hdrSeqno=0):
 		ControlReply.__init__(self, ControlReply.REPLY_ERROR,
@@ -432,6 +668,7 @@ class ControlReplyError(ControlReply):
 			self.CTLERR_CONTEXT	: "Not supported in this context",
 			self.CTLERR_CHECKSUM	: "Data checksum error",
 			self.CTLERR_CMDFAIL	: "Command failed",
+			self.CTLERR_SEQUENCE	: "Lost stream message",
 		}
 		try:
 			return code2text[self.code]
@@ -450,8 +687,143 @@ class ControlReplyVal16(ControlReply):
 	def isOK(self):
 		return True
 
+class ControlReplyStats(ControlReply):
+	def __init__(self, raw, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_STATS,
+				      hdrFlags, hdrSeqno)
+		u16 = lambda i: raw[i] | (raw[i + 1] << 8)
+		self.mainloopRate = u16(0)
+		self.irqQueueHwm = raw[2]
+		self.irqQueueDrops = u16(4)
+		self.spiRetries = u16(6)
+		self.lcdCommits = u16(8)
+		self.lcdTimeMax = u16(10)
+		self.usbIrqs = u16(12)
+		self.usbIrqMax = u16(14)
+		self.dbgOverruns = u16(16)
+		# Older firmware does not count UART drops.
+		self.uartDrops = u16(18) if len(raw) >= 20 else 0
+
+	def __repr__(self):
+		return "mainloop %d/s, irq queue hwm %d drops %d, "\
+		       "spi retries %d, lcd commits %d max %d us, "\
+		       "usb irqs %d max %d us, dbg overruns %d, "\
+		       "uart drops %d" %\
+		       (self.mainloopRate, self.irqQueueHwm, self.irqQueueDrops,
+			self.spiRetries, self.lcdCommits, self.lcdTimeMax,
+			self.usbIrqs, self.usbIrqMax, self.dbgOverruns,
+			self.uartDrops)
+
+	def isOK(self):
+		return True
+
+class ControlReplyIrqtrace(ControlReply):
+	def __init__(self, raw, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_IRQTRACE,
+				      hdrFlags, hdrSeqno)
+		u16 = lambda i: raw[i] | (raw[i + 1] << 8)
+		self.index = raw[0]
+		self.nrSites = raw[1]
+		self.lost = u16(2)
+		self.site = u16(4)	# Word address
+		self.maxUsec = u16(6)
+		self.calls = u16(8)
+
+	def __repr__(self):
+		return "site 0x%04X: max %d us, %d calls" %\
+		       (self.site * 2, self.maxUsec, self.calls)
+
+	def isOK(self):
+		return True
+
+class ControlReplyLoophist(ControlReply):
+	NR_BUCKETS	= 12
+	STAGE_NAMES	= ( "buttons", "lcd", "leds", "debug-ringbuffer",
+			    "irq-queue-retry", "other", )
+
+	def __init__(self, raw, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_LOOPHIST,
+				      hdrFlags, hdrSeqno)
+		self.table = raw[0]
+		count = raw[1]
+		self.values = [ raw[2 + i * 2] | (raw[3 + i * 2] << 8)
+				for i in range(count) ]
+
+	@classmethod
+	def bucketName(cls, index):
+		# Returns the usec range of a histogram bucket.
+		if index == 0:
+			return "< 64 us"
+		lo = 1 << (index + 5)
+		if index == cls.NR_BUCKETS - 1:
+			return ">= %d us" % lo
+		return "%d - %d us" % (lo, lo * 2)
+
+	def __repr__(self):
+		return "table %d: %s" % (self.table, str(self.values))
+
+	def isOK(self):
+		return True
+
+class ControlReplyStream(ControlReply):
+	# Stream types
+	STREAM_LOGMSG	= 0
+	STREAM_LOGTOK	= 1
+
+	def __init__(self, streamType, start, data, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_STREAM,
+				      hdrFlags, hdrSeqno)
+		self.streamType = streamType
+		self.start = start
+		self.data = bytes(data)
+
+	def __repr__(self):
+		return "stream packet %d: type %d, %d bytes" %\
+			(self.seqno, self.streamType, len(self.data))
+
+	def isOK(self):
+		return True
+
+class ControlReplySram(ControlReply):
+	def __init__(self, raw, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_SRAM,
+				      hdrFlags, hdrSeqno)
+		u16 = lambda i: raw[i] | (raw[i + 1] << 8)
+		self.ramSize = u16(0)
+		self.staticSize = u16(2)
+		self.stackMax = u16(4)	# 0 in the simulator
+		self.stackUnused = u16(6)
+		self.irqQueueSize = u16(8)
+		self.dbgRingSize = u16(10)
+		self.lcdSize = u16(12)
+		self.usbSize = u16(14)
+		self.uartSize = u16(16)
+
+	def __repr__(self):
+		return "sram %d, static %d, stack max %d unused %d" %\
+		       (self.ramSize, self.staticSize,
+			self.stackMax, self.stackUnused)
+
+	def isOK(self):
+		return True
+
+class ControlReplyPagecrc(ControlReply):
+	def __init__(self, raw, hdrFlags=0, hdrSeqno=0):
+		ControlReply.__init__(self, ControlReply.REPLY_PAGECRC,
+				      hdrFlags, hdrSeqno)
+		u16 = lambda i: raw[i] | (raw[i + 1] << 8)
+		self.address = u16(0)
+		self.crcs = [ u16(4 + i * 2) for i in range(raw[2]) ]
+
+	def __repr__(self):
+		return "page CRCs at 0x%04X: %s" %\
+		       (self.address, " ".join("%04X" % c for c in self.crcs))
+
+	def isOK(self):
+		return True
+
 class ControlIrq:
-	MAX_SIZE		= 14
+	MAX_SIZE		= 16
 
 	# IDs
 	IRQ_JOG			= 0
@@ -461,6 +833,7 @@ class ControlIrq:
 	IRQ_DEVFLAGS		= 4
 	IRQ_HALT		= 5
 	IRQ_LOGMSG		= 6
+	IRQ_LOGTOK		= 7
 
 	# Flags
 	IRQ_FLG_TXQOVR		= (1 << 0)
@@ -483,6 +856,7 @@ class ControlIrq:
 			raw = raw[4:]
 			if id == ControlIrq.IRQ_JOG:
 				return ControlIrqJog(raw[0:4], raw[4:8], raw[8], raw[9],
+						     ControlIrq.__u16(raw, 10),
 						     hdrFlags=flags, hdrSeqno=seqno)
 			elif id == ControlIrq.IRQ_JOG_KEEPALIFE:
 				return ControlIrqJogKeepalife(hdrFlags=flags, hdrSeqno=seqno)
@@ -496,15 +870,27 @@ class ControlIrq:
 				return ControlIrqDevflags(raw[0:2],
 							  hdrFlags=flags, hdrSeqno=seqno)
 			elif id == ControlIrq.IRQ_HALT:
-				return ControlIrqHalt(hdrFlags=flags, hdrSeqno=seqno)
+				return ControlIrqHalt(ControlIrq.__u16(raw, 0),
+						      ControlIrq.__u16(raw, 2),
+						      hdrFlags=flags, hdrSeqno=seqno)
 			elif id == ControlIrq.IRQ_LOGMSG:
 				return ControlIrqLogmsg(raw[0:10],
 							hdrFlags=flags, hdrSeqno=seqno)
+			elif id == ControlIrq.IRQ_LOGTOK:
+				return ControlIrqLogtok(raw[0], raw[1:10],
+							hdrFlags=flags, hdrSeqno=seqno)
 			else:
 				CNCCException.error("Unknown ControlIrq ID: %d" % id)
 		except (IndexError, KeyError):
 			CNCCException.error("Failed to parse ControlIrq (%d bytes)" % len(raw))
 
+	@staticmethod
+	def __u16(raw, offset):
+		# Older firmware does not send the latency and timestamps.
+		if len(raw) < offset + 2:
+			return None
+		return raw[offset] | (raw[offset + 1] << 8)
+
 	def __repr__(self):
 		return "Unknown interrupt"
 
@@ -512,7 +898,7 @@ class ControlIrqJog(ControlIrq):
 	IRQ_JOG_CONTINUOUS	= (1 << 0)
 	IRQ_JOG_RAPID		= (1 << 1)
 
-	def __init__(self, increment, velocity, axis, flags,
+	def __init__(self, increment, velocity, axis, flags, timestamp=None,
 		     hdrFlags=0, hdrSeqno=0):
 		ControlIrq.__init__(self, ControlIrq.IRQ_JOG,
 				    hdrFlags, hdrSeqno)
@@ -520,6 +906,7 @@ class ControlIrqJog(ControlIrq):
 		self.velocity = FixPt(velocity)
 		self.axis = NUMBER2AXIS[axis]
 		self.jogFlags = flags
+		self.timestamp = timestamp # Device jiffies of the input
 
 	def __repr__(self):
 		return "JOG interrupt (nr%d): %s, %s, %s, 0x%X" %\
@@ -562,22 +949,40 @@ class ControlIrqDevflags(ControlIrq):
 		return "DEVFLAGS interrupt (nr%d): %04X" % (self.seqno, self.devFlags)
 
 class ControlIrqHalt(ControlIrq):
-	def __init__(self, hdrFlags=0, hdrSeqno=0):
+	def __init__(self, latency=None, timestamp=None, hdrFlags=0, hdrSeqno=0):
 		ControlIrq.__init__(self, ControlIrq.IRQ_HALT,
 				    hdrFlags, hdrSeqno)
+		self.latency = latency # Button edge to queue, in usec
+		self.timestamp = timestamp # Device jiffies of the edge
 
 	def __repr__(self):
-		return "HALT interrupt (nr%d)" % (self.seqno)
+		if self.latency is None:
+			return "HALT interrupt (nr%d)" % self.seqno
+		return "HALT interrupt (nr%d): latency %d us" %\
+			(self.seqno, self.latency)
 
 class ControlIrqLogmsg(ControlIrq):
 	def __init__(self, msg, hdrFlags=0, hdrSeqno=0):
 		ControlIrq.__init__(self, ControlIrq.IRQ_LOGMSG,
 				    hdrFlags, hdrSeqno)
-		self.msg = "".join([c if type(c) == str else chr(c) for c in msg])
+		# The last chunk of a message is padded with NUL bytes.
+		self.msg = "".join([c if type(c) == str else chr(c) for c in msg]).rstrip("\0")
 
 	def __repr__(self):
 		return "LOGMSG interrupt (nr%d)" % (self.seqno)
 
+class ControlIrqLogtok(ControlIrq):
+	NOSTART		= 0xFF	# No record starts in this chunk
+
+	def __init__(self, start, data, hdrFlags=0, hdrSeqno=0):
+		ControlIrq.__init__(self, ControlIrq.IRQ_LOGTOK,
+				    hdrFlags, hdrSeqno)
+		self.start = start
+		self.data = bytes(data)
+
+	def __repr__(self):
+		return "LOGTOK interrupt (nr%d)" % (self.seqno)
+
 class JogState:
 	KEEPALIFE_TIMEOUT = 0.3
 	STOPDATA = (FixPt(0.0), False, FixPt(0.0))
@@ -595,21 +1000,480 @@ class JogState:
 				return self.STOPDATA
 		return (direction, incremental, velocity)
 
-	def set(self, direction, incremental, velocity):
+	def set(self, direction, incremental, velocity, edgeTime=None):
 		self.__direction, self.__incremental, self.__velocity =\
 			direction, incremental, velocity
+		self.edgeTime = edgeTime
 		self.keepAlife()
 
 	def reset(self):
 		self.set(self.STOPDATA[0], self.STOPDATA[1], self.STOPDATA[2])
 
+	def popEdgeTime(self):
+		# Returns the host time of the last jog input edge, or None.
+		edgeTime, self.edgeTime = self.edgeTime, None
+		return edgeTime
+
 	def keepAlife(self):
 		self.__timeout = datetime.now() + timedelta(seconds=self.KEEPALIFE_TIMEOUT)
 
+class DeviceClock:
+	"""Maps device jiffies timestamps to the host monotonic clock.
+	The offset is estimated from GETTIME round-trips.
+	The sample with the shortest round-trip time wins."""
+
+	JPS		= 15625		# Device jiffies per second
+	WRAP		= 0x10000	# Jiffies counter wraps after 4.2 seconds
+	WINDOW		= 8		# Number of round-trips to keep
+
+	def __init__(self):
+		self.reset()
+
+	def reset(self):
+		self.samples = []
+
+	def synced(self):
+		return bool(self.samples)
+
+	def addSample(self, hostSend, hostRecv, ticks):
+		# The device read its clock somewhere within the round-trip.
+		rtt = hostRecv - hostSend
+		self.samples.append((rtt, hostSend + rtt / 2, ticks))
+		self.samples = self.samples[-self.WINDOW:]
+
+	def rtt(self):
+		if not self.samples:
+			return None
+		return min(self.samples)[0]
+
+	def hostTime(self, ticks, now=None):
+		# Returns the host time of the device time stamp @ticks.
+		# @ticks must not be older than WRAP jiffies.
+		if not self.samples or ticks is None:
+			return None
+		if now is None:
+			now = time.monotonic()
+		rtt, refHost, refTicks = min(self.samples)
+		devNow = refTicks + (now - refHost) * self.JPS
+		age = (int(round(devNow)) - ticks) % self.WRAP
+		return now - age / self.JPS
+
+class PerfHistogram:
+	"""Logarithmic histogram of durations.
+	Percentiles are accurate to about 20%."""
+
+	SUBBUCKETS	= 4	# Buckets per power of two
+
+	def __init__(self):
+		self.reset()
+
+	def reset(self):
+		self.buckets = {}
+		self.count = 0
+		self.total = 0.0
+		self.max = 0.0
+
+	def add(self, seconds):
+		usec = seconds * 1000000.0
+		index = 0
+		if usec >= 1.0:
+			index = int(math.log2(usec) * self.SUBBUCKETS) + 1
+		self.buckets[index] = self.buckets.get(index, 0) + 1
+		self.count += 1
+		self.total += seconds
+		self.max = max(self.max, usec)
+
+	def percentile(self, percent):
+		# Returns the upper bucket bound, in usec.
+		if not self.count:
+			return 0.0
+		limit = self.count * percent / 100.0
+		seen = 0
+		for index in sorted(self.buckets):
+			seen += self.buckets[index]
+			if seen >= limit:
+				break
+		return min(2.0 ** (index / self.SUBBUCKETS), self.max)
+
+class PerfProfiler:
+	"""Host driver phase profiler.
+	Nested phases are not accounted to the enclosing phase.
+	"group.detail" phases are also accounted to "group"."""
+
+	class Phase:
+		def __init__(self, profiler, name):
+			self.profiler = profiler
+			self.name = name
+
+		def __enter__(self):
+			self.profiler.begin(self.name)
+
+		def __exit__(self, excType, excValue, traceback):
+			self.profiler.end()
+
+	def __init__(self):
+		self.stack = []
+		self.reset()
+
+	def reset(self):
+		self.hists = {}
+		self.since = time.perf_counter()
+
+	def phase(self, name):
+		return self.Phase(self, name)
+
+	def begin(self, name):
+		self.stack.append([name, time.perf_counter(), 0.0])
+
+	def end(self):
+		name, start, nested = self.stack.pop()
+		duration = time.perf_counter() - start
+		if self.stack:
+			self.stack[-1][2] += duration
+		self.add(name, duration - nested)
+
+	def add(self, name, seconds):
+		names = [name]
+		if "." in name:
+			names.append(name.split(".")[0])
+		for name in names:
+			hist = self.hists.get(name)
+			if hist is None:
+				hist = self.hists[name] = PerfHistogram()
+			hist.add(seconds)
+
+	def get(self, name):
+		return self.hists.get(name, PerfHistogram())
+
+	def summary(self):
+		# Returns a list of lines, the most expensive phase first.
+		elapsed = max(time.perf_counter() - self.since, 0.000001)
+		lines = [ "%-20s %7s %8s %8s %8s %6s" %\
+			  ("phase", "count", "p50-us", "p99-us", "max-us", "load") ]
+		for name, hist in sorted(self.hists.items(),
+					 key=lambda item: -item[1].total):
+			lines.append("%-20s %7d %8.0f %8.0f %8.0f %5.1f%%" %\
+				     (name, hist.count,
+				      hist.percentile(50), hist.percentile(99),
+				      hist.max, hist.total * 100.0 / elapsed))
+		return lines
+
+class UsbCapture:
+	"""USB traffic capture file.
+	The file starts with MAGIC, followed by records of
+	HEADER (type, usec since the previous record, data length) and data."""
+
+	MAGIC		= b"CNCCCAP1"
+	HEADER		= struct.Struct("<BIB")
+
+	# Record types
+	REC_MSG		= 0	# ControlMsg to the device
+	REC_REPLY	= 1	# ControlReply from the device
+	REC_IRQ		= 2	# ControlIrq from the device
+	REC_IRQ_TIMEOUT	= 3	# Interrupt read without an event
+	REC_STREAM	= 4	# ControlReplyStream from the device
+
+	def __init__(self, filename):
+		try:
+			self.file = open(filename, "wb")
+			self.file.write(self.MAGIC)
+		except IOError as e:
+			CNCCException.error("Failed to create capture file: %s" % str(e))
+		self.start = time.monotonic()
+		self.usec = 0
+		self.lastFlush = self.start
+
+	def record(self, recType, data=b""):
+		now = time.monotonic()
+		usec = int((now - self.start) * 1000000)
+		delta = min(usec - self.usec, 0xFFFFFFFF)
+		self.usec = usec
+		data = bytes(data)
+		try:
+			self.file.write(self.HEADER.pack(recType, delta, len(data)))
+			self.file.write(data)
+			if now - self.lastFlush >= 1.0:
+				self.file.flush()
+				self.lastFlush = now
+		except IOError as e:
+			CNCCException.error("Failed to write capture file: %s" % str(e))
+
+	def flush(self):
+		try:
+			self.file.flush()
+			self.lastFlush = time.monotonic()
+		except IOError as e:
+			CNCCException.error("Failed to write capture file: %s" % str(e))
+
+	def close(self):
+		try:
+			self.file.close()
+		except IOError as e:
+			CNCCException.error("Failed to write capture file: %s" % str(e))
+
+	@classmethod
+	def load(cls, filename):
+		# Returns a list of (seconds, type, data) records.
+		try:
+			with open(filename, "rb") as f:
+				raw = f.read()
+		except IOError as e:
+			CNCCException.error("Failed to read capture file: %s" % str(e))
+		if raw[:len(cls.MAGIC)] != cls.MAGIC:
+			CNCCException.error("Not a capture file: %s" % filename)
+		records = []
+		offset, usec = len(cls.MAGIC), 0
+		while offset + cls.HEADER.size <= len(raw):
+			recType, delta, size = cls.HEADER.unpack_from(raw, offset)
+			offset += cls.HEADER.size
+			usec += delta
+			records.append((usec / 1000000.0, recType,
+					raw[offset : offset + size]))
+			offset += size
+		return records
+
+class UsbReplay:
+	"""Replays a UsbCapture file in place of the USB device handle.
+	Interrupts are delivered in capture order, at the original pace
+	or as fast as they are read.
+	Replies are matched to the messages by control ID, because the
+	host may send a different message sequence than in the capture."""
+
+	LOOKAHEAD = 64 # Max number of captured messages to skip for a match
+
+	def __init__(self, filename, realtime=True):
+		self.realtime = realtime
+		self.irqs = []
+		self.pairs = []
+		msg = None
+		for t, recType, data in UsbCapture.load(filename):
+			if recType in (UsbCapture.REC_IRQ, UsbCapture.REC_IRQ_TIMEOUT):
+				self.irqs.append((t, recType, data))
+			elif recType == UsbCapture.REC_MSG:
+				msg = data
+			elif recType == UsbCapture.REC_REPLY and msg:
+				self.pairs.append((msg[0], data))
+				msg = None
+		self.rewind()
+
+	def rewind(self):
+		self.irqIndex = 0
+		self.pairIndex = 0
+		self.start = None
+		self.pendingMsg = None
+		self.lastReplies = {}
+
+	def finished(self):
+		return self.irqIndex >= len(self.irqs)
+
+	def reset(self):
+		pass
+
+	def bulkWrite(self, endpoint, data, timeoutMs):
+		self.pendingMsg = bytes(data)
+		return len(data)
+
+	def bulkRead(self, endpoint, size, timeoutMs):
+		msg, self.pendingMsg = self.pendingMsg, None
+		if not msg:
+			raise usb.USBError("Replay: No message pending")
+		end = min(self.pairIndex + self.LOOKAHEAD, len(self.pairs))
+		for i in range(self.pairIndex, end):
+			msgId, reply = self.pairs[i]
+			if msgId == msg[0]:
+				self.pairIndex = i + 1
+				self.lastReplies[msgId] = reply
+				break
+		else:
+			reply = self.lastReplies.get(msg[0],
+				bytes((ControlReply.REPLY_OK, 0, 0, 0)))
+		reply = bytearray(reply)
+		reply[3] = msg[3] # seqno
+		return reply[:size]
+
+	def interruptRead(self, endpoint, size, timeoutMs):
+		if self.finished():
+			CNCCFatal.error("Replay finished")
+		t, recType, data = self.irqs[self.irqIndex]
+		if self.realtime:
+			now = time.monotonic()
+			if self.start is None:
+				self.start = now - t
+			wait = self.start + t - now
+			if wait > timeoutMs / 1000.0:
+				time.sleep(timeoutMs / 1000.0)
+				raise usb.USBError("Replay: Timeout")
+			if wait > 0:
+				time.sleep(wait)
+		self.irqIndex += 1
+		if recType == UsbCapture.REC_IRQ_TIMEOUT:
+			raise usb.USBError("Replay: Timeout")
+		return data[:size]
+
+class LogTokenDecoder:
+	"Decodes the tokenized debug log records of IRQ_LOGTOK."
+
+	TABLE_FORMAT	= 1
+
+	# printf conversion: flags, width, precision, length, conversion
+	CONVERSION	= re.compile(r"%([#0\- +]*)(\*|\d+)?(?:\.(\*|\d*))?([hl]?)(.)")
+
+	def __init__(self, filename):
+		# The table is generated by firmware/cpu-firmware/logtab.py
+		try:
+			with open(filename, "r") as f:
+				table = json.load(f)
+			if table.get("format") != self.TABLE_FORMAT:
+				raise ValueError("Unsupported format")
+			self.strings = dict((int(fmtId), fmt)
+					    for fmtId, fmt in table["strings"].items())
+		except (IOError, ValueError, KeyError, AttributeError) as e:
+			raise CNCCException("Failed to load log table %s: %s" %\
+					    (filename, str(e)))
+		self.reset()
+
+	def reset(self):
+		self.buf = bytearray()
+
+	def feed(self, start, data):
+		# Feed one IRQ_LOGTOK chunk. Returns the decoded text.
+		if self.buf:
+			# The chunk must continue the incomplete record.
+			need = self.buf[0] - len(self.buf)
+			if not (start == need or
+				(start == ControlIrqLogtok.NOSTART and
+				 (need >= len(data) or data[need] == 0))):
+				# A chunk was dropped. Resynchronize.
+				self.buf = bytearray()
+		if not self.buf:
+			if start == ControlIrqLogtok.NOSTART or start >= len(data):
+				return ""
+			data = data[start:]
+		self.buf += data
+
+		text = ""
+		while self.buf:
+			size = self.buf[0]
+			if size == 0:
+				# Padding at the end of the chunk.
+				self.buf = bytearray()
+			elif size < 3:
+				CNCCException.warn("Invalid log record")
+				self.buf = bytearray()
+			elif len(self.buf) >= size:
+				text += self.__decode(bytes(self.buf[1:size]))
+				del self.buf[:size]
+			else:
+				break
+		return text
+
+	def __decode(self, record):
+		fmtId = record[0] | (record[1] << 8)
+		fmt = self.strings.get(fmtId)
+		if fmt is None:
+			return "<unknown log format 0x%04X>\n" % fmtId
+		args = record[2:]
+		pos = 0
+		text = ""
+		end = 0
+		try:
+			for m in self.CONVERSION.finditer(fmt):
+				text += fmt[end:m.start()]
+				end = m.end()
+				flags, width, prec, length, conv = m.groups()
+				if conv == "%":
+					text += "%"
+					continue
+				if width == "*":
+					width = str(struct.unpack_from("<h", args, pos)[0])
+					pos += 2
+				if prec == "*":
+					prec = str(struct.unpack_from("<h", args, pos)[0])
+					pos += 2
+				spec = "%" + flags + (width or "") +\
+				       ("." + prec if prec is not None else "")
+				if conv == "c":
+					value = chr(args[pos])
+					pos += 1
+				elif conv in "di":
+					if length == "l":
+						value = struct.unpack_from("<i", args, pos)[0]
+						pos += 4
+					else:
+						value = struct.unpack_from("<h", args, pos)[0]
+						pos += 2
+					conv = "d"
+				elif conv in "ouxX":
+					if length == "l":
+						value = struct.unpack_from("<I", args, pos)[0]
+						pos += 4
+					else:
+						value = struct.unpack_from("<H", args, pos)[0]
+						pos += 2
+					if conv == "u":
+						conv = "d"
+				elif conv == "p":
+					value = struct.unpack_from("<H", args, pos)[0]
+					pos += 2
+					spec, conv = "0x%04", "X"
+				elif conv in "sS":
+					nul = args.index(b"\0", pos)
+					value = args[pos:nul].decode("latin-1")
+					pos = nul + 1
+					conv = "s"
+				elif conv in "eEfFgG":
+					value = struct.unpack_from("<f", args, pos)[0]
+					pos += 4
+				else:
+					text += m.group(0)
+					continue
+				text += (spec + conv) % value
+			text += fmt[end:]
+		except (IndexError, ValueError, struct.error):
+			text += "<bad log record 0x%04X>\n" % fmtId
+		return text
+
 class CNCControl:
+	# Interval of the stream polls, while the stream is idle.
+	STREAM_POLL_SEC = 0.02
+
 	def __init__(self, verbose=False):
 		self.deviceAvailable = False
 		self.verbose = verbose
+		self.clock = DeviceClock()
+		self.profiler = PerfProfiler()
+		self.capture = None
+		self.replay = None
+		self.logTokenDecoder = None
+		self.streaming = False
+		self.streamPending = False
+		self.lastStreamPoll = 0.0
+
+	def setCapture(self, filename):
+		# Record all USB traffic to the capture file.
+		self.closeCapture()
+		self.capture = UsbCapture(filename)
+
+	def closeCapture(self):
+		if self.capture:
+			capture, self.capture = self.capture, None
+			capture.close()
+
+	def close(self):
+		# Shutdown. Writes out the capture file.
+		self.closeCapture()
+
+	def setReplay(self, filename, realtime=True):
+		# Replay a capture file instead of talking to the device.
+		self.replay = UsbReplay(filename, realtime)
+
+	def setLogTable(self, filename):
+		# Decode tokenized debug messages with the firmware's log table.
+		# See setDebugging().
+		self.logTokenDecoder = LogTokenDecoder(filename)
+
+	def replayFinished(self):
+		return self.replay is not None and self.replay.finished()
 
 	@staticmethod
 	def __haveEndpoint(interface, epAddress):
@@ -643,6 +1507,12 @@ class CNCControl:
 		if self.deviceAvailable:
 			return True
 		self.__initializeData()
+		if self.replay:
+			if self.replay.finished():
+				return False
+			self.usbh = self.replay
+			self.__devicePlug()
+			return True
 		try:
 			self.usbdev = self.__findDevice(IDVENDOR, IDPRODUCT)
 			if not self.usbdev:
@@ -713,6 +1583,12 @@ class CNCControl:
 		self.spindleState = 0
 		self.feedOverridePercent = 0
 		self.logMsgBuf = ""
+		if self.logTokenDecoder:
+			self.logTokenDecoder.reset()
+		self.streamSeqno = None
+		self.haltEdgeTime = None
+		self.clock.reset()
+		self.clockSupported = True
 
 	def __interpretDevFlags(self, devFlags):
 		if devFlags & ControlMsgDevflags.DEVICE_FLG_ON:
@@ -742,6 +1618,8 @@ class CNCControl:
 	def __deviceUnplug(self):
 		if self.deviceAvailable:
 			self.deviceAvailable = False
+			if self.capture:
+				self.capture.flush()
 			CNCCException.info("device disconnected")
 
 	def __deviceUnplugException(self, message):
@@ -765,10 +1643,22 @@ class CNCControl:
 						       timeoutMs)
 		except usb.USBError as e:
 			if not e.errno:
+				if self.capture:
+					self.capture.record(UsbCapture.REC_IRQ_TIMEOUT)
 				return False # Timeout. No event.
 			self.__usbError(e, origin="eventWait")
 		if data:
+			if self.capture:
+				self.capture.record(UsbCapture.REC_IRQ, data)
 			self.__handleInterrupt(data)
+		if self.streaming:
+			# Each empty poll blocks for the timeout and costs a
+			# device interrupt. Poll again right away only after data.
+			now = time.monotonic()
+			if self.streamPending or\
+			   now - self.lastStreamPoll >= self.STREAM_POLL_SEC:
+				self.lastStreamPoll = now
+				self.streamPending = self.streamPoll() > 0
 		return True
 
 	def __handleInterrupt(self, rawData):
@@ -783,7 +1673,8 @@ class CNCControl:
 			state = self.jogStates[irq.axis]
 			state.set(direction = irq.increment,
 				  incremental = not cont,
-				  velocity = velocity)
+				  velocity = velocity,
+				  edgeTime = self.clock.hostTime(irq.timestamp))
 		elif irq.id == ControlIrq.IRQ_JOG_KEEPALIFE:
 			for jogState in self.jogStates.values():
 				jogState.keepAlife()
@@ -799,26 +1690,39 @@ class CNCControl:
 		elif irq.id == ControlIrq.IRQ_DEVFLAGS:
 			self.__interpretDevFlags(irq.devFlags)
 		elif irq.id == ControlIrq.IRQ_HALT:
+			if self.verbose and irq.latency is not None:
+				CNCCException.info("HALT button latency: %.1f ms" %\
+						   (irq.latency / 1000.0))
 			self.motionHaltRequest = True
+			self.haltEdgeTime = self.clock.hostTime(irq.timestamp)
 			for jogState in self.jogStates.values():
 				jogState.reset()
 			self.spindleCommand = 0
 		elif irq.id == ControlIrq.IRQ_LOGMSG:
-			msg = self.logMsgBuf + irq.msg
-			msg = msg.split('\n')
-			while len(msg) > 1:
-				print("[dev debug]:", msg[0])
-				msg = msg[1:]
-			self.logMsgBuf = msg[0]
+			self.__printLogMsg(irq.msg)
+		elif irq.id == ControlIrq.IRQ_LOGTOK:
+			if self.logTokenDecoder:
+				self.__printLogMsg(self.logTokenDecoder.feed(irq.start,
+									     irq.data))
 		else:
 			CNCCException.warn("Unhandled IRQ: " + str(irq))
 
+	def __printLogMsg(self, text):
+		msg = self.logMsgBuf + text
+		msg = msg.split('\n')
+		while len(msg) > 1:
+			print("[dev debug]:", msg[0])
+			msg = msg[1:]
+		self.logMsgBuf = msg[0]
+
 	def controlMsg(self, msg, timeoutMs=300):
 		try:
 			msg.setSeqno(self.messageSequenceNumber)
 			self.messageSequenceNumber = (self.messageSequenceNumber + 1) & 0xFF
 
 			rawData = msg.getRaw()
+			if self.capture:
+				self.capture.record(UsbCapture.REC_MSG, rawData)
 			size = self.usbh.bulkWrite(EP_OUT, rawData, timeoutMs)
 			if len(rawData) != size:
 				CNCCException.error("Only wrote %d bytes of %d bytes "
@@ -827,20 +1731,101 @@ class CNCControl:
 			self.__usbError(e, origin="controlMsg")
 
 	def controlReply(self, timeoutMs=300):
-		try:
-			data = self.usbh.bulkRead(EP_IN, ControlReply.MAX_SIZE, timeoutMs)
-		except usb.USBError as e:
-			self.__usbError(e, origin="controlReply")
-		return ControlReply.parseRaw(data)
+		while True:
+			try:
+				data = self.usbh.bulkRead(EP_IN, ControlReply.MAX_SIZE,
+							  timeoutMs)
+			except usb.USBError as e:
+				self.__usbError(e, origin="controlReply")
+			reply = ControlReply.parseRaw(data)
+			if reply.id == ControlReply.REPLY_STREAM:
+				# Stream packets may be queued before the reply.
+				self.__handleStream(reply, data)
+				continue
+			if self.capture:
+				self.capture.record(UsbCapture.REC_REPLY, data)
+			return reply
+
+	def streamPoll(self, timeoutMs=1, maxPackets=16):
+		# Read the pending stream packets from the bulk IN endpoint.
+		# Returns the number of packets read.
+		for i in range(maxPackets):
+			try:
+				data = self.usbh.bulkRead(EP_IN, ControlReply.MAX_SIZE,
+							  timeoutMs)
+			except usb.USBError as e:
+				if not e.errno or self.replay:
+					return i # Timeout. No data.
+				self.__usbError(e, origin="streamPoll")
+			if not data:
+				return i
+			reply = ControlReply.parseRaw(data)
+			if reply.id != ControlReply.REPLY_STREAM:
+				CNCCException.warn("Unexpected reply: " + str(reply))
+				continue
+			self.__handleStream(reply, data)
+		return maxPackets
+
+	def __handleStream(self, stream, rawData):
+		if self.capture:
+			self.capture.record(UsbCapture.REC_STREAM, rawData)
+		if self.streamSeqno is not None and\
+		   stream.seqno != self.streamSeqno:
+			CNCCException.warn("Lost %d debug stream packets" %\
+					   ((stream.seqno - self.streamSeqno) & 0xFF))
+			if self.logTokenDecoder:
+				self.logTokenDecoder.reset()
+		self.streamSeqno = (stream.seqno + 1) & 0xFF
+		if stream.streamType == ControlReplyStream.STREAM_LOGMSG:
+			self.__printLogMsg(stream.data.decode("latin-1"))
+		elif stream.streamType == ControlReplyStream.STREAM_LOGTOK:
+			if self.logTokenDecoder:
+				self.__printLogMsg(self.logTokenDecoder.feed(stream.start,
+									     stream.data))
+		else:
+			CNCCException.warn("Unknown stream type %d" % stream.streamType)
 
 	def controlMsgSyncReply(self, msg, timeoutMs=300):
-		self.controlMsg(msg, timeoutMs)
-		reply = self.controlReply(timeoutMs)
+		name = type(msg).__name__[len("ControlMsg"):].lower()
+		with self.profiler.phase("msg." + name):
+			self.controlMsg(msg, timeoutMs)
+			reply = self.controlReply(timeoutMs)
 		if msg.seqno != reply.seqno:
 			CNCCException.error("Got invalid reply sequence number: %d vs %d" %\
 				(msg.seqno, reply.seqno))
 		return reply
 
+	def getStats(self):
+		# Returns ControlReplyStats or None, if unsupported by the firmware.
+		if not self.deviceAvailable:
+			self.__deviceUnplugException()
+		reply = self.controlMsgSyncReply(ControlMsgGetstats())
+		if reply.id == ControlReply.REPLY_ERROR and\
+		   reply.code == ControlReplyError.CTLERR_COMMAND:
+			return None
+		if reply.id != ControlReply.REPLY_STATS:
+			CNCCException.error("Failed to read device stats: %s" % str(reply))
+		return reply
+
+	def syncClock(self):
+		# Take a device clock sample.
+		# Returns False, if unsupported by the firmware.
+		if not self.deviceAvailable:
+			self.__deviceUnplugException()
+		if not self.clockSupported:
+			return False
+		hostSend = time.monotonic()
+		reply = self.controlMsgSyncReply(ControlMsgGettime())
+		hostRecv = time.monotonic()
+		if reply.id == ControlReply.REPLY_ERROR and\
+		   reply.code == ControlReplyError.CTLERR_COMMAND:
+			self.clockSupported = False
+			return False
+		if reply.id != ControlReply.REPLY_VAL16:
+			CNCCException.error("Failed to read device time: %s" % str(reply))
+		self.clock.addSample(hostSend, hostRecv, reply.value)
+		return True
+
 	def setTwohandEnabled(self, enable):
 		if not self.deviceAvailable:
 			self.__deviceUnplugException()
@@ -863,8 +1848,10 @@ class CNCControl:
 			CNCCException.error("Failed to set increment %f at index %d: %s" %\
 				(increment, index, str(reply)))
 
-	def setDebugging(self, debugLevel, usbMessages):
+	def setDebugging(self, debugLevel, usbMessages, stream=False):
 		# 0 => disabled, 1 => enabled, 2 => verbose
+		# stream: Read the USB messages from the bulk IN stream
+		# instead of the interrupt endpoint. See streamPoll().
 		if not self.deviceAvailable:
 			self.__deviceUnplugException()
 		flg = ControlMsgDevflags.DEVICE_FLG_NODEBUG
@@ -874,13 +1861,21 @@ class CNCControl:
 			flg |= ControlMsgDevflags.DEVICE_FLG_VERBOSEDBG
 		if usbMessages:
 			flg |= ControlMsgDevflags.DEVICE_FLG_USBLOGMSG
+			# Firmware without tokenized messages ignores this flag.
+			if self.logTokenDecoder:
+				flg |= ControlMsgDevflags.DEVICE_FLG_USBLOGTOK
+			if stream:
+				flg |= ControlMsgDevflags.DEVICE_FLG_USBSTREAM
 		msg = ControlMsgDevflags(ControlMsgDevflags.DEVICE_FLG_NODEBUG |
 					 ControlMsgDevflags.DEVICE_FLG_VERBOSEDBG |
-					 ControlMsgDevflags.DEVICE_FLG_USBLOGMSG,
+					 ControlMsgDevflags.DEVICE_FLG_USBLOGMSG |
+					 ControlMsgDevflags.DEVICE_FLG_USBLOGTOK |
+					 ControlMsgDevflags.DEVICE_FLG_USBSTREAM,
 					 flg)
 		reply = self.controlMsgSyncReply(msg)
 		if not reply.isOK():
 			CNCCException.error("Failed to set debugging flags")
+		self.streaming = bool(usbMessages and stream)
 
 	def setEstopState(self, asserted):
 		# Send the estop state to the device
@@ -906,6 +1901,17 @@ class CNCControl:
 		self.motionHaltRequest = False
 		return halt
 
+	def popHaltEdgeTime(self):
+		# Returns the host time of the last HALT button edge, or None.
+		edgeTime, self.haltEdgeTime = self.haltEdgeTime, None
+		return edgeTime
+
+	def popJogEdgeTime(self, axis):
+		# Returns the host time of the last jog input edge, or None.
+		if not self.deviceAvailable:
+			self.__deviceUnplugException()
+		return self.jogStates[axis].popEdgeTime()
+
 	def getSpindleCommand(self):
 		# Returns -1, 0 or 1 for reverse, stop or forward.
 		if not self.deviceAvailable:
@@ -12,6 +12,8 @@ import sys
 import os
 import errno
 import time
+import getopt
+from collections import deque
 from datetime import datetime, timedelta
 import hal
 from hal import HAL_BIT, HAL_U32, HAL_S32, HAL_FLOAT
@@ -83,6 +85,108 @@ class ValueBalance:
 		else:
 			self.incBit.startDuty()
 
+class DeviceStats:
+	# Device counter name => HAL pin name
+	COUNTERS = (
+		("irqQueueDrops",	"stats.irq-queue.drops"),
+		("spiRetries",		"stats.spi.retries"),
+		("lcdCommits",		"stats.lcd.commits"),
+		("usbIrqs",		"stats.usb.irqs"),
+		("dbgOverruns",		"stats.debug.overruns"),
+		("uartDrops",		"stats.uart.drops"),
+	)
+	# Device value name => HAL pin name
+	VALUES = (
+		("mainloopRate",	"stats.mainloop.rate"),
+		("irqQueueHwm",		"stats.irq-queue.hwm"),
+		("lcdTimeMax",		"stats.lcd.time-max-us"),
+		("usbIrqMax",		"stats.usb.irq-max-us"),
+	)
+
+	def __init__(self, h):
+		self.h = h
+		self.reset()
+
+	@classmethod
+	def createHalPins(cls, h):
+		for name, pin in cls.COUNTERS + cls.VALUES:
+			h.newpin(pin, HAL_U32, HAL_OUT)
+
+	def reset(self):
+		self.supported = True
+		self.last = None
+
+	def update(self, stats):
+		# The device counters are 16 bit wide. Extend them to 32 bit.
+		h = self.h
+		for name, pin in self.COUNTERS:
+			value = getattr(stats, name)
+			if self.last is not None:
+				delta = (value - getattr(self.last, name)) & 0xFFFF
+				h[pin] = (h[pin] + delta) & 0xFFFFFFFF
+		for name, pin in self.VALUES:
+			h[pin] = getattr(stats, name)
+		self.last = stats
+
+class LatencyStats:
+	"""Device input edge to HAL pin change latency."""
+
+	WINDOW = 256 # Number of recent events to evaluate
+
+	def __init__(self, h, name):
+		self.h = h
+		self.name = name
+		self.prefix = "latency.%s." % name
+		self.samples = deque(maxlen=self.WINDOW)
+
+	@staticmethod
+	def createHalPins(h, name):
+		prefix = "latency.%s." % name
+		h.newpin(prefix + "min-ms", HAL_FLOAT, HAL_OUT)
+		h.newpin(prefix + "avg-ms", HAL_FLOAT, HAL_OUT)
+		h.newpin(prefix + "p99-ms", HAL_FLOAT, HAL_OUT)
+		h.newpin(prefix + "count", HAL_U32, HAL_OUT)
+
+	def add(self, edgeTime, verbose=False):
+		# The clock sync error may be bigger than a very short latency.
+		ms = max(time.monotonic() - edgeTime, 0.0) * 1000.0
+		self.samples.append(ms)
+		ordered = sorted(self.samples)
+		p99 = ordered[min(int(len(ordered) * 0.99), len(ordered) - 1)]
+		avg = sum(ordered) / len(ordered)
+		h, prefix = self.h, self.prefix
+		h[prefix + "min-ms"] = ordered[0]
+		h[prefix + "avg-ms"] = avg
+		h[prefix + "p99-ms"] = p99
+		h[prefix + "count"] = (h[prefix + "count"] + 1) & 0xFFFFFFFF
+		if verbose:
+			print("CNC-Control: %s latency %.1f ms "
+			      "(min %.1f, avg %.1f, p99 %.1f ms)" %\
+			      (self.name, ms, ordered[0], avg, p99))
+
+class PerfPins:
+	# Profiler phases that are exported as HAL pins
+	PHASES = ("loop", "event-wait", "msg", "pins", "jog", "axis")
+
+	def __init__(self, h, profiler):
+		self.h = h
+		self.profiler = profiler
+
+	@classmethod
+	def createHalPins(cls, h):
+		for phase in cls.PHASES:
+			h.newpin("perf.%s.p50-us" % phase, HAL_FLOAT, HAL_OUT)
+			h.newpin("perf.%s.p99-us" % phase, HAL_FLOAT, HAL_OUT)
+			h.newpin("perf.%s.max-us" % phase, HAL_FLOAT, HAL_OUT)
+
+	def update(self):
+		h = self.h
+		for phase in self.PHASES:
+			hist = self.profiler.get(phase)
+			h["perf.%s.p50-us" % phase] = hist.percentile(50)
+			h["perf.%s.p99-us" % phase] = hist.percentile(99)
+			h["perf.%s.max-us" % phase] = hist.max
+
 class CNCControlHAL(CNCControl):
 	def __init__(self, halName="cnccontrol"):
 		CNCControl.__init__(self, verbose=True)
@@ -93,6 +197,11 @@ class CNCControlHAL(CNCControl):
 		self.__createHalPins()
 		self.h.ready()
 
+		self.stats = DeviceStats(self.h)
+		self.jogLatency = LatencyStats(self.h, "jog")
+		self.haltLatency = LatencyStats(self.h, "halt")
+		self.perfPins = PerfPins(self.h, self.profiler)
+
 		self.foBalance = ValueBalance(self.h, self.tk,
 				scalePin="feed-override.scale",
 				incPin="feed-override.inc",
@@ -132,7 +241,9 @@ class CNCControlHAL(CNCControl):
 		h.newparam("config.twohand", HAL_BIT, HAL_RW)
 		h.newparam("config.debug", HAL_U32, HAL_RW)
 		h.newparam("config.debugperf", HAL_BIT, HAL_RW)
+		h.newparam("config.debuglatency", HAL_BIT, HAL_RW)
 		h.newparam("config.usblogmsg", HAL_BIT, HAL_RW)
+		h.newparam("config.usbstream", HAL_BIT, HAL_RW)
 
 		# Machine state
 		h.newpin("machine.on", HAL_BIT, HAL_IN)
@@ -178,6 +289,16 @@ class CNCControlHAL(CNCControl):
 		# Program control
 		h.newpin("program.stop", HAL_BIT, HAL_OUT)
 
+		# Device performance counters
+		DeviceStats.createHalPins(h)
+
+		# Input latency
+		LatencyStats.createHalPins(h, "jog")
+		LatencyStats.createHalPins(h, "halt")
+
+		# Host driver profiler
+		PerfPins.createHalPins(h)
+
 	def __resetHalOutputPins(self):
 		h = self.h
 
@@ -208,12 +329,19 @@ class CNCControlHAL(CNCControl):
 		# CNC-Control USB device connected. Initialize it.
 		h = self.h
 		self.deviceReset()
-		self.setDebugging(h["config.debug"], h["config.usblogmsg"])
+		self.stats.reset()
+		self.setDebugging(h["config.debug"], h["config.usblogmsg"],
+				  h["config.usbstream"])
 		self.setTwohandEnabled(h["config.twohand"])
 		for i in range(0, ControlMsgSetincrement.MAX_INDEX + 1):
 			self.setIncrementAtIndex(i, h["jog.increment.%d" % i])
 		axes = [ax if h["axis.%s.enable" % ax] else "" for ax in ALL_AXES]
 		self.setEnabledAxes([_f for _f in axes if _f])
+		for i in range(0, DeviceClock.WINDOW):
+			if not self.syncClock():
+				print("CNC-Control: Device firmware does not support "
+				      "latency measurement")
+				break
 
 	def __pingDevice(self):
 		for i in range(0, 3):
@@ -222,6 +350,16 @@ class CNCControlHAL(CNCControl):
 		else:
 			CNCCFatal.error("Failed to ping the device")
 
+	def __updateStats(self):
+		if not self.stats.supported:
+			return
+		stats = self.getStats()
+		if stats is None:
+			print("CNC-Control: Device firmware does not support stats")
+			self.stats.supported = False
+			return
+		self.stats.update(stats)
+
 	def __updatePins(self):
 		h = self.h
 
@@ -234,6 +372,10 @@ class CNCControlHAL(CNCControl):
 		# Halt the program, if requested
 		if self.haveMotionHaltRequest():
 			self.programStop.startDuty()
+			edgeTime = self.popHaltEdgeTime()
+			if edgeTime is not None:
+				self.haltLatency.add(edgeTime,
+						     h["config.debuglatency"])
 		self.programStop.update()
 
 		# Update master spindle state
@@ -270,17 +412,28 @@ class CNCControlHAL(CNCControl):
 		self.setFeedOverrideState(h["feed-override.value"] * 100)
 
 		# Update jog states
+		with self.profiler.phase("jog"):
+			self.__updateJogPins()
+
+		# Update axis states
+		with self.profiler.phase("axis"):
+			self.__updateAxisPins()
+
+	def __updateJogPins(self):
+		h = self.h
+
 		velocity = h["jog.velocity-rapid"]
 		jogParams = {}
 		for ax in ALL_AXES:
 			if not h["axis.%s.enable" % ax]:
 				continue
+			edgeTime = self.popJogEdgeTime(ax)
 			(direction, incremental, vel) = self.getJogState(ax)
 			if not equal(direction, 0.0):
 				if vel < 0: # Rapid move
 					vel = h["jog.velocity-rapid"]
 				velocity = min(velocity, vel)
-			jogParams[ax] = (direction, incremental)
+			jogParams[ax] = (direction, incremental, edgeTime)
 		h["jog.velocity"] = velocity
 		for ax in jogParams:
 			self.incJogPlus[ax].update()
@@ -289,7 +442,7 @@ class CNCControlHAL(CNCControl):
 				h["jog.%s.minus" % ax] = 0
 				h["jog.%s.plus" % ax] = 0
 				continue
-			(direction, incremental) = jogParams[ax]
+			(direction, incremental, edgeTime) = jogParams[ax]
 			if incremental and not equal(direction, 0.0):
 				h["jog.%s.minus" % ax] = 0
 				h["jog.%s.plus" % ax] = 0
@@ -310,8 +463,13 @@ class CNCControlHAL(CNCControl):
 				else: # stop
 					h["jog.%s.minus" % ax] = 0
 					h["jog.%s.plus" % ax] = 0
+			if edgeTime is not None:
+				self.jogLatency.add(edgeTime,
+						    h["config.debuglatency"])
+
+	def __updateAxisPins(self):
+		h = self.h
 
-		# Update axis states
 		g53coords = self.wantG53Coords()
 		for ax in ALL_AXES:
 			if not h["axis.%s.enable" % ax]:
@@ -322,39 +480,46 @@ class CNCControlHAL(CNCControl):
 				pos = h["axis.%s.pos.user-coords" % ax]
 			self.setAxisPosition(ax, pos)
 
+	def __updatePerf(self):
+		# Publish and restart the profiler window.
+		self.perfPins.update()
+		if self.h["config.debugperf"]:
+			print("CNC-Control: Event loop profile:")
+			for line in self.profiler.summary():
+				print("  " + line)
+		self.profiler.reset()
+
 	def __eventLoop(self):
-		avgRuntime = 0
-		lastRuntimePrint = -1
 		lastPing = -1
-		timeDebug = bool(self.h["config.debugperf"])
+		self.profiler.reset()
 		while self.__checkLinuxCNC():
 			self.tk.update()
-			start = self.tk.now
+			start = time.perf_counter()
 			try:
-				if start.second != lastPing:
-					lastPing = start.second
+				if self.tk.now.second != lastPing:
+					lastPing = self.tk.now.second
+					self.__updatePerf()
 					self.__pingDevice()
-				self.eventWait()
+					self.__updateStats()
+					self.syncClock()
+				with self.profiler.phase("event-wait"):
+					self.eventWait()
 				self.tk.update()
 				# Update pins, even if we didn't receive an event.
-				self.__updatePins()
+				with self.profiler.phase("pins"):
+					self.__updatePins()
 			except CNCCFatal as e:
 				raise # Drop out of event loop and re-probe device.
 			except CNCCException as e:
 				print("CNC-Control error: " + str(e))
-			if not timeDebug:
-				continue
-			self.tk.update()
-			runtime = (self.tk.now - start).microseconds
-			avgRuntime = (avgRuntime + runtime) // 2
-			if start.second != lastRuntimePrint:
-				lastRuntimePrint = start.second
-				print("Average event loop runtime = %.1f milliseconds" %\
-					(float(avgRuntime) / 1000))
+			self.profiler.add("loop", time.perf_counter() - start)
 
 	def probeLoop(self):
 		self.__resetHalOutputPins()
 		while self.__checkLinuxCNC():
+			if self.replayFinished():
+				print("CNC-Control: Replay finished")
+				break
 			try:
 				if self.probe():
 					self.__deviceInitialize()
@@ -367,13 +532,49 @@ class CNCControlHAL(CNCControl):
 				print("CNC-Control error: " + str(e))
 			self.__resetHalOutputPins()
 
+def usage():
+	print("linuxcnchal_cnccontrol.py [OPTIONS]")
+	print("")
+	print(" -c|--capture FILE           Record the USB traffic to a capture file")
+	print(" -r|--replay FILE            Replay a capture file instead of using the device")
+	print(" -f|--replay-fast            Replay as fast as possible")
+	print(" -l|--logtab FILE            Log table of the firmware (cnc-control.cpu.logtab)")
+	print("                             Enables tokenized USB debug messages")
+
 def main():
+	capture, replay, realtime, logtab = None, None, True, None
+	try:
+		(opts, args) = getopt.getopt(sys.argv[1:],
+			"hc:r:fl:",
+			[ "help", "capture=", "replay=", "replay-fast", "logtab=", ])
+	except getopt.GetoptError:
+		usage()
+		return 1
+	for (o, v) in opts:
+		if o in ("-h", "--help"):
+			usage()
+			return 0
+		if o in ("-c", "--capture"):
+			capture = v
+		if o in ("-r", "--replay"):
+			replay = v
+		if o in ("-f", "--replay-fast"):
+			realtime = False
+		if o in ("-l", "--logtab"):
+			logtab = v
+	cncc = None
 	try:
 		try:
 			os.nice(-20)
 		except OSError as e:
 			print("WARNING: Failed to renice cnccontrol HAL module:", str(e))
 		cncc = CNCControlHAL()
+		if capture:
+			cncc.setCapture(capture)
+		if replay:
+			cncc.setReplay(replay, realtime)
+		if logtab:
+			cncc.setLogTable(logtab)
 		cncc.probeLoop()
 	except CNCCException as e:
 		print("CNC-Control: Unhandled exception: " + str(e))
@@ -381,6 +582,12 @@ def main():
 	except KeyboardInterrupt as e:
 		print("CNC-Control: shutdown")
 		return 0
+	finally:
+		if cncc:
+			try:
+				cncc.close()
+			except CNCCException as e:
+				print("CNC-Control: " + str(e))
 
 if __name__ == "__main__":
 	sys.exit(main())
@@ -1,7 +1,7 @@
 ######################################################
 # AVR make library                                   #
 # Copyright (c) 2015-2016 Michael Buesch <m@bues.ch> #
-# Version 1.5                                        #
+# Version 1.6                                        #
 ######################################################
 
 ifeq ($(NAME),)
@@ -34,6 +34,7 @@ RM			:= rm
 CP			:= cp
 ECHO			:= echo
 GREP			:= grep
+AWK			:= awk
 TRUE			:= true
 TEST			:= test
 AVRDUDE			:= avrdude
@@ -223,9 +224,22 @@ $(HEX): $(BIN)
 	 || $(TRUE)
 	$(QUIET_SIZE) --format=SysV $(BIN)
 
+# The bootloader must fit between BOOT_OFFSET and the end of the flash.
+define _check_boot_size
+  size="$$($(SIZE) --format=Berkeley $(BOOT_BIN) | \
+	   $(AWK) 'NR == 2 { print $$1 + $$2 }')"; \
+  max="$$(( $(FLASH_SIZE) - $(BOOT_OFFSET) ))"; \
+  $(TEST) "$$size" -le "$$max" || { \
+    $(ECHO) "$(BOOT_BIN): $$size bytes exceed the $$max bytes boot section"; \
+    $(RM) -f $(BOOT_HEX); \
+    exit 1; \
+  }
+endef
+
 $(BOOT_HEX): $(BOOT_BIN)
 	$(QUIET_OBJCOPY) -R.eeprom -O ihex $(BOOT_BIN) $(BOOT_HEX)
 	$(QUIET_SIZE) --format=SysV $(BOOT_BIN)
+	$(if $(FLASH_SIZE),@$(_check_boot_size))
 
 define _avrdude_interactive
   $(AVRDUDE) -B $(AVRDUDE_SPEED) -p $(AVRDUDE_ARCH) \
@@ -133,6 +133,17 @@ static noinline uint8_t spi_xfer_sync(uint8_t tx)
 	return data;
 }
 
+/* Receive @size bytes without handshake between them. */
+static void spi_rx_block(uint8_t *buf, uint8_t size)
+{
+	spi_busy(0);
+	do {
+		spi_transwait();
+		*buf++ = SPDR;
+	} while (--size);
+	spi_busy(1);
+}
+
 static noreturn noinline void exit_bootloader(void)
 {
 	irq_disable();
@@ -195,7 +206,7 @@ static noinline uint8_t calc_crc8(uint8_t crc, uint8_t data)
 	return spi_crc8(crc, data);
 }
 
-static void do_flash(void)
+static void do_flash(bool block)
 {
 	uint8_t data, addr_lo, addr_hi;
 	uint8_t crc = 0, expected_crc;
@@ -208,9 +219,15 @@ static void do_flash(void)
 	crc = calc_crc8(crc, addr_hi);
 	page_address = (uint16_t)addr_lo | ((uint16_t)addr_hi << 8);
 
+	if (block)
+		spi_rx_block(page_buffer, sizeof(page_buffer));
 	for (i = 0; i < ARRAY_SIZE(page_buffer); i++) {
-		data = spi_xfer_sync(0);
-		page_buffer[i] = data;
+		if (block) {
+			data = page_buffer[i];
+		} else {
+			data = spi_xfer_sync(0);
+			page_buffer[i] = data;
+		}
 		crc = calc_crc8(crc, data);
 	}
 
@@ -231,6 +248,29 @@ static void do_flash(void)
 		spi_xfer_sync(SPI_RESULT_FAIL);
 }
 
+static void do_pagecrc(void)
+{
+	uint8_t addr_lo, addr_hi, crc;
+	uint16_t page_address, i, page_crc = 0xFFFF;
+
+	addr_lo = spi_xfer_sync(0);
+	addr_hi = spi_xfer_sync(0);
+	page_address = (uint16_t)addr_lo | ((uint16_t)addr_hi << 8);
+	page_address &= (uint16_t)~(SPM_PAGESIZE - 1u);
+
+	for (i = 0; i < SPM_PAGESIZE; i++) {
+		wdt_reset();
+		page_crc = spi_page_crc(page_crc,
+			pgm_read_byte((void PROGPTR *)(void *)(page_address + i)));
+	}
+
+	crc = calc_crc8(0, lo8(page_crc));
+	crc = calc_crc8(crc, hi8(page_crc));
+	spi_xfer_sync(lo8(page_crc));
+	spi_xfer_sync(hi8(page_crc));
+	spi_xfer_sync(crc ^ 0xFF);
+}
+
 static void handle_spi(void)
 {
 	uint8_t data, txdata = 0;
@@ -251,7 +291,16 @@ static void handle_spi(void)
 			exit_bootloader();
 			break;
 		case SPI_CONTROL_STARTFLASH:
-			do_flash();
+			do_flash(0);
+			break;
+		case SPI_CONTROL_FLASHBLOCK:
+			do_flash(1);
+			break;
+		case SPI_CONTROL_PAGECRC:
+			do_pagecrc();
+			break;
+		case SPI_CONTROL_BOOTCAPS:
+			txdata = SPI_BOOTCAP_PAGECRC | SPI_BOOTCAP_FLASHBLOCK;
 			break;
 		default:
 			/* Ignore unknown commands */
@@ -20,6 +20,7 @@
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
+#include <avr/sleep.h>
 
 #include <stdint.h>
 
@@ -27,8 +28,33 @@
 typedef uint16_t jiffies_t;
 
 
-#define BUTTON_DEBOUNCE		msec2jiffies(40)
-#define ENC_DEBOUNCE		usec2jiffies(3500)
+/* Debounce times. Can be overridden from the Makefile. */
+#ifndef BUTTON_DEBOUNCE_MS
+# define BUTTON_DEBOUNCE_MS	40
+#endif
+/* The HALT button uses a short debounce on press. */
+#ifndef HALT_PRESS_DEBOUNCE_MS
+# define HALT_PRESS_DEBOUNCE_MS	2
+#endif
+#ifndef ENC_DEBOUNCE_US
+# define ENC_DEBOUNCE_US	3500
+#endif
+
+#define BUTTON_DEBOUNCE		msec2jiffies(BUTTON_DEBOUNCE_MS)
+#define HALT_PRESS_DEBOUNCE	msec2jiffies(HALT_PRESS_DEBOUNCE_MS)
+#define ENC_DEBOUNCE		usec2jiffies(ENC_DEBOUNCE_US)
+
+/* Input sample rate, in Hz.
+ * The inputs are sampled from the Timer2 compare interrupt.
+ * The worst case latency from an input edge to the update of the
+ * software state (and the trans-IRQ to the master) is
+ * debounce time + 2 sample periods. */
+#ifndef SAMPLE_RATE_HZ
+# define SAMPLE_RATE_HZ		5000
+#endif
+#if SAMPLE_RATE_HZ < 2000 || SAMPLE_RATE_HZ > 10000
+# error "SAMPLE_RATE_HZ out of range"
+#endif
 
 
 /* Hardware state of a button */
@@ -36,6 +62,7 @@ struct button_hwstate {
 	bool state;			/* 1 = pressed, 0 = released */
 	bool synchronized;		/* Is synchronized with software state? */
 	jiffies_t sync_deadline;	/* Deadline for sync */
+	jiffies_t edge_time;		/* Time of the first unsynchronized edge */
 };
 
 /* Hardware state of a torque encoder */
@@ -49,6 +76,7 @@ struct encoder_hwstate {
 /* Software state of a torque encoder */
 struct encoder_swstate {
 	int8_t state;
+	int8_t sent;		/* Sent, but not acknowledged, yet */
 };
 
 static struct button_hwstate hwstates[14];
@@ -56,6 +84,25 @@ static uint16_t swstates;
 static struct encoder_hwstate enc_hwstates[1];
 static struct encoder_swstate enc_swstates[1];
 
+/* Button input event */
+struct input_event {
+	uint8_t id;			/* SPI_EVENT_... */
+	jiffies_t time;			/* Time of the edge */
+};
+
+/* Input event FIFO. Size must be a power of two. */
+#define EVENT_FIFO_SIZE		8
+static struct input_event event_fifo[EVENT_FIFO_SIZE];
+static uint8_t event_fifo_in;
+static uint8_t event_fifo_out;
+/* Number of events sent, but not acknowledged, yet */
+static uint8_t event_fifo_sent;
+/* The FIFO was empty during this fetch */
+static bool event_fifo_drained;
+
+/* Set by the sampler. Cleared by the main loop. */
+static bool sampler_ran;
+
 
 /* Convert 2bit graycode to binary */
 static inline uint8_t gray2bin_2bit(uint8_t graycode)
@@ -75,12 +122,14 @@ static void jiffies_init(void)
 	TIMSK = 0;
 	TCCR1A = 0;
 	TCCR1B = (0 << CS10) | (0 << CS11) | (1 << CS12);
+
+	BUILD_BUG_ON(JPS != SPI_TIMESTAMP_HZ);
 }
 
 #define msec2jiffies(ms)	((jiffies_t)((uint32_t)(ms) * JPS / (uint32_t)1000))
 #define usec2jiffies(us)	((jiffies_t)((uint32_t)(us) * JPS / (uint32_t)1000000))
 
-#define time_after(a, b)	((int16_t)(b) - (int16_t)(a) < 0)
+#define time_after(a, b)	((int16_t)((jiffies_t)(b) - (jiffies_t)(a)) < 0)
 #define time_before(a, b)	time_after(b, a)
 
 static inline jiffies_t jiffies_get(void)
@@ -90,12 +139,16 @@ static inline jiffies_t jiffies_get(void)
 
 static inline void do_button_read(struct button_hwstate *hw,
 				  bool state,
-				  jiffies_t timestamp)
+				  jiffies_t timestamp,
+				  jiffies_t press_debounce)
 {
 	if (state != hw->state) {
+		if (hw->synchronized)
+			hw->edge_time = timestamp;
 		hw->state = state;
 		hw->synchronized = 0;
-		hw->sync_deadline = timestamp + BUTTON_DEBOUNCE;
+		hw->sync_deadline = (jiffies_t)(timestamp +
+				(state ? press_debounce : BUTTON_DEBOUNCE));
 	}
 }
 
@@ -126,20 +179,20 @@ static void buttons_read(void)
 	now = jiffies_get();
 
 	/* Interpret the buttons */
-	do_button_read(&hwstates[0], !(b & (1 << 0)), now);
-	do_button_read(&hwstates[1], !(b & (1 << 1)), now);
-	do_button_read(&hwstates[2], !(c & (1 << 0)), now);
-	do_button_read(&hwstates[3], !(c & (1 << 1)), now);
-	do_button_read(&hwstates[4], !(c & (1 << 2)), now);
-	do_button_read(&hwstates[5], !(c & (1 << 3)), now);
-	do_button_read(&hwstates[6], !(c & (1 << 4)), now);
-	do_button_read(&hwstates[7], !(c & (1 << 5)), now);
-	do_button_read(&hwstates[8], !(d & (1 << 0)), now);
-	do_button_read(&hwstates[9], !(d & (1 << 1)), now);
-	do_button_read(&hwstates[10], !(d & (1 << 2)), now);
-	do_button_read(&hwstates[11], !(d & (1 << 3)), now);
-	do_button_read(&hwstates[12], !(d & (1 << 4)), now);
-	do_button_read(&hwstates[13], !(d & (1 << 5)), now);
+	do_button_read(&hwstates[0], !(b & (1 << 0)), now, HALT_PRESS_DEBOUNCE);
+	do_button_read(&hwstates[1], !(b & (1 << 1)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[2], !(c & (1 << 0)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[3], !(c & (1 << 1)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[4], !(c & (1 << 2)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[5], !(c & (1 << 3)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[6], !(c & (1 << 4)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[7], !(c & (1 << 5)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[8], !(d & (1 << 0)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[9], !(d & (1 << 1)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[10], !(d & (1 << 2)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[11], !(d & (1 << 3)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[12], !(d & (1 << 4)), now, BUTTON_DEBOUNCE);
+	do_button_read(&hwstates[13], !(d & (1 << 5)), now, BUTTON_DEBOUNCE);
 	BUILD_BUG_ON(ARRAY_SIZE(hwstates) != 14);
 	BUILD_BUG_ON(ARRAY_SIZE(hwstates) > sizeof(swstates) * 8);
 
@@ -178,21 +231,82 @@ static void trigger_trans_interrupt(void)
 					    (1u << SPI_SLAVE_TRANSIRQ_BIT));
 }
 
+/* Queue an input event. Runs in IRQ context. */
+static void event_fifo_put(uint8_t id, jiffies_t time)
+{
+	struct input_event *ev;
+
+	BUILD_BUG_ON(EVENT_FIFO_SIZE & (EVENT_FIFO_SIZE - 1));
+
+	if ((uint8_t)(event_fifo_in - event_fifo_out) >= EVENT_FIFO_SIZE) {
+		/* FIFO overflow. Drop the event.
+		 * The master still gets the final state via GETLOW/GETHIGH. */
+		return;
+	}
+	ev = &event_fifo[event_fifo_in & (EVENT_FIFO_SIZE - 1)];
+	ev->id = id;
+	ev->time = time;
+	event_fifo_in++;
+}
+
+/* Start a fetch. Send all events again,
+ * that were not acknowledged. Runs in IRQ context. */
+static void event_fifo_rewind(void)
+{
+	event_fifo_sent = 0;
+	event_fifo_drained = 0;
+}
+
+/* Get the next input event to send.
+ * It stays queued until it is acknowledged.
+ * Runs in IRQ context. */
+static void event_fifo_peek(struct input_event *ev)
+{
+	uint8_t pos = (uint8_t)(event_fifo_out + event_fifo_sent);
+
+	if (event_fifo_drained || event_fifo_in == pos) {
+		/* The master stops at the first empty event.
+		 * Events queued after it go to the next fetch. */
+		event_fifo_drained = 1;
+		ev->id = SPI_EVENT_NONE;
+		ev->time = 0;
+		return;
+	}
+	*ev = event_fifo[pos & (EVENT_FIFO_SIZE - 1)];
+	event_fifo_sent++;
+}
+
+/* The master received the sent data. Drop it.
+ * Runs in IRQ context. */
+static void spi_data_ack(void)
+{
+	event_fifo_out = (uint8_t)(event_fifo_out + event_fifo_sent);
+	event_fifo_sent = 0;
+	enc_swstates[0].state = (int8_t)(enc_swstates[0].state -
+					 enc_swstates[0].sent);
+	enc_swstates[0].sent = 0;
+}
+
 static inline uint8_t do_sync_button(struct button_hwstate *hw,
 				     uint8_t swstate_bit,
 				     jiffies_t now)
 {
 	bool state;
+	uint16_t old_swstates;
 
 	if (!hw->synchronized) {
 		if (time_after(now, hw->sync_deadline)) {
 			state = hw->state;
-			irq_disable();
+			old_swstates = swstates;
 			if (state)
 				swstates |= (1u << swstate_bit);
 			else
 				swstates &= ~(1u << swstate_bit);
-			irq_enable();
+			if (swstates != old_swstates) {
+				event_fifo_put((uint8_t)(swstate_bit |
+					(state ? SPI_EVENT_PRESSED : 0u)),
+					hw->edge_time);
+			}
 			hw->synchronized = 1;
 
 			return 1;
@@ -215,17 +329,11 @@ static inline uint8_t do_sync_encoder(struct encoder_hwstate *hw,
 			hw->prev_gray = hw->gray;
 			hw->synchronized = 1;
 			if (cur == ((prev + 1) & 3)) {
-				irq_disable();
 				sw->state--;
-				irq_enable();
-
 				return 1;
 			}
 			if (cur == ((prev - 1) & 3)) {
-				irq_disable();
 				sw->state++;
-				irq_enable();
-
 				return 1;
 			}
 		}
@@ -234,7 +342,8 @@ static inline uint8_t do_sync_encoder(struct encoder_hwstate *hw,
 	return 0;
 }
 
-/* Synchronize the software state of the buttons */
+/* Synchronize the software state of the buttons.
+ * Runs in IRQ context. */
 static void buttons_synchronize(void)
 {
 	uint8_t i, one_state_changed = 0;
@@ -259,17 +368,41 @@ static void buttons_synchronize(void)
 		trigger_trans_interrupt();
 }
 
+/* Input sampler.
+ * This is a blocking ISR, so it is serialized against the SPI ISR. */
+ISR(TIMER2_COMP_vect)
+{
+	buttons_read();
+	buttons_synchronize();
+	sampler_ran = 1;
+}
+
+static void sampler_init(void)
+{
+	/* Timer2 in CTC mode. 8M/32=250k */
+	TCCR2 = 0;
+	TCNT2 = 0;
+	OCR2 = (uint8_t)(250000ul / SAMPLE_RATE_HZ - 1ul);
+	TIFR = (1 << OCF2);
+	TIMSK |= (1 << OCIE2);
+	TCCR2 = (1 << WGM21) | (1 << CS21) | (1 << CS20);
+}
+
 static noreturn void enter_bootloader(void)
 {
 	irq_disable();
 	wdt_reset();
 
 	/* Jump to bootloader code */
+#ifdef SIMULATOR
+	sim_enter_bootloader();
+#else
 	__asm__ __volatile__(
 	"ijmp\n"
 	: /* None */
 	: [_Z]		"z" (BOOT_OFFSET / 2)
 	);
+#endif
 	unreachable();
 }
 
@@ -278,6 +411,10 @@ ISR(SPI_STC_vect)
 	uint8_t data;
 	static uint8_t checksum;
 	static bool enterboot_first_stage_done;
+	static uint8_t event_byte;
+	static bool event_fetch;
+	static struct input_event event;
+	static jiffies_t time_latch;
 
 	data = SPDR;
 
@@ -297,6 +434,11 @@ ISR(SPI_STC_vect)
 		enterboot_first_stage_done = 0;
 	}
 
+	if (data != SPI_CONTROL_GETEVENT) {
+		event_byte = 0;
+		event_fetch = 0;
+	}
+
 	switch (data) {
 	case SPI_CONTROL_GETLOW:
 		data = swstates & 0xFF;
@@ -308,7 +450,39 @@ ISR(SPI_STC_vect)
 		break;
 	case SPI_CONTROL_GETENC:
 		data = (uint8_t)(enc_swstates[0].state);
-		enc_swstates[0].state = 0;
+		enc_swstates[0].sent = (int8_t)data;
+		checksum ^= data;
+		break;
+	case SPI_CONTROL_GETEVENT:
+		if (!event_fetch) {
+			event_fifo_rewind();
+			event_fetch = 1;
+		}
+		switch (event_byte) {
+		case 0:
+		default:
+			event_fifo_peek(&event);
+			data = event.id;
+			event_byte = 1;
+			break;
+		case 1:
+			data = lo8(event.time);
+			event_byte = 2;
+			break;
+		case 2:
+			data = hi8(event.time);
+			event_byte = 0;
+			break;
+		}
+		checksum ^= data;
+		break;
+	case SPI_CONTROL_GETTIMELO:
+		time_latch = jiffies_get();
+		data = lo8(time_latch);
+		checksum ^= data;
+		break;
+	case SPI_CONTROL_GETTIMEHI:
+		data = hi8(time_latch);
 		checksum ^= data;
 		break;
 	case SPI_CONTROL_GETSUM:
@@ -319,6 +493,11 @@ ISR(SPI_STC_vect)
 		data = SPI_RESULT_OK;
 		checksum = 0;
 		break;
+	case SPI_CONTROL_ACKEVENTS:
+		spi_data_ack();
+		data = 0;
+		checksum = 0;
+		break;
 	case SPI_CONTROL_ENTERAPP:
 	case SPI_CONTROL_NOP:
 	default:
@@ -355,11 +534,18 @@ int main(void)
 	jiffies_init();
 	buttons_init();
 	spi_init();
+	sampler_init();
 
+	set_sleep_mode(SLEEP_MODE_IDLE);
 	irq_enable();
 	while (1) {
-		buttons_read();
-		buttons_synchronize();
-		wdt_reset();
+		/* Everything is done in IRQ context. */
+		sleep_mode();
+
+		mb();
+		if (sampler_ran) {
+			sampler_ran = 0;
+			wdt_reset();
+		}
 	}
 }
@@ -0,0 +1,18 @@
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+/* Host replacement for <avr/interrupt.h>.
+ * Interrupt handlers are plain functions called by the input harness. */
+
+#include <avr/io.h>
+
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+
+#define TIMER2_COMP_vect	sim_vect_timer2_comp
+#define SPI_STC_vect		sim_vect_spi_stc
+
+#define cli()			do { SREG = (uint8_t)(SREG & ~(1u << SREG_I)); } while (0)
+#define sei()			do { SREG = (uint8_t)(SREG | (1u << SREG_I)); } while (0)
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
@@ -0,0 +1,56 @@
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+/* Host replacement for <avr/io.h> (ATmega8).
+ * The registers are plain variables, which the input harness
+ * sets and reads around the calls to the interrupt handlers. */
+
+#include <stdint.h>
+
+
+#define SIM_IO8_REGS(X)						\
+	X(PORTB) X(PORTC) X(PORTD)				\
+	X(DDRB) X(DDRC) X(DDRD)					\
+	X(PINB) X(PINC) X(PIND)					\
+	X(SREG) X(TIMSK) X(TIFR)				\
+	X(TCCR1A) X(TCCR1B)					\
+	X(TCCR2) X(TCNT2) X(OCR2)				\
+	X(SPCR) X(SPSR) X(SPDR)
+
+#define SIM_IO16_REGS(X)					\
+	X(TCNT1) X(OCR1A)
+
+#define __SIM_REG_DECL8(name)	extern volatile uint8_t name;
+#define __SIM_REG_DECL16(name)	extern volatile uint16_t name;
+SIM_IO8_REGS(__SIM_REG_DECL8)
+SIM_IO16_REGS(__SIM_REG_DECL16)
+
+/* SREG */
+#define SREG_I		7
+/* TCCR1B */
+#define CS10		0
+#define CS11		1
+#define CS12		2
+/* TCCR2 */
+#define CS20		0
+#define CS21		1
+#define CS22		2
+#define WGM21		3
+#define WGM20		6
+/* TIMSK and TIFR */
+#define OCIE2		7
+#define OCF2		7
+/* SPCR */
+#define SPR0		0
+#define SPR1		1
+#define CPHA		2
+#define CPOL		3
+#define MSTR		4
+#define DORD		5
+#define SPE		6
+#define SPIE		7
+
+/** sim_enter_bootloader - The application jumped to the bootloader. */
+void sim_enter_bootloader(void) __attribute__((__noreturn__));
+
+#endif /* SIM_AVR_IO_H_ */
@@ -0,0 +1,12 @@
+#ifndef SIM_AVR_SLEEP_H_
+#define SIM_AVR_SLEEP_H_
+
+/* Host replacement for <avr/sleep.h>.
+ * The input harness never runs the main loop. */
+
+#define SLEEP_MODE_IDLE		0
+
+#define set_sleep_mode(mode)	do { (void)(mode); } while (0)
+#define sleep_mode()		do { } while (0)
+
+#endif /* SIM_AVR_SLEEP_H_ */
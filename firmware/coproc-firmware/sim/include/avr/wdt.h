@@ -0,0 +1,14 @@
+#ifndef SIM_AVR_WDT_H_
+#define SIM_AVR_WDT_H_
+
+/* Host replacement for <avr/wdt.h>.
+ * The input harness has no watchdog. */
+
+#define WDTO_15MS	0
+#define WDTO_500MS	5
+
+#define wdt_enable(timeout)	do { (void)(timeout); } while (0)
+#define wdt_disable()		do { } while (0)
+#define wdt_reset()		do { } while (0)
+
+#endif /* SIM_AVR_WDT_H_ */
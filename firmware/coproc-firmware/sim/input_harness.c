@@ -0,0 +1,620 @@
+/*
+ *   CNC-remote-control
+ *   Button processor input harness
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+/* Runs the button and encoder logic of the coprocessor firmware
+ * against synthetic input signals. The signals are sampled at the
+ * firmware sample rate by calling the sampler interrupt handler.
+ * The results are written as JSON to stdout. */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define main coproc_main
+#include "main.c"
+#undef main
+
+
+#define NSEC_PER_USEC		1000ull
+#define NSEC_PER_MSEC		1000000ull
+#define NSEC_PER_SEC		1000000000ull
+#define JIFFY_NSEC		(NSEC_PER_SEC / SPI_TIMESTAMP_HZ)
+/* Timer2 runs at 8M/32 */
+#define TIMER2_TICK_NSEC	4000ull
+
+#define HALT_BUTTON		0
+#define TEST_BUTTON		1
+
+#define __SIM_REG_DEF8(name)	volatile uint8_t name;
+#define __SIM_REG_DEF16(name)	volatile uint16_t name;
+SIM_IO8_REGS(__SIM_REG_DEF8)
+SIM_IO16_REGS(__SIM_REG_DEF16)
+
+
+/* Input signal. A sorted list of level toggles, starting at level 0. */
+struct trace {
+	uint64_t *toggles;
+	size_t count;
+	size_t alloc;
+	size_t pos;		/* Next toggle to apply */
+	bool level;
+};
+
+/* A true (noise free) input edge */
+struct edge {
+	uint64_t time;
+	int8_t value;		/* New button state, or encoder direction */
+	bool matched;
+};
+
+struct edge_list {
+	struct edge *edges;
+	size_t count;
+	size_t alloc;
+};
+
+struct stat {
+	uint64_t count;
+	double sum;
+	double min;
+	double max;
+};
+
+struct button_scenario {
+	const char *name;
+	uint8_t button;		/* hwstates[] index */
+	uint32_t bounce_us;	/* Bounce window after each edge */
+	uint8_t bounce_pairs;	/* Max number of bounce pulses */
+	uint32_t glitch_per_sec;	/* Noise pulses while stable */
+	uint32_t glitch_us;	/* Max noise pulse width */
+	uint32_t hold_ms;	/* Press duration */
+	uint32_t gap_ms;	/* Release duration */
+};
+
+struct encoder_scenario {
+	const char *name;
+	uint32_t detents_per_sec;
+	uint32_t jitter_pct;	/* Random step interval variation */
+	uint32_t bounce_us;	/* Chatter window after each edge */
+	uint8_t bounce_pairs;	/* Max number of chatter pulses */
+};
+
+static const struct button_scenario button_scenarios[] = {
+	{ .name = "clean", .button = TEST_BUTTON,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "bounce-1ms", .button = TEST_BUTTON,
+	  .bounce_us = 1000, .bounce_pairs = 5,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "bounce-5ms", .button = TEST_BUTTON,
+	  .bounce_us = 5000, .bounce_pairs = 10,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "bounce-20ms", .button = TEST_BUTTON,
+	  .bounce_us = 20000, .bounce_pairs = 20,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "bounce-60ms", .button = TEST_BUTTON,
+	  .bounce_us = 60000, .bounce_pairs = 5,
+	  .hold_ms = 300, .gap_ms = 300, },
+	{ .name = "glitch", .button = TEST_BUTTON,
+	  .bounce_us = 1000, .bounce_pairs = 5,
+	  .glitch_per_sec = 5, .glitch_us = 500,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "short-press", .button = TEST_BUTTON,
+	  .bounce_us = 1000, .bounce_pairs = 5,
+	  .hold_ms = 50, .gap_ms = 200, },
+	{ .name = "halt-clean", .button = HALT_BUTTON,
+	  .hold_ms = 200, .gap_ms = 200, },
+	{ .name = "halt-bounce-1ms", .button = HALT_BUTTON,
+	  .bounce_us = 1000, .bounce_pairs = 5,
+	  .hold_ms = 200, .gap_ms = 200, },
+};
+
+static const struct encoder_scenario encoder_scenarios[] = {
+	{ .name = "5dps", .detents_per_sec = 5, .jitter_pct = 10, },
+	{ .name = "20dps", .detents_per_sec = 20, .jitter_pct = 10, },
+	{ .name = "50dps", .detents_per_sec = 50, .jitter_pct = 10, },
+	{ .name = "100dps", .detents_per_sec = 100, .jitter_pct = 10, },
+	{ .name = "150dps", .detents_per_sec = 150, .jitter_pct = 10, },
+	{ .name = "50dps-bounce-300us", .detents_per_sec = 50, .jitter_pct = 10,
+	  .bounce_us = 300, .bounce_pairs = 3, },
+	{ .name = "50dps-bounce-1ms", .detents_per_sec = 50, .jitter_pct = 10,
+	  .bounce_us = 1000, .bounce_pairs = 5, },
+	{ .name = "100dps-bounce-1ms", .detents_per_sec = 100, .jitter_pct = 10,
+	  .bounce_us = 1000, .bounce_pairs = 5, },
+};
+
+static struct {
+	uint32_t rand;
+	uint64_t sample_nsec;
+	unsigned int trials;
+} harness;
+
+
+void sim_enter_bootloader(void)
+{
+	fprintf(stderr, "input-harness: Unexpected bootloader entry\n");
+	abort();
+}
+
+static uint32_t rand32(void)
+{
+	/* xorshift32 */
+	harness.rand ^= harness.rand << 13;
+	harness.rand ^= harness.rand >> 17;
+	harness.rand ^= harness.rand << 5;
+	return harness.rand;
+}
+
+/* Random number in [0, range) */
+static uint64_t rand_range(uint64_t range)
+{
+	return range ? ((uint64_t)rand32() * range) >> 32 : 0;
+}
+
+static void * xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "input-harness: Out of memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+static void trace_toggle(struct trace *t, uint64_t time)
+{
+	if (t->count >= t->alloc) {
+		t->alloc = t->alloc ? t->alloc * 2 : 64;
+		t->toggles = xrealloc(t->toggles, t->alloc * sizeof(*t->toggles));
+	}
+	t->toggles[t->count++] = time;
+}
+
+static int cmp_u64(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a, y = *(const uint64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static void trace_finish(struct trace *t)
+{
+	qsort(t->toggles, t->count, sizeof(*t->toggles), cmp_u64);
+	t->pos = 0;
+	t->level = 0;
+}
+
+/* Get the signal level at @time. Must be called with increasing times. */
+static bool trace_level(struct trace *t, uint64_t time)
+{
+	while (t->pos < t->count && t->toggles[t->pos] <= time) {
+		t->level = !t->level;
+		t->pos++;
+	}
+	return t->level;
+}
+
+static void trace_free(struct trace *t)
+{
+	free(t->toggles);
+	memset(t, 0, sizeof(*t));
+}
+
+/* Add an edge at @time, followed by up to @pairs bounce pulses
+ * within @window. The level after the window is the edge level. */
+static void trace_bouncy_edge(struct trace *t, uint64_t time,
+			      uint64_t window, uint8_t pairs)
+{
+	unsigned int i, n;
+
+	trace_toggle(t, time);
+	if (!window)
+		return;
+	n = (unsigned int)rand_range((uint64_t)pairs + 1) * 2;
+	for (i = 0; i < n; i++)
+		trace_toggle(t, time + 1 + rand_range(window - 1));
+}
+
+static void edge_add(struct edge_list *l, uint64_t time, int8_t value)
+{
+	if (l->count >= l->alloc) {
+		l->alloc = l->alloc ? l->alloc * 2 : 64;
+		l->edges = xrealloc(l->edges, l->alloc * sizeof(*l->edges));
+	}
+	l->edges[l->count].time = time;
+	l->edges[l->count].value = value;
+	l->edges[l->count].matched = 0;
+	l->count++;
+}
+
+/* Find the last true edge at or before @time. */
+static struct edge * edge_find(struct edge_list *l, uint64_t time)
+{
+	size_t lo = 0, hi = l->count;
+
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+
+		if (l->edges[mid].time <= time)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	return lo ? &l->edges[lo - 1] : NULL;
+}
+
+static void stat_add(struct stat *s, double value)
+{
+	if (!s->count || value < s->min)
+		s->min = value;
+	if (!s->count || value > s->max)
+		s->max = value;
+	s->sum += value;
+	s->count++;
+}
+
+static void stat_print(FILE *f, const char *name, const struct stat *s)
+{
+	if (!s->count) {
+		fprintf(f, "\"%s\": null", name);
+		return;
+	}
+	fprintf(f, "\"%s\": { \"min\": %.1f, \"mean\": %.1f, \"max\": %.1f }",
+		name, s->min, s->sum / (double)s->count, s->max);
+}
+
+/* Reset the firmware input state to all inputs released. */
+static void firmware_reset(void)
+{
+	memset(hwstates, 0, sizeof(hwstates));
+	swstates = 0;
+	memset(enc_hwstates, 0, sizeof(enc_hwstates));
+	memset(enc_swstates, 0, sizeof(enc_swstates));
+	event_fifo_in = event_fifo_out = 0;
+	event_fifo_rewind();
+
+	PINB = PINC = PIND = 0xFF;
+	TCNT1 = 0;
+	jiffies_init();
+	buttons_init();
+	sampler_init();
+	harness.sample_nsec = ((uint64_t)OCR2 + 1) * TIMER2_TICK_NSEC;
+}
+
+static void firmware_sample(uint64_t now)
+{
+	TCNT1 = (uint16_t)(now / JIFFY_NSEC);
+	sim_vect_timer2_comp();
+}
+
+static void run_button_scenario(FILE *f, const struct button_scenario *sc)
+{
+	struct trace trace = { 0 };
+	struct edge_list edges = { 0 };
+	struct stat latency = { 0 }, ts_error = { 0 };
+	struct input_event ev;
+	struct edge *edge;
+	uint64_t time, end, stable, next, width;
+	uint64_t bounce = sc->bounce_us * NSEC_PER_USEC;
+	uint64_t nr_false = 0, nr_missed = 0;
+	uint16_t mask = (uint16_t)(1u << sc->button);
+	uint16_t prev_swstates;
+	unsigned int i, j;
+
+	/* Build the input trace */
+	time = 100 * NSEC_PER_MSEC;
+	for (i = 0; i < harness.trials; i++) {
+		for (j = 0; j < 2; j++) {
+			trace_bouncy_edge(&trace, time, bounce, sc->bounce_pairs);
+			edge_add(&edges, time, (int8_t)!j);
+			stable = time + bounce;
+			time += (j ? sc->gap_ms : sc->hold_ms) * NSEC_PER_MSEC;
+			/* Noise pulses in the stable period */
+			if (!sc->glitch_per_sec)
+				continue;
+			for (next = stable + NSEC_PER_MSEC;
+			     next + NSEC_PER_MSEC < time;
+			     next += NSEC_PER_MSEC) {
+				if (rand_range(1000) >= sc->glitch_per_sec)
+					continue;
+				width = 1 + rand_range(sc->glitch_us * NSEC_PER_USEC);
+				trace_toggle(&trace, next);
+				trace_toggle(&trace, next + width);
+			}
+		}
+	}
+	end = time;
+	trace_finish(&trace);
+
+	/* Feed the trace to the sampler */
+	firmware_reset();
+	prev_swstates = swstates;
+	for (time = 0; time < end; time += harness.sample_nsec) {
+		if (trace_level(&trace, time))
+			PINB = (uint8_t)(PINB & ~(1u << sc->button));
+		else
+			PINB = (uint8_t)(PINB | (1u << sc->button));
+		firmware_sample(time);
+
+		if (!((swstates ^ prev_swstates) & mask))
+			continue;
+		prev_swstates = swstates;
+		edge = edge_find(&edges, time);
+		if (edge && (edge->matched || edge->value != !!(swstates & mask)))
+			edge = NULL;
+		/* The event timestamp is the first edge, as seen by the master. */
+		event_fifo_rewind();
+		while (1) {
+			event_fifo_peek(&ev);
+			if (ev.id == SPI_EVENT_NONE)
+				break;
+			if (!edge || (ev.id & SPI_EVENT_BUTTON_MASK) != sc->button)
+				continue;
+			stat_add(&ts_error, (double)(int16_t)(ev.time -
+				 (uint16_t)(edge->time / JIFFY_NSEC)) *
+				 JIFFY_NSEC / NSEC_PER_USEC);
+		}
+		spi_data_ack();
+		if (!edge) {
+			nr_false++;
+			continue;
+		}
+		edge->matched = 1;
+		stat_add(&latency, (double)(time - edge->time) / NSEC_PER_USEC);
+	}
+	for (i = 0; i < edges.count; i++)
+		nr_missed += !edges.edges[i].matched;
+
+	fprintf(f, "\t\t\"%s\": { \"edges\": %zu, \"missed\": %llu, "
+		   "\"false\": %llu, ",
+		sc->name, edges.count,
+		(unsigned long long)nr_missed, (unsigned long long)nr_false);
+	stat_print(f, "latency_us", &latency);
+	fprintf(f, ", ");
+	stat_print(f, "timestamp_error_us", &ts_error);
+	fprintf(f, " }");
+
+	trace_free(&trace);
+	free(edges.edges);
+}
+
+/* One segment of encoder steps in one direction */
+static uint64_t encoder_segment(struct trace *a, struct trace *b,
+				struct edge_list *edges,
+				const struct encoder_scenario *sc,
+				uint64_t time, uint8_t *bin,
+				unsigned int nr_steps, int8_t direction)
+{
+	uint64_t interval = NSEC_PER_SEC / (sc->detents_per_sec * 2u);
+	uint64_t bounce = sc->bounce_us * NSEC_PER_USEC;
+	uint64_t jitter = interval * sc->jitter_pct / 100u;
+	uint8_t old_gray, new_gray;
+	unsigned int i;
+
+	if (bounce >= interval)
+		bounce = interval - 1;
+	for (i = 0; i < nr_steps; i++) {
+		time += interval - jitter + rand_range(jitter * 2 + 1);
+		old_gray = (uint8_t)(*bin ^ (*bin >> 1));
+		*bin = (uint8_t)((*bin + direction) & 3u);
+		new_gray = (uint8_t)(*bin ^ (*bin >> 1));
+		if ((old_gray ^ new_gray) & 1u)
+			trace_bouncy_edge(a, time, bounce, sc->bounce_pairs);
+		else
+			trace_bouncy_edge(b, time, bounce, sc->bounce_pairs);
+		/* The firmware counts down for increasing graycode. */
+		edge_add(edges, time, (int8_t)-direction);
+	}
+
+	return time;
+}
+
+static void run_encoder_scenario(FILE *f, const struct encoder_scenario *sc)
+{
+	struct trace a = { 0 }, b = { 0 };
+	struct edge_list edges = { 0 };
+	struct stat latency = { 0 };
+	struct edge *edge;
+	uint64_t time, end;
+	uint64_t nr_counted = 0, nr_false = 0, nr_missed;
+	uint8_t bin = 0;
+	unsigned int i, steps_per_segment = 40;
+	int8_t count;
+
+	/* Turn the wheel forward and back */
+	time = 100 * NSEC_PER_MSEC;
+	for (i = 0; i < harness.trials; i++) {
+		time = encoder_segment(&a, &b, &edges, sc, time, &bin,
+				       steps_per_segment, (int8_t)((i & 1u) ? -1 : 1));
+		time += 100 * NSEC_PER_MSEC;
+	}
+	end = time;
+	trace_finish(&a);
+	trace_finish(&b);
+
+	firmware_reset();
+	for (time = 0; time < end; time += harness.sample_nsec) {
+		/* The encoder inputs are active low. */
+		PIND = (uint8_t)((trace_level(&a, time) ? 0u : (1u << 6)) |
+				 (trace_level(&b, time) ? 0u : (1u << 7)) |
+				 0x3Fu);
+		firmware_sample(time);
+
+		/* Fetch like SPI_CONTROL_GETENC */
+		count = enc_swstates[0].state;
+		enc_swstates[0].state = 0;
+		if (!count)
+			continue;
+		edge = edge_find(&edges, time);
+		if (!edge || (count > 0) != (edge->value > 0)) {
+			nr_false += (uint64_t)abs(count);
+			continue;
+		}
+		nr_counted += (uint64_t)abs(count);
+		stat_add(&latency, (double)(time - edge->time) / NSEC_PER_USEC);
+	}
+	if (nr_counted > edges.count) {
+		nr_false += nr_counted - edges.count;
+		nr_counted = edges.count;
+	}
+	nr_missed = edges.count - nr_counted;
+
+	fprintf(f, "\t\t\"%s\": { \"steps\": %zu, \"missed\": %llu, "
+		   "\"false\": %llu, ",
+		sc->name, edges.count,
+		(unsigned long long)nr_missed, (unsigned long long)nr_false);
+	stat_print(f, "latency_us", &latency);
+	fprintf(f, " }");
+
+	trace_free(&a);
+	trace_free(&b);
+	free(edges.edges);
+}
+
+/* One SPI byte from the master. Returns the reply to it. */
+static uint8_t spi_exchange(uint8_t cmd)
+{
+	SPDR = cmd;
+	sim_vect_spi_stc();
+	return SPDR;
+}
+
+/* The event part of the CPU firmware transfer. The sampler queues
+ * 'nr_late' events after the event triple 'late_pos'.
+ * Returns the number of events the master takes, which are the
+ * events up to the first empty one. */
+static unsigned int spi_fetch_events(unsigned int late_pos,
+				     unsigned int nr_late)
+{
+	uint8_t ids[3];
+	unsigned int i, j, nr_events = 0;
+
+	spi_exchange(SPI_CONTROL_ACKEVENTS);
+	for (i = 0; i < ARRAY_SIZE(ids); i++) {
+		ids[i] = spi_exchange(SPI_CONTROL_GETEVENT);
+		spi_exchange(SPI_CONTROL_GETEVENT);
+		spi_exchange(SPI_CONTROL_GETEVENT);
+		if (i != late_pos)
+			continue;
+		for (j = 0; j < nr_late; j++)
+			event_fifo_put((uint8_t)(TEST_BUTTON | SPI_EVENT_PRESSED), 0);
+	}
+	spi_exchange(SPI_CONTROL_GETSUM);
+	spi_exchange(SPI_CONTROL_NOP);
+
+	for (i = 0; i < ARRAY_SIZE(ids); i++) {
+		if (ids[i] == SPI_EVENT_NONE)
+			break;
+		nr_events++;
+	}
+
+	return nr_events;
+}
+
+/* Events queued by the sampler in the middle of a fetch
+ * must reach the master exactly once. */
+static void run_fetch_scenario(FILE *f)
+{
+	unsigned int i, nr_queued, nr_late, late_pos, nr_events, nr_fetches;
+	uint64_t nr_sent = 0, nr_lost = 0, nr_dup = 0;
+
+	for (i = 0; i < harness.trials; i++) {
+		firmware_reset();
+		nr_queued = (unsigned int)rand_range(3);
+		nr_late = 1 + (unsigned int)rand_range(2);
+		late_pos = (unsigned int)rand_range(3);
+		for (nr_events = 0; nr_events < nr_queued; nr_events++)
+			event_fifo_put(TEST_BUTTON, 0);
+
+		nr_events = spi_fetch_events(late_pos, nr_late);
+		for (nr_fetches = 0; nr_fetches < 3; nr_fetches++)
+			nr_events += spi_fetch_events(0, 0);
+
+		nr_sent += nr_queued + nr_late;
+		if (nr_events < nr_queued + nr_late)
+			nr_lost += nr_queued + nr_late - nr_events;
+		else
+			nr_dup += nr_events - (nr_queued + nr_late);
+	}
+
+	fprintf(f, "\t\"event_fetch\": { \"events\": %llu, \"lost\": %llu, "
+		   "\"duplicated\": %llu }\n",
+		(unsigned long long)nr_sent, (unsigned long long)nr_lost,
+		(unsigned long long)nr_dup);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr, "Usage: %s [-s SEED] [-n TRIALS]\n"
+		"Writes the results as JSON to stdout.\n", prog);
+}
+
+int main(int argc, char **argv)
+{
+	FILE *f = stdout;
+	uint32_t seed = 1;
+	unsigned int i;
+	int opt;
+
+	harness.trials = 100;
+	while ((opt = getopt(argc, argv, "hs:n:")) != -1) {
+		switch (opt) {
+		case 's':
+			seed = (uint32_t)strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			harness.trials = (unsigned int)strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (!harness.trials) {
+		usage(argv[0]);
+		return 1;
+	}
+	harness.rand = seed ? seed : 1;
+
+	firmware_reset();
+	fprintf(f, "{\n");
+	fprintf(f, "\t\"seed\": %u,\n", (unsigned int)seed);
+	fprintf(f, "\t\"trials\": %u,\n", harness.trials);
+	fprintf(f, "\t\"sample_rate_hz\": %u,\n",
+		(unsigned int)(NSEC_PER_SEC / harness.sample_nsec));
+	fprintf(f, "\t\"button_debounce_ms\": %u,\n", BUTTON_DEBOUNCE_MS);
+	fprintf(f, "\t\"halt_press_debounce_ms\": %u,\n", HALT_PRESS_DEBOUNCE_MS);
+	fprintf(f, "\t\"enc_debounce_us\": %u,\n", ENC_DEBOUNCE_US);
+
+	fprintf(f, "\t\"buttons\": {\n");
+	for (i = 0; i < ARRAY_SIZE(button_scenarios); i++) {
+		run_button_scenario(f, &button_scenarios[i]);
+		fprintf(f, "%s\n", (i + 1 < ARRAY_SIZE(button_scenarios)) ? "," : "");
+	}
+	fprintf(f, "\t},\n");
+
+	fprintf(f, "\t\"encoder\": {\n");
+	for (i = 0; i < ARRAY_SIZE(encoder_scenarios); i++) {
+		run_encoder_scenario(f, &encoder_scenarios[i]);
+		fprintf(f, "%s\n", (i + 1 < ARRAY_SIZE(encoder_scenarios)) ? "," : "");
+	}
+	fprintf(f, "\t},\n");
+
+	run_fetch_scenario(f);
+	fprintf(f, "}\n");
+
+	return 0;
+}
@@ -16,12 +16,19 @@ enum spi_commands {
 	SPI_CONTROL_GETHIGH,
 	SPI_CONTROL_GETENC,
 	SPI_CONTROL_GETSUM,
+	SPI_CONTROL_GETEVENT,		/* Event FIFO (3 bytes per event) */
+	SPI_CONTROL_GETTIMELO,		/* Latch timestamp clock; low byte */
+	SPI_CONTROL_GETTIMEHI,		/* Latched timestamp clock; high byte */
+	SPI_CONTROL_ACKEVENTS,		/* Previous fetch was good; drop its data */
 
 	/* Bootloader related commands */
 	SPI_CONTROL_ENTERBOOT = 0xA0,	/* Enter the bootloader */
 	SPI_CONTROL_ENTERBOOT2,		/* Enter the bootloader (second stage) */
 	SPI_CONTROL_ENTERAPP,		/* Enter the application */
 	SPI_CONTROL_STARTFLASH,		/* Begin flashing sequence */
+	SPI_CONTROL_PAGECRC,		/* Read a flash page CRC */
+	SPI_CONTROL_BOOTCAPS,		/* Read the bootloader capabilities */
+	SPI_CONTROL_FLASHBLOCK,		/* Begin flashing sequence, block data */
 };
 
 enum spi_result {
@@ -29,6 +36,39 @@ enum spi_result {
 	SPI_RESULT_FAIL = 0x8A,
 };
 
+/* Input events, as returned by SPI_CONTROL_GETEVENT.
+ * The first byte is the event ID, followed by the
+ * little endian 16 bit timestamp of the first edge. */
+#define SPI_EVENT_NONE			0xFFu	/* Event FIFO is empty */
+#define SPI_EVENT_PRESSED		0x80u	/* Button pressed (else released) */
+#define SPI_EVENT_BUTTON_MASK		0x1Fu	/* Button number */
+
+/* The events and the encoder state stay queued after the fetch.
+ * SPI_CONTROL_ACKEVENTS drops the data of the previous fetch.
+ * Without it the next fetch returns the same data again. */
+
+/* SPI_CONTROL_PAGECRC is followed by the little endian page address.
+ * The next three transfers return the little endian CRC16 of the page
+ * (see spi_page_crc) and the inverted spi_crc8 of these two bytes. */
+
+/* SPI_CONTROL_BOOTCAPS returns the enum spi_bootcaps of the
+ * bootloader in the next transfer. Older bootloaders ignore the
+ * command and return 0. */
+enum spi_bootcaps {
+	SPI_BOOTCAP_PAGECRC	= (1 << 0), /* SPI_CONTROL_PAGECRC */
+	SPI_BOOTCAP_FLASHBLOCK	= (1 << 1), /* SPI_CONTROL_FLASHBLOCK */
+};
+
+/* SPI_CONTROL_FLASHBLOCK is the SPI_CONTROL_STARTFLASH sequence,
+ * but the page data is one block without the busy handshake between
+ * the bytes. After the address the slave signals ready once and then
+ * receives the page at up to SPI_FLASHBLOCK_MAXSCK.
+ * It flashes the page while busy after the checksum result. */
+#define SPI_FLASHBLOCK_MAXSCK		1000000ul
+
+/* Event timestamp clock frequency, in Hz */
+#define SPI_TIMESTAMP_HZ		31250ul
+
 #define SPI_SLAVE_TRANSIRQ_DDR		DDRB
 #define SPI_SLAVE_TRANSIRQ_PORT		PORTB
 #define SPI_SLAVE_TRANSIRQ_PIN		PINB
@@ -47,4 +87,10 @@ static inline uint8_t spi_crc8(uint8_t crc, uint8_t data)
 	return _crc_ibutton_update(crc, data);
 }
 
+/* Flash page CRC. Start with crc=0xFFFF. */
+static inline uint16_t spi_page_crc(uint16_t crc, uint8_t data)
+{
+	return _crc16_update(crc, data);
+}
+
 #endif /* SPI_INTERFACE_H_ */
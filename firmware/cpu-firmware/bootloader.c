@@ -50,6 +50,51 @@
 				     COPROC_E2SIZE))))
 static uint8_t page_buffer[PGBUF_SIZE];
 
+/* Flash page stream state. See CONTROL_BOOT_STREAMSTART.
+ * The CPU pages are double buffered in page_buffer. One page is filled,
+ * while the other one is programmed. */
+static struct {
+	bool active;		/* Accepting stream data */
+	uint8_t target;		/* enum mcu_target */
+	uint8_t encoding;	/* enum boot_stream_encoding */
+	uint8_t seqno;		/* Expected message seqno */
+	uint8_t slot;		/* Page buffer being filled. 0 or 1 */
+	uint8_t fill;		/* Bytes in the page buffer */
+	uint8_t crc;		/* CRC of the bytes in the page buffer */
+	uint16_t page;		/* Address of the page in the page buffer */
+} stream;
+
+enum prog_state {
+	PROG_IDLE,
+	PROG_ERASE,		/* Page erase running */
+	PROG_WRITE,		/* Page write running */
+	PROG_COPROC,		/* Coprocessor flashes a page */
+};
+
+/* Asynchronous page programming.
+ * The bootloader runs from the NRWW section, so it keeps running
+ * while the application (RWW) section is erased and written.
+ * The coprocessor flashes a page on its own, after the page data
+ * was transferred by SPI_CONTROL_FLASHBLOCK. */
+static struct {
+	uint8_t state;		/* enum prog_state */
+	bool failed;		/* A page failed to verify */
+	uint16_t address;
+	const uint8_t *buf;
+} prog;
+
+/* enum spi_bootcaps of the coprocessor bootloader */
+static uint8_t coproc_bootcaps;
+
+/* Time for the coprocessor to signal busy after a transfer */
+#define COPROC_SPI_SETTLE_US	10
+/* Time for the coprocessor to flash and verify a page */
+#define COPROC_PROG_TIMEOUT_MS	100
+#define COPROC_PROG_POLL_US	100
+
+/* flash_page() success */
+#define CTLERR_NONE		0xFFu
+
 
 static void disable_all_irq_sources(void)
 {
@@ -68,6 +113,7 @@ static void disable_all_irq_sources(void)
 
 static void route_irqs_to_bootloader(void)
 {
+#ifndef SIMULATOR
 	uint8_t tmp;
 
 	__asm__ __volatile__(
@@ -80,10 +126,12 @@ static void route_irqs_to_bootloader(void)
 	, [_IVSEL]	"M" (1 << IVSEL)
 	, [_IVCE]	"M" (1 << IVCE)
 	);
+#endif
 }
 
 static void route_irqs_to_application(void)
 {
+#ifndef SIMULATOR
 	uint8_t tmp;
 
 	__asm__ __volatile__(
@@ -95,16 +143,22 @@ static void route_irqs_to_application(void)
 	: [_GICR]	"I" (_SFR_IO_ADDR(GICR))
 	, [_IVCE]	"M" (1 << IVCE)
 	);
+#endif
+}
+
+static bool coprocessor_spi_busy(void)
+{
+	return !!(SPI_MASTER_TRANSIRQ_PIN & (1 << SPI_MASTER_TRANSIRQ_BIT));
 }
 
 static void coprocessor_spi_busywait(void)
 {
-	while (SPI_MASTER_TRANSIRQ_PIN & (1 << SPI_MASTER_TRANSIRQ_BIT));
+	_delay_us(COPROC_SPI_SETTLE_US);
+	while (coprocessor_spi_busy());
 }
 
 static uint8_t coprocessor_spi_transfer(uint8_t data)
 {
-	_delay_ms(1);
 	coprocessor_spi_busywait();
 	return spi_transfer_sync(data);
 }
@@ -134,13 +188,20 @@ static bool coprocessor_enter_bootloader(void)
 	coprocessor_spi_transfer_nobusy(SPI_CONTROL_ENTERBOOT2);
 	spi_slave_select(0);
 	_delay_ms(150);
-	if (!coprocessor_is_in_application())
-		return 1;
-	return 0;
+	if (coprocessor_is_in_application())
+		return 0;
+
+	spi_slave_select(1);
+	coprocessor_spi_transfer(SPI_CONTROL_BOOTCAPS);
+	coproc_bootcaps = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+	spi_slave_select(0);
+
+	return 1;
 }
 
 static bool coprocessor_exit_bootloader(void)
 {
+	coproc_bootcaps = 0;
 	spi_slave_select(1);
 	coprocessor_spi_transfer_nobusy(SPI_CONTROL_ENTERAPP);
 	spi_slave_select(0);
@@ -170,22 +231,35 @@ static noreturn noinline void exit_bootloader(void)
 
 	route_irqs_to_application();
 	/* Jump to application code */
+#ifdef SIMULATOR
+	sim_exit_bootloader();
+#else
 	__asm__ __volatile__(
 	"ijmp\n"
 	: /* None */
 	: [_Z]		"z" (0x0000)
 	);
+#endif
 	unreachable();
 }
 
-static bool verify_page(uint16_t page_address)
+static uint8_t read_flash(uint16_t address)
+{
+#ifdef SIMULATOR
+	return sim_flash_read(address);
+#else
+	return pgm_read_byte((void PROGPTR *)(void *)address);
+#endif
+}
+
+static bool verify_page(uint16_t page_address, const uint8_t *buf)
 {
 	uint8_t i, data0, data1;
 
 	for (i = 0; i < CPU_SPM_PAGESIZE; i++) {
 		wdt_reset();
-		data0 = page_buffer[i];
-		data1 = pgm_read_byte((void PROGPTR *)(void *)(page_address + i));
+		data0 = buf[i];
+		data1 = read_flash((uint16_t)(page_address + i));
 		if (data0 != data1)
 			return 0;
 	}
@@ -193,29 +267,84 @@ static bool verify_page(uint16_t page_address)
 	return 1;
 }
 
-static void write_page(uint16_t page_address)
+/* Advance the page programming. Call with IRQs disabled. */
+static void prog_step(void)
 {
-	uint8_t i, sreg;
+	uint8_t i;
 	uint16_t data;
 
-	eeprom_busy_wait();
-	boot_spm_busy_wait();
+	if (prog.state == PROG_IDLE || boot_spm_busy())
+		return;
 
-	sreg = irq_disable_save();
+	switch (prog.state) {
+	case PROG_ERASE:
+		for (i = 0; i < CPU_SPM_PAGESIZE; i = (uint8_t)(i + 2u)) {
+			data = (uint16_t)(prog.buf[i]);
+			data |= ((uint16_t)(prog.buf[i + 1]) << 8);
+			boot_page_fill(prog.address + i, data);
+		}
+		boot_page_write(prog.address);
+		prog.state = PROG_WRITE;
+		break;
+	case PROG_WRITE:
+		boot_rww_enable();
+		if (!verify_page(prog.address, prog.buf))
+			prog.failed = 1;
+		prog.state = PROG_IDLE;
+		break;
+	case PROG_COPROC:
+		if (coprocessor_spi_busy())
+			break;
+		/* Read the result. */
+		spi_slave_select(1);
+		if (spi_transfer_sync(SPI_CONTROL_NOP) != SPI_RESULT_OK)
+			prog.failed = 1;
+		spi_slave_select(0);
+		prog.state = PROG_IDLE;
+		break;
+	}
+}
 
-	boot_page_erase(page_address);
-	boot_spm_busy_wait();
-	for (i = 0; i < CPU_SPM_PAGESIZE; i = (uint8_t)(i + 2u)) {
+/* Wait for the page programming to finish. Call with IRQs disabled. */
+static void prog_wait(void)
+{
+	uint16_t polls = COPROC_PROG_TIMEOUT_MS * (1000 / COPROC_PROG_POLL_US);
+
+	while (prog.state != PROG_IDLE) {
 		wdt_reset();
-		data = (uint16_t)(page_buffer[i]);
-		data |= ((uint16_t)(page_buffer[i + 1]) << 8);
-		boot_page_fill(page_address + i, data);
+		if (prog.state == PROG_COPROC) {
+			if (!polls--) {
+				/* The coprocessor does not answer. */
+				prog.failed = 1;
+				prog.state = PROG_IDLE;
+				break;
+			}
+			_delay_us(COPROC_PROG_POLL_US);
+		}
+		prog_step();
 	}
-	boot_page_write(page_address);
-	boot_spm_busy_wait();
-	boot_rww_enable();
+}
+
+/* Start programming @buf to @page_address. The programming must be idle.
+ * @buf must not change until the programming finished.
+ * Call with IRQs disabled. */
+static void prog_start(uint16_t page_address, const uint8_t *buf)
+{
+	eeprom_busy_wait();
 
-	irq_restore(sreg);
+	prog.address = page_address;
+	prog.buf = buf;
+	boot_page_erase(page_address);
+	prog.state = PROG_ERASE;
+}
+
+static uint8_t prog_status(void)
+{
+	if (prog.state != PROG_IDLE)
+		return BOOT_PROG_BUSY;
+	if (prog.failed)
+		return BOOT_PROG_FAILED;
+	return BOOT_PROG_IDLE;
 }
 
 static noinline uint8_t calc_crc8(uint8_t crc, uint8_t data)
@@ -223,19 +352,230 @@ static noinline uint8_t calc_crc8(uint8_t crc, uint8_t data)
 	return spi_crc8(crc, data);
 }
 
+/* Flash @buf to the coprocessor page at @address and wait for it.
+ * This is for coprocessor bootloaders without SPI_CONTROL_FLASHBLOCK.
+ * Returns CTLERR_NONE or the error code. */
+static uint8_t coproc_flash_page_sync(uint16_t address, const uint8_t *buf)
+{
+	uint16_t i;
+	uint8_t d, retval, crc = 0;
+
+	spi_slave_select(1);
+	coprocessor_spi_transfer(SPI_CONTROL_STARTFLASH);
+	crc = calc_crc8(crc, lo8(address));
+	coprocessor_spi_transfer(lo8(address));
+	crc = calc_crc8(crc, hi8(address));
+	coprocessor_spi_transfer(hi8(address));
+	for (i = 0; i < COPROC_SPM_PAGESIZE; i++) {
+		d = buf[i];
+		crc = calc_crc8(crc, d);
+		coprocessor_spi_transfer(d);
+	}
+	crc ^= 0xFF;
+	coprocessor_spi_transfer(crc);
+	retval = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+	if (retval != SPI_RESULT_OK) {
+		spi_slave_select(0);
+		return CTLERR_CHECKSUM; /* CRC error */
+	}
+	/* Flashing starts. Wait for result and read it. */
+	retval = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+	spi_slave_select(0);
+	if (retval != SPI_RESULT_OK)
+		return CTLERR_CMDFAIL;
+
+	return CTLERR_NONE;
+}
+
+/* Transfer @buf to the coprocessor and let it flash the page at @address.
+ * The page data is sent as one block at the fast SPI clock.
+ * The programming must be idle. prog_step() reads the result.
+ * Returns CTLERR_NONE or the error code. */
+static uint8_t coproc_prog_start(uint16_t address, const uint8_t *buf)
+{
+	uint8_t i, retval, crc = 0;
+
+	BUILD_BUG_ON(F_CPU / 16 > SPI_FLASHBLOCK_MAXSCK);
+
+	crc = calc_crc8(crc, lo8(address));
+	crc = calc_crc8(crc, hi8(address));
+	for (i = 0; i < COPROC_SPM_PAGESIZE; i++)
+		crc = calc_crc8(crc, buf[i]);
+	crc ^= 0xFF;
+
+	spi_slave_select(1);
+	coprocessor_spi_transfer(SPI_CONTROL_FLASHBLOCK);
+	coprocessor_spi_transfer(lo8(address));
+	coprocessor_spi_transfer(hi8(address));
+	coprocessor_spi_busywait();
+	spi_fastclock(1);
+	for (i = 0; i < COPROC_SPM_PAGESIZE; i++)
+		spi_transfer_sync(buf[i]);
+	spi_fastclock(0);
+	coprocessor_spi_transfer(crc);
+	retval = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+	if (retval != SPI_RESULT_OK) {
+		spi_slave_select(0);
+		return CTLERR_CHECKSUM; /* CRC error */
+	}
+	/* Flashing starts. prog_step() selects the slave
+	 * again to read the result, when it is ready. */
+	spi_slave_select(0);
+	_delay_us(COPROC_SPI_SETTLE_US);
+	prog.state = PROG_COPROC;
+
+	return CTLERR_NONE;
+}
+
+/* Start programming @buf to @address of the @target MCU.
+ * The programming must be idle. @buf must not change until
+ * the programming finished. Errors of the programming are
+ * collected in prog.failed.
+ * Returns CTLERR_NONE or the error code. */
+static uint8_t page_prog_start(uint16_t address, uint8_t target,
+			       const uint8_t *buf)
+{
+	switch (target) {
+	case TARGET_CPU:
+		prog_start(address, buf);
+		break;
+	case TARGET_COPROC:
+		if (coproc_bootcaps & SPI_BOOTCAP_FLASHBLOCK)
+			return coproc_prog_start(address, buf);
+		return coproc_flash_page_sync(address, buf);
+	default:
+		return CTLERR_CONTEXT;
+	}
+
+	return CTLERR_NONE;
+}
+
+/* Flash @buf to @address of the @target MCU and wait for it.
+ * Returns CTLERR_NONE or the error code. */
+static uint8_t flash_page(uint16_t address, uint8_t target,
+			  const uint8_t *buf)
+{
+	uint8_t err;
+
+	prog.failed = 0;
+	err = page_prog_start(address, target, buf);
+	if (err != CTLERR_NONE)
+		return err;
+	prog_wait();
+	if (prog.failed)
+		return CTLERR_CMDFAIL;
+
+	return CTLERR_NONE;
+}
+
+/* Get the CRC of the flash page at @address of the @target MCU.
+ * The programming must be idle.
+ * Returns CTLERR_NONE or the error code. */
+static uint8_t page_crc(uint16_t address, uint8_t target, uint16_t *result)
+{
+	uint8_t i, lo, hi, crc;
+	uint16_t c = 0xFFFF;
+
+	switch (target) {
+	case TARGET_CPU:
+		for (i = 0; i < CPU_SPM_PAGESIZE; i++) {
+			wdt_reset();
+			c = spi_page_crc(c, read_flash((uint16_t)(address + i)));
+		}
+		break;
+	case TARGET_COPROC:
+		if (!(coproc_bootcaps & SPI_BOOTCAP_PAGECRC))
+			return CTLERR_COMMAND;
+		spi_slave_select(1);
+		coprocessor_spi_transfer(SPI_CONTROL_PAGECRC);
+		coprocessor_spi_transfer(lo8(address));
+		coprocessor_spi_transfer(hi8(address));
+		lo = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+		hi = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+		crc = coprocessor_spi_transfer(SPI_CONTROL_NOP);
+		spi_slave_select(0);
+		crc ^= 0xFF;
+		if (calc_crc8(calc_crc8(0, lo), hi) != crc)
+			return CTLERR_CHECKSUM;
+		c = (uint16_t)(lo | ((uint16_t)hi << 8));
+		break;
+	default:
+		return CTLERR_CONTEXT;
+	}
+	*result = c;
+
+	return CTLERR_NONE;
+}
+
+static uint8_t stream_page_size(void)
+{
+	if (stream.target == TARGET_COPROC)
+		return COPROC_SPM_PAGESIZE;
+	return CPU_SPM_PAGESIZE;
+}
+
+/* Decode @size bytes of stream @data into @buf at @fill.
+ * Returns the new fill level or 0xFF on an error. */
+static uint8_t stream_decode(uint8_t *buf, uint8_t fill, uint8_t pagesize,
+			     const uint8_t *data, uint8_t size)
+{
+	uint8_t i = 0, token, count, d;
+	bool run = 0;
+
+	while (i < size) {
+		if (stream.encoding == BOOT_STREAM_RAW) {
+			count = size;
+		} else {
+			token = data[i++];
+			run = !!(token & BOOT_RLE_RUN);
+			count = (uint8_t)((token & BOOT_RLE_COUNT) + (run ? 2u : 1u));
+			if (i + (run ? 1u : count) > size)
+				return 0xFF;
+		}
+		if (count > pagesize - fill)
+			return 0xFF;
+		while (count--) {
+			d = data[i];
+			if (!run)
+				i++;
+			stream.crc = calc_crc8(stream.crc, d);
+			buf[fill++] = d;
+		}
+		if (run)
+			i++;
+	}
+
+	return fill;
+}
+
 uint8_t usb_app_ep2_rx(uint8_t *data, uint8_t ctl_size,
 		       uint8_t *reply_buf)
 {
 	struct control_message *ctl = (struct control_message *)data;
 	struct control_reply *reply = (struct control_reply *)reply_buf;
+	uint8_t err;
 
 	BUILD_BUG_ON(USBCFG_EP2_MAXSIZE < CONTROL_REPLY_MAX_SIZE);
+	BUILD_BUG_ON(USBCFG_EP2_MAXSIZE < CONTROL_MSG_SIZE(boot_streamdata));
+	BUILD_BUG_ON(PGBUF_SIZE < 2 * CPU_SPM_PAGESIZE);
 
 	if (ctl_size < CONTROL_MSG_HDR_SIZE)
 		goto err_size;
 	if (!(ctl->flags & CONTROL_FLG_BOOTLOADER))
 		goto err_context;
 
+	if (ctl->id == CONTROL_BOOT_STREAMDATA) {
+		/* Drop the data after a stream error. */
+		if (!stream.active)
+			return 0;
+	} else {
+		/* Other messages end the stream. */
+		stream.active = 0;
+		/* Finish programming, before the page buffer is reused. */
+		if (ctl->id != CONTROL_BOOT_PROGSTATUS)
+			prog_wait();
+	}
+
 	switch (ctl->id) {
 	case CONTROL_PING: {
 		break;
@@ -302,49 +642,133 @@ uint8_t usb_app_ep2_rx(uint8_t *data, uint8_t ctl_size,
 		break;
 	}
 	case CONTROL_BOOT_FLASHPG: {
-		uint16_t i, address;
-		uint8_t d, retval, crc = 0;
-
 		if (ctl_size < CONTROL_MSG_SIZE(boot_flashpg))
 			goto err_size;
-		address = ctl->boot_flashpg.address;
 
-		switch (ctl->boot_flashpg.target) {
-		case TARGET_CPU:
-			write_page(address);
-			if (!verify_page(address))
-				goto err_cmdfail;
-			break;
-		case TARGET_COPROC:
-			spi_slave_select(1);
-			coprocessor_spi_transfer(SPI_CONTROL_STARTFLASH);
-			crc = calc_crc8(crc, lo8(address));
-			coprocessor_spi_transfer(lo8(address));
-			crc = calc_crc8(crc, hi8(address));
-			coprocessor_spi_transfer(hi8(address));
-			for (i = 0; i < COPROC_SPM_PAGESIZE; i++) {
-				d = page_buffer[i];
-				crc = calc_crc8(crc, d);
-				coprocessor_spi_transfer(d);
-			}
-			crc ^= 0xFF;
-			coprocessor_spi_transfer(crc);
-			retval = coprocessor_spi_transfer(SPI_CONTROL_NOP);
-			if (retval != SPI_RESULT_OK) {
-				spi_slave_select(0);
-				goto err_checksum; /* CRC error */
-			}
-			/* Flashing starts. Wait for result and read it. */
-			retval = coprocessor_spi_transfer(SPI_CONTROL_NOP);
-			if (retval != SPI_RESULT_OK) {
-				spi_slave_select(0);
-				goto err_cmdfail;
-			}
-			spi_slave_select(0);
-			break;
-		default:
+		err = flash_page(ctl->boot_flashpg.address,
+				 ctl->boot_flashpg.target, page_buffer);
+		if (err != CTLERR_NONE)
+			goto err_code;
+		break;
+	}
+	case CONTROL_BOOT_PROGSTATUS: {
+		init_control_reply(reply, REPLY_VAL16, 0, ctl->seqno);
+		reply->val16.value = prog_status();
+		return CONTROL_REPLY_SIZE(val16);
+	}
+	case CONTROL_BOOT_PAGECRC: {
+		uint8_t i, count, target;
+		uint16_t address, pagesize, crc;
+
+		if (ctl_size < CONTROL_MSG_SIZE(boot_pagecrc))
+			goto err_size;
+		address = ctl->boot_pagecrc.address;
+		count = ctl->boot_pagecrc.count;
+		target = ctl->boot_pagecrc.target;
+		pagesize = (target == TARGET_COPROC) ? COPROC_SPM_PAGESIZE
+						     : CPU_SPM_PAGESIZE;
+
+		if (count == 0 || count > BOOT_PAGECRC_MAX ||
+		    (address & (pagesize - 1u)) ||
+		    (uint32_t)address + (uint32_t)count * pagesize > 0x10000ul)
+			goto err_inval;
+
+		for (i = 0; i < count; i++) {
+			err = page_crc((uint16_t)(address + i * pagesize), target,
+				       &crc);
+			if (err != CTLERR_NONE)
+				goto err_code;
+			reply->pagecrc.crc[i] = crc;
+		}
+		init_control_reply(reply, REPLY_PAGECRC, 0, ctl->seqno);
+		reply->pagecrc.address = address;
+		reply->pagecrc.count = count;
+		reply->pagecrc._reserved = 0;
+		return (uint8_t)(CONTROL_REPLY_SIZE(pagecrc) -
+				 sizeof(reply->pagecrc.crc) +
+				 count * sizeof(reply->pagecrc.crc[0]));
+	}
+	case CONTROL_BOOT_STREAMSTART: {
+		uint8_t encoding = BOOT_STREAM_RAW;
+
+		if (ctl_size < CONTROL_MSG_SIZE(boot_streamstart.target))
+			goto err_size;
+		if (ctl->boot_streamstart.target != TARGET_CPU &&
+		    ctl->boot_streamstart.target != TARGET_COPROC)
 			goto err_context;
+		/* Older hosts do not send the encoding. */
+		if (ctl_size >= CONTROL_MSG_SIZE(boot_streamstart))
+			encoding = ctl->boot_streamstart.encoding;
+		if (encoding != BOOT_STREAM_RAW &&
+		    encoding != BOOT_STREAM_RLE)
+			goto err_inval;
+
+		memset(&stream, 0, sizeof(stream));
+		prog.failed = 0;
+		stream.target = ctl->boot_streamstart.target;
+		stream.encoding = encoding;
+		stream.seqno = (uint8_t)(ctl->seqno + 1u);
+		stream.active = 1;
+
+		init_control_reply(reply, REPLY_VAL16, 0, ctl->seqno);
+		reply->val16.value = encoding;
+		return CONTROL_REPLY_SIZE(val16);
+	}
+	case CONTROL_BOOT_STREAMDATA: {
+		uint8_t size, offset, fill, pagesize;
+		uint16_t address;
+		uint8_t *buf;
+
+		/* Reactivated, if the message is fine. */
+		stream.active = 0;
+
+		if (ctl_size < CONTROL_MSG_SIZE(boot_streamdata))
+			goto err_size;
+		if (ctl->seqno != stream.seqno)
+			goto err_sequence;
+		size = ctl->boot_streamdata.size;
+		address = ctl->boot_streamdata.address;
+		pagesize = stream_page_size();
+		offset = (uint8_t)(address & (pagesize - 1u));
+
+		/* A new page may start at any page address. */
+		if (offset != stream.fill ||
+		    (offset && address - offset != stream.page))
+			goto err_sequence;
+		if (size > sizeof(ctl->boot_streamdata.data))
+			goto err_inval;
+
+		buf = &page_buffer[stream.slot * CPU_SPM_PAGESIZE];
+		fill = stream_decode(buf, offset, pagesize,
+				     ctl->boot_streamdata.data, size);
+		if (fill == 0xFF)
+			goto err_inval;
+		stream.page = (uint16_t)(address - offset);
+		stream.fill = fill;
+		stream.seqno++;
+
+		if (stream.fill < pagesize) {
+			/* No reply until the page is complete. */
+			stream.active = 1;
+			return 0;
 		}
+
+		stream.crc ^= 0xFF;
+		if (stream.crc != ctl->boot_streamdata.crc)
+			goto err_checksum;
+		/* Program this page in the background, while the
+		 * host sends the next one to the other buffer.
+		 * The reply reports errors of the previous page. */
+		prog_wait();
+		if (prog.failed)
+			goto err_cmdfail;
+		err = page_prog_start(stream.page, stream.target, buf);
+		if (err != CTLERR_NONE)
+			goto err_code;
+		stream.slot ^= 1;
+		stream.fill = 0;
+		stream.crc = 0;
+		stream.active = 1;
 		break;
 	}
 	case CONTROL_BOOT_EEPWRITE: {
@@ -413,6 +837,12 @@ err_cmdfail:
 err_checksum:
 	reply->error.code = CTLERR_CHECKSUM;
 	goto error;
+err_sequence:
+	reply->error.code = CTLERR_SEQUENCE;
+	goto error;
+err_code:
+	reply->error.code = err;
+	goto error;
 
 error:
 	init_control_reply(reply, REPLY_ERROR, 0, ctl->seqno);
@@ -435,6 +865,10 @@ static bool should_enter_bootloader(void)
 	return 1;
 }
 
+#ifdef SIMULATOR
+/* The simulator starts the bootloader by jump only. */
+static uint8_t saved_mcucsr;
+#else
 static uint8_t saved_mcucsr __attribute__((section(".noinit")));
 
 void early_init(void) __attribute__((naked, section(".init3"), used));
@@ -445,6 +879,7 @@ void early_init(void)
 	MCUCSR = 0;
 	wdt_enable(WDTO_2S);
 }
+#endif
 
 int main(void) _mainfunc;
 int main(void)
@@ -485,5 +920,9 @@ int main(void)
 	irq_enable();
 	while (1) {
 		wdt_reset();
+
+		irq_disable();
+		prog_step();
+		irq_enable();
 	}
 }
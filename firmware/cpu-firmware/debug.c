@@ -18,15 +18,41 @@
 #include "main.h"
 #include "util.h"
 #include "uart.h"
+#include "stats.h"
 
 #include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
 
 
 static uint8_t dbg_ringbuf[256];
 static uint8_t dbg_ringbuf_in;
 static uint8_t dbg_ringbuf_out;
 static uint8_t dbg_ringbuf_used;
+static uint8_t dbg_token_left;		/* Bytes left in the record being drained */
 
+/* Maximum size of one tokenized log record */
+#define DEBUG_TOKEN_MAX_SIZE	64
+
+/* A tokenized log record, while it is encoded */
+struct debug_token {
+	uint8_t size;
+	bool overrun;
+	uint8_t buf[DEBUG_TOKEN_MAX_SIZE];
+};
+
+#ifdef SIMULATOR
+extern const char __start_dbgfmt[];
+# define debug_fmt_id(fmt)	((uint16_t)((fmt) - __start_dbgfmt))
+#else
+# define debug_fmt_id(fmt)	((uint16_t)(fmt))
+#endif
+
+
+uint16_t debug_ringbuf_ramsize(void)
+{
+	return sizeof(dbg_ringbuf);
+}
 
 uint8_t debug_ringbuf_count(void)
 {
@@ -34,42 +60,96 @@ uint8_t debug_ringbuf_count(void)
 	return ATOMIC_LOAD(dbg_ringbuf_used);
 }
 
+/* Must be called with interrupts disabled. */
+static uint8_t debug_ringbuf_pop(void)
+{
+	uint8_t byte;
+
+	byte = dbg_ringbuf[dbg_ringbuf_out];
+	if (dbg_ringbuf_out >= ARRAY_SIZE(dbg_ringbuf) - 1)
+		dbg_ringbuf_out = 0u;
+	else
+		dbg_ringbuf_out++;
+	dbg_ringbuf_used--;
+
+	return byte;
+}
+
+/* Must be called with interrupts disabled.
+ * Returns false, if the ringbuffer is full. */
+static bool debug_ringbuf_put(uint8_t byte)
+{
+	if (dbg_ringbuf_used >= ARRAY_SIZE(dbg_ringbuf) - 1)
+		return 0;
+	dbg_ringbuf[dbg_ringbuf_in] = byte;
+	if (dbg_ringbuf_in >= ARRAY_SIZE(dbg_ringbuf) - 1)
+		dbg_ringbuf_in = 0u;
+	else
+		dbg_ringbuf_in++;
+	dbg_ringbuf_used++;
+
+	return 1;
+}
+
 uint8_t debug_ringbuf_get(void *buf, uint8_t size)
 {
 	uint8_t *outbuf = buf;
 	uint8_t sreg, count = 0;
 
 	sreg = irq_disable_save();
-	for ( ; dbg_ringbuf_used && size; dbg_ringbuf_used--, size--, count++) {
-		*outbuf++ = dbg_ringbuf[dbg_ringbuf_out];
-		if (dbg_ringbuf_out >= ARRAY_SIZE(dbg_ringbuf) - 1)
-			dbg_ringbuf_out = 0u;
-		else
-			dbg_ringbuf_out++;
+	for ( ; dbg_ringbuf_used && size; size--, count++)
+		*outbuf++ = debug_ringbuf_pop();
+	irq_restore(sreg);
+
+	return count;
+}
+
+uint8_t debug_ringbuf_get_tokens(void *buf, uint8_t size, uint8_t *start)
+{
+	uint8_t *outbuf = buf;
+	uint8_t sreg, byte, count = 0;
+
+	*start = LOGTOK_NOSTART;
+	sreg = irq_disable_save();
+	for ( ; dbg_ringbuf_used && size; size--, count++) {
+		byte = debug_ringbuf_pop();
+		if (!dbg_token_left) {
+			/* This is the size byte of the next record. */
+			dbg_token_left = byte;
+			if (*start == LOGTOK_NOSTART)
+				*start = count;
+		}
+		dbg_token_left--;
+		*outbuf++ = byte;
 	}
 	irq_restore(sreg);
 
 	return count;
 }
 
+void debug_ringbuf_flush(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	dbg_ringbuf_in = 0u;
+	dbg_ringbuf_out = 0u;
+	dbg_ringbuf_used = 0u;
+	dbg_token_left = 0u;
+	irq_restore(sreg);
+}
+
 static void debug_ringbuf_putchar(char c)
 {
 	uint8_t sreg;
-	uint16_t used;
 
-	if (!devflag_is_set(DEVICE_FLG_USBLOGMSG))
+	if (!devflag_is_set(DEVICE_FLG_USBLOGMSG) ||
+	    devflag_is_set(DEVICE_FLG_USBLOGTOK))
 		return;
 
 	sreg = irq_disable_save();
-	used = dbg_ringbuf_used;
-	if (used < ARRAY_SIZE(dbg_ringbuf)) {
-		dbg_ringbuf[dbg_ringbuf_in] = (uint8_t)c;
-		if (dbg_ringbuf_in >= ARRAY_SIZE(dbg_ringbuf) - 1)
-			dbg_ringbuf_in = 0u;
-		else
-			dbg_ringbuf_in++;
-		dbg_ringbuf_used++;
-	}
+	if (!debug_ringbuf_put((uint8_t)c))
+		stats_dbg_overrun();
 	irq_restore(sreg);
 }
 
@@ -88,12 +168,193 @@ static int debug_stream_putchar(char c, FILE *stream)
 static FILE debug_fstream = FDEV_SETUP_STREAM(debug_stream_putchar, NULL,
 					      _FDEV_SETUP_WRITE);
 
+static int uart_stream_putchar(char c, FILE *stream)
+{
+	uart_putchar(c);
+	return 0;
+}
+
+static FILE uart_fstream = FDEV_SETUP_STREAM(uart_stream_putchar, NULL,
+					     _FDEV_SETUP_WRITE);
+
+static void debug_token_put(struct debug_token *tok,
+			    const void *data, uint8_t size)
+{
+	const uint8_t *p = data;
+
+	for ( ; size; size--) {
+		if (tok->size >= sizeof(tok->buf)) {
+			tok->overrun = 1;
+			return;
+		}
+		tok->buf[tok->size++] = *p++;
+	}
+}
+
+static void debug_token_put_str(struct debug_token *tok,
+				const char *str, bool progmem)
+{
+	uint8_t i;
+	char c = '\0';
+
+	for (i = 0; str && i < LOGTOK_MAX_STRLEN; i++) {
+		c = progmem ? (char)pgm_read_byte(str + i) : str[i];
+		if (c == '\0')
+			break;
+		debug_token_put(tok, &c, 1);
+	}
+	c = '\0';
+	debug_token_put(tok, &c, 1);
+}
+
+/* Copy a complete record into the ringbuffer, or drop it.
+ * Must be called with interrupts disabled. */
+static void debug_token_commit(const struct debug_token *tok)
+{
+	uint8_t first;
+	uint16_t in;
+
+	if (tok->overrun ||
+	    ARRAY_SIZE(dbg_ringbuf) - 1u - dbg_ringbuf_used < tok->size) {
+		stats_dbg_overrun();
+		return;
+	}
+	first = (uint8_t)min(tok->size,
+			     ARRAY_SIZE(dbg_ringbuf) - dbg_ringbuf_in);
+	memcpy(&dbg_ringbuf[dbg_ringbuf_in], tok->buf, first);
+	memcpy(&dbg_ringbuf[0], &tok->buf[first], (uint8_t)(tok->size - first));
+	in = (uint16_t)(dbg_ringbuf_in + tok->size);
+	if (in >= ARRAY_SIZE(dbg_ringbuf))
+		in = (uint16_t)(in - ARRAY_SIZE(dbg_ringbuf));
+	dbg_ringbuf_in = (uint8_t)in;
+	dbg_ringbuf_used = (uint8_t)(dbg_ringbuf_used + tok->size);
+}
+
+/* Write a tokenized log record into the ringbuffer.
+ * The record is the format ID and the raw arguments.
+ * See the IRQ_LOGTOK record format in machine_interface.h.
+ * The record is encoded with interrupts enabled and then
+ * copied to the ringbuffer as a whole. */
+static void debug_log_token(const char PROGPTR *fmt, va_list args)
+{
+	struct debug_token tok;
+	union {
+		uint16_t u16;
+		uint32_t u32;
+		float f;
+	} arg;
+	uint8_t sreg;
+	bool is_long;
+	char c;
+
+	tok.size = 1u; /* Size byte */
+	tok.overrun = 0;
+
+	arg.u16 = debug_fmt_id(fmt);
+	debug_token_put(&tok, &arg.u16, 2);
+
+	while ((c = (char)pgm_read_byte(fmt++)) != '\0') {
+		if (c != '%')
+			continue;
+
+		/* Skip the flags, width and precision. */
+		is_long = 0;
+		while (1) {
+			c = (char)pgm_read_byte(fmt++);
+			if (c == '*') {
+				arg.u16 = (uint16_t)va_arg(args, int);
+				debug_token_put(&tok, &arg.u16, 2);
+			} else if (c == 'l') {
+				is_long = 1;
+			} else if (!((c >= '0' && c <= '9') ||
+				     c == '#' || c == '-' || c == '+' ||
+				     c == ' ' || c == '.' || c == 'h')) {
+				break;
+			}
+		}
+
+		switch (c) {
+		case '\0':
+			goto out;
+		case 'c':
+			arg.u16 = (uint16_t)va_arg(args, int);
+			debug_token_put(&tok, &arg.u16, 1);
+			break;
+		case 'd':
+		case 'i':
+		case 'o':
+		case 'u':
+		case 'x':
+		case 'X':
+			if (is_long) {
+				arg.u32 = (uint32_t)va_arg(args, long);
+				debug_token_put(&tok, &arg.u32, 4);
+			} else {
+				arg.u16 = (uint16_t)va_arg(args, int);
+				debug_token_put(&tok, &arg.u16, 2);
+			}
+			break;
+		case 'p':
+			arg.u16 = (uint16_t)(uintptr_t)va_arg(args, void *);
+			debug_token_put(&tok, &arg.u16, 2);
+			break;
+		case 's':
+			debug_token_put_str(&tok, va_arg(args, const char *), 0);
+			break;
+		case 'S':
+			debug_token_put_str(&tok, va_arg(args, const char *), 1);
+			break;
+		case 'e':
+		case 'E':
+		case 'f':
+		case 'F':
+		case 'g':
+		case 'G':
+			arg.f = (float)va_arg(args, double);
+			debug_token_put(&tok, &arg.f, 4);
+			break;
+		default: /* %% */
+			break;
+		}
+	}
+out:
+	tok.buf[0] = tok.size;
+
+	sreg = irq_disable_save();
+	debug_token_commit(&tok);
+	irq_restore(sreg);
+}
+
 void do_debug_printf(const char PROGPTR *fmt, ...)
+{
+	va_list args;
+#ifdef LOGTOK_UART
+	va_list tok_args;
+#endif
+
+	va_start(args, fmt);
+	if (devflag_is_set(DEVICE_FLG_USBLOGTOK) &&
+	    devflag_is_set(DEVICE_FLG_USBLOGMSG)) {
+		/* The host formats the message. */
+#ifdef LOGTOK_UART
+		va_copy(tok_args, args);
+		debug_log_token(fmt, tok_args);
+		va_end(tok_args);
+		vfprintf_P(&uart_fstream, fmt, args);
+#else
+		debug_log_token(fmt, args);
+#endif
+	} else
+		vfprintf_P(&debug_fstream, fmt, args);
+	va_end(args);
+}
+
+void do_uart_printf(const char PROGPTR *fmt, ...)
 {
 	va_list args;
 
 	va_start(args, fmt);
-	vfprintf_P(&debug_fstream, fmt, args);
+	vfprintf_P(&uart_fstream, fmt, args);
 	va_end(args);
 }
 
@@ -110,14 +371,15 @@ void debug_dumpmem(const void *_mem, uint8_t size)
 	for (i = 0; i < size; i++) {
 		if (i % 16 == 0) {
 			if (i != 0)
-				debug_putchar('\n');
+				debug_printf("\n");
 			debug_printf("0x%02X: ", i);
 		}
 		if (i % 2 == 0)
-			debug_putchar(' ');
-		debug_printf("%02X", mem[i]);
+			debug_printf(" %02X", mem[i]);
+		else
+			debug_printf("%02X", mem[i]);
 	}
-	debug_putchar('\n');
+	debug_printf("\n");
 }
 
 void debug_init(void)
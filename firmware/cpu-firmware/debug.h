@@ -10,17 +10,27 @@
 void debug_init(void);
 
 void do_debug_printf(const char PROGPTR *fmt, ...);
+void do_uart_printf(const char PROGPTR *fmt, ...);
 
-#define _debug_printf(pfmt, ...)	do {				\
-		if (debug_enabled())					\
-			do_debug_printf(pfmt ,##__VA_ARGS__);		\
-	} while (0)
+/* The format strings are named "__debug_fmt" objects.
+ * logtab.py builds the host's log table from these symbols. */
+#ifdef SIMULATOR
+# define DEBUG_FMT_ATTR		__attribute__((__section__("dbgfmt"), __used__))
+#else
+# define DEBUG_FMT_ATTR		PROGMEM
+#endif
 
 #define debug_printf(fmt, ...)		do {				\
-		if (debug_enabled())					\
-			do_debug_printf(PSTR(fmt) ,##__VA_ARGS__);	\
+		if (debug_enabled()) {					\
+			static const char DEBUG_FMT_ATTR __debug_fmt[] = fmt;	\
+			do_debug_printf(__debug_fmt ,##__VA_ARGS__);	\
+		}							\
 	} while (0)
 
+/* Text output to the UART only. It does not depend on the debug
+ * flags, so do_panic() and reboot() use it with interrupts disabled. */
+#define uart_printf(fmt, ...)	do_uart_printf(PSTR(fmt) ,##__VA_ARGS__)
+
 void debug_dumpmem(const void *_mem, uint8_t size);
 
 static inline bool debug_enabled(void)
@@ -44,4 +54,18 @@ uint8_t debug_ringbuf_count(void);
  * Returns the number of bytes copied to the target buffer. */
 uint8_t debug_ringbuf_get(void *buf, uint8_t size);
 
+/** debug_ringbuf_get_tokens - Get tokenized log records from the ringbuffer.
+ * @buf: Target buffer
+ * @size: Target buffer size
+ * @start: Returns the offset of the first record start in @buf,
+ *         or LOGTOK_NOSTART.
+ * Returns the number of bytes copied to the target buffer. */
+uint8_t debug_ringbuf_get_tokens(void *buf, uint8_t size, uint8_t *start);
+
+/** debug_ringbuf_flush - Discard the contents of the ringbuffer. */
+void debug_ringbuf_flush(void);
+
+/** debug_ringbuf_ramsize - SRAM size of the ringbuffer, in bytes. */
+uint16_t debug_ringbuf_ramsize(void);
+
 #endif /* DEBUG_INTERFACE_H_ */
@@ -146,13 +146,13 @@ class StringDescriptor(object):
 	def __init__(self, string=None, ccode=None, strId=None):
 		if ccode is None:
 			ccode = []
-			uni = string.encode("UTF-16-LE")
+			uni = bytearray(string.encode("UTF-16-LE"))
 			for i in range(0, len(uni), 2):
 				pfx = ""
 				if i != 0 and i % 8 == 0:
 					pfx = "\n\t"
 				ccode.append("%s0x%02X, 0x%02X" %\
-					(pfx, ord(uni[i]), ord(uni[i+1])))
+					(pfx, uni[i], uni[i+1]))
 			self.ccode = ", ".join(ccode)
 			self.text = string
 		else:
@@ -333,7 +333,7 @@ class Device(Descriptor):
 		return "".join(s)
 
 	def dump(self):
-		print self
+		print(self)
 
 class Configuration(Descriptor):
 	def __init__(self, device):
@@ -411,7 +411,7 @@ device = Device()
 try:
 	device.set("idVendor", int(sys.argv[1], 16))
 	device.set("idProduct", int(sys.argv[2], 16))
-except (ValueError, IndexError), e:
+except (ValueError, IndexError) as e:
 	pass
 
 atexit.register(device.dump)
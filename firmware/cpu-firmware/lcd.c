@@ -15,6 +15,7 @@
  */
 
 #include "lcd.h"
+#include "stats.h"
 
 #include <avr/io.h>
 #include <util/delay.h>
@@ -153,6 +154,11 @@ void lcd_cmd_cursor(uint8_t line, uint8_t column)
 			      (column & (LCD_NR_COLUMNS - 1u))));
 }
 
+uint16_t lcd_ramsize(void)
+{
+	return sizeof(lcd_buffer);
+}
+
 /** lcd_clear_buffer - Clear the software buffer. */
 void lcd_clear_buffer(void)
 {
@@ -165,6 +171,7 @@ void lcd_commit(void)
 {
 	uint8_t line, col;
 	const uint8_t *buf = lcd_buffer;
+	perf_time_t start = perf_timer_get();
 
 	for (line = 0; line < LCD_NR_LINES; line++) {
 		lcd_cmd_cursor(line, 0);
@@ -172,6 +179,8 @@ void lcd_commit(void)
 			lcd_data(*buf++);
 	}
 	lcd_cmd_cursor(lcd_getline(), lcd_getcolumn());
+
+	stats_lcd_commit(start);
 }
 
 /** lcd_put_char - Put one character into software buffer. */
@@ -45,6 +45,9 @@ void lcd_put_pstr(const char PROGPTR *str);
 
 void lcd_clear_buffer(void);
 
+/** lcd_ramsize - SRAM size of the software buffer, in bytes. */
+uint16_t lcd_ramsize(void);
+
 /** lcd_cursor - Move the LCD software cursor. */
 static inline void lcd_cursor(uint8_t line, uint8_t column)
 {
@@ -0,0 +1,168 @@
+"""
+ *   CNC-remote-control
+ *   Tokenized debug log table generator
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+"""
+
+# Extracts the debug_printf() format strings from the firmware ELF
+# and writes the format ID to string table for the host driver.
+# The format ID is the address of the "__debug_fmt" object.
+# In the simulator it is relative to the "dbgfmt" section.
+#
+# Usage: logtab.py FIRMWARE.elf > FIRMWARE.logtab
+
+import sys
+import struct
+import json
+
+
+LOGTAB_FORMAT		= 1
+FMT_SYMBOL		= "__debug_fmt"
+FMT_SECTION		= "dbgfmt"
+
+SHT_SYMTAB		= 2
+SHT_NOBITS		= 8
+STT_OBJECT		= 1
+SHN_UNDEF		= 0
+SHN_LORESERVE		= 0xFF00
+
+class ElfError(Exception):
+	pass
+
+class Section(object):
+	def __init__(self, name, shType, addr, offset, size, link, entsize):
+		self.name = name
+		self.type = shType
+		self.addr = addr
+		self.offset = offset
+		self.size = size
+		self.link = link
+		self.entsize = entsize
+
+class Elf(object):
+	def __init__(self, data):
+		self.data = data
+		if data[0:4] != b"\x7fELF":
+			raise ElfError("Not an ELF file")
+		self.is64 = { 1: False, 2: True }.get(data[4])
+		if self.is64 is None:
+			raise ElfError("Unknown ELF class")
+		self.endian = { 1: "<", 2: ">" }.get(data[5])
+		if self.endian is None:
+			raise ElfError("Unknown ELF byte order")
+		if self.is64:
+			(shoff, shentsize, shnum, shstrndx) =\
+				self.unpack("40xQ10xHHH", 0)
+		else:
+			(shoff, shentsize, shnum, shstrndx) =\
+				self.unpack("32xI10xHHH", 0)
+		self.sections = [ self.__parseSection(shoff + i * shentsize)
+				  for i in range(shnum) ]
+		names = self.sections[shstrndx]
+		for sec in self.sections:
+			sec.name = self.string(names, sec.name)
+
+	def unpack(self, fmt, offset):
+		fmt = self.endian + fmt
+		return struct.unpack_from(fmt, self.data, offset)
+
+	def __parseSection(self, offset):
+		if self.is64:
+			(name, shType, flags, addr, secOffset, size, link, info,
+			 align, entsize) = self.unpack("IIQQQQIIQQ", offset)
+		else:
+			(name, shType, flags, addr, secOffset, size, link, info,
+			 align, entsize) = self.unpack("IIIIIIIIII", offset)
+		return Section(name, shType, addr, secOffset, size, link, entsize)
+
+	def string(self, section, offset):
+		start = section.offset + offset
+		end = self.data.index(b"\0", start)
+		return self.data[start:end].decode("latin-1")
+
+	def section(self, name):
+		for sec in self.sections:
+			if sec.name == name:
+				return sec
+		return None
+
+	def symbols(self):
+		# Yields (name, value, size, type, sectionIndex)
+		for symtab in self.sections:
+			if symtab.type != SHT_SYMTAB or not symtab.entsize:
+				continue
+			strtab = self.sections[symtab.link]
+			for offset in range(symtab.offset,
+					    symtab.offset + symtab.size,
+					    symtab.entsize):
+				if self.is64:
+					(name, info, other, shndx, value, size) =\
+						self.unpack("IBBHQQ", offset)
+				else:
+					(name, value, size, info, other, shndx) =\
+						self.unpack("IIIBBH", offset)
+				yield (self.string(strtab, name), value, size,
+				       info & 0xF, shndx)
+
+	def read(self, section, addr, size):
+		if section.type == SHT_NOBITS:
+			raise ElfError("Section %s has no data" % section.name)
+		start = section.offset + (addr - section.addr)
+		return self.data[start:start+size]
+
+def isFmtSymbol(name):
+	# Static locals may get a numbered suffix, for example "__debug_fmt.12"
+	return name == FMT_SYMBOL or name.startswith(FMT_SYMBOL + ".")
+
+def logtab(elf):
+	fmtSection = elf.section(FMT_SECTION)
+	base = fmtSection.addr if fmtSection else 0
+
+	strings = {}
+	for (name, value, size, symType, shndx) in elf.symbols():
+		if not isFmtSymbol(name) or symType != STT_OBJECT:
+			continue
+		if shndx == SHN_UNDEF or shndx >= SHN_LORESERVE:
+			continue
+		data = elf.read(elf.sections[shndx], value, size)
+		fmt = data.split(b"\0")[0].decode("latin-1")
+		fmtId = value - base
+		if fmtId < 0 or fmtId > 0xFFFF:
+			raise ElfError("Format ID of %s out of range" % name)
+		prev = strings.get(fmtId)
+		if prev is not None and prev != fmt:
+			raise ElfError("Format ID 0x%04X is ambiguous" % fmtId)
+		strings[fmtId] = fmt
+
+	return {
+		"format"	: LOGTAB_FORMAT,
+		"strings"	: dict((str(fmtId), strings[fmtId])
+				       for fmtId in sorted(strings)),
+	}
+
+def main():
+	if len(sys.argv) != 2:
+		print("Usage: logtab.py FIRMWARE.elf", file=sys.stderr)
+		return 1
+	try:
+		with open(sys.argv[1], "rb") as f:
+			elf = Elf(f.read())
+		table = logtab(elf)
+	except (IOError, ValueError, struct.error, ElfError) as e:
+		print("logtab.py: %s" % str(e), file=sys.stderr)
+		return 1
+	sys.stdout.write(json.dumps(table, indent=1) + "\n")
+	return 0
+
+if __name__ == "__main__":
+	sys.exit(main())
@@ -24,6 +24,7 @@
 #include "debug.h"
 #include "lcd.h"
 #include "tiny-list.h"
+#include "stats.h"
 
 #include <avr/wdt.h>
 
@@ -43,6 +44,7 @@ static struct tiny_list tx_free;
 static uint8_t tx_free_count;
 static bool irq_queue_overflow;
 static uint8_t irq_sequence_number;
+static uint8_t stream_sequence_number;
 
 
 uint16_t active_devflags;
@@ -53,6 +55,11 @@ uint8_t interrupt_queue_freecount(void)
 	return ATOMIC_LOAD(tx_free_count);
 }
 
+uint16_t interrupt_queue_ramsize(void)
+{
+	return sizeof(tx_queue_entry_buffer);
+}
+
 static void tqentry_free(struct tx_queue_entry *e)
 {
 	tlist_move_tail(&e->list, &tx_free);
@@ -91,6 +98,7 @@ void usb_app_reset(void)
 
 	irq_queue_overflow = 0;
 	irq_sequence_number = 0;
+	stream_sequence_number = 0;
 
 	irq_restore(sreg);
 }
@@ -123,6 +131,10 @@ static uint16_t do_modify_devflags(uint16_t mask, uint16_t set)
 	flags |= mask & set;
 	flags &= ~mask | set;
 	if (flags != active_devflags) {
+		/* The ringbuffer contents belong to the old log format. */
+		if ((flags ^ active_devflags) &
+		    (DEVICE_FLG_USBLOGMSG | DEVICE_FLG_USBLOGTOK))
+			debug_ringbuf_flush();
 		active_devflags = flags;
 		update_userinterface();
 	}
@@ -160,11 +172,15 @@ static noreturn void enter_bootloader(void)
 	pdiusb_exit();
 
 	/* Jump to bootloader code */
+#ifdef SIMULATOR
+	sim_enter_bootloader();
+#else
 	__asm__ __volatile__(
 	"ijmp\n"
 	: /* None */
 	: [_Z]		"z" (BOOT_OFFSET / 2)
 	);
+#endif
 	unreachable();
 }
 
@@ -272,6 +288,90 @@ static int8_t rx_raw_message(const void *msg, uint8_t ctl_size,
 	}
 	case CONTROL_EXITBOOT:
 		break;
+	case CONTROL_GETSTATS: {
+		struct device_stats s;
+
+		stats_snapshot(&s);
+
+		init_control_reply(reply, REPLY_STATS, 0, ctl->seqno);
+		reply->stats.mainloop_rate = s.mainloop_rate;
+		reply->stats.irqq_hwm = s.irqq_hwm;
+		reply->stats._reserved = 0;
+		reply->stats.irqq_drops = s.irqq_drops;
+		reply->stats.spi_retries = s.spi_retries;
+		reply->stats.lcd_commits = s.lcd_commits;
+		reply->stats.lcd_time_max = s.lcd_time_max;
+		reply->stats.usb_irqs = s.usb_irqs;
+		reply->stats.usb_irq_max = s.usb_irq_max;
+		reply->stats.dbg_overruns = s.dbg_overruns;
+		reply->stats.uart_drops = s.uart_drops;
+		return CONTROL_REPLY_SIZE(stats);
+	}
+	case CONTROL_GETSRAM: {
+		struct sram_usage u;
+
+		stats_sram(&u);
+
+		init_control_reply(reply, REPLY_SRAM, 0, ctl->seqno);
+		reply->sram.ram_size = u.ram_size;
+		reply->sram.static_size = u.static_size;
+		reply->sram.stack_max = u.stack_max;
+		reply->sram.stack_unused = u.stack_unused;
+		reply->sram.irqq_size = u.irqq_size;
+		reply->sram.dbg_ring_size = u.dbg_ring_size;
+		reply->sram.lcd_size = u.lcd_size;
+		reply->sram.usb_size = u.usb_size;
+		reply->sram.uart_size = u.uart_size;
+		return CONTROL_REPLY_SIZE(sram);
+	}
+	case CONTROL_GETTIME: {
+		init_control_reply(reply, REPLY_VAL16, 0, ctl->seqno);
+		reply->val16.value = get_jiffies();
+		return CONTROL_REPLY_SIZE(val16);
+	}
+	case CONTROL_GETLOOPHIST: {
+		uint8_t table;
+
+		if (ctl_size < CONTROL_MSG_SIZE(getloophist))
+			goto err_size;
+		table = ctl->getloophist.table;
+		if (table >= LOOPHIST_NR_TABLES)
+			goto err_inval;
+
+		init_control_reply(reply, REPLY_LOOPHIST, 0, ctl->seqno);
+		reply->loophist.table = table;
+		memset(reply->loophist.values, 0, sizeof(reply->loophist.values));
+		reply->loophist.count = stats_loophist_get(table,
+							   reply->loophist.values);
+		if (ctl->getloophist.flags & LOOPHIST_FLG_RESET)
+			stats_loophist_reset();
+		return CONTROL_REPLY_SIZE(loophist);
+	}
+#ifdef IRQTRACE
+	case CONTROL_GETIRQTRACE: {
+		struct irqtrace_entry e;
+		uint16_t lost;
+		uint8_t index, nr;
+
+		if (ctl_size < CONTROL_MSG_SIZE(getirqtrace))
+			goto err_size;
+		index = ctl->getirqtrace.index;
+
+		memset(&e, 0, sizeof(e));
+		nr = irqtrace_get(index, &e, &lost);
+		if (ctl->getirqtrace.flags & IRQTRACE_FLG_RESET)
+			irqtrace_reset();
+
+		init_control_reply(reply, REPLY_IRQTRACE, 0, ctl->seqno);
+		reply->irqtrace.index = index;
+		reply->irqtrace.nr_sites = nr;
+		reply->irqtrace.lost = lost;
+		reply->irqtrace.site = e.site;
+		reply->irqtrace.max_usec = e.max_usec;
+		reply->irqtrace.calls = e.calls;
+		return CONTROL_REPLY_SIZE(irqtrace);
+	}
+#endif
 	default:
 		goto err_command;
 	}
@@ -359,13 +459,37 @@ uint8_t usb_app_ep1_tx_poll(void *buffer)
 	return ret_size;
 }
 
+/* Bulk IN endpoint. The replies are sent before this is polled. */
 uint8_t usb_app_ep2_tx_poll(void *buffer)
 {
-	return USB_APP_UNHANDLED;
+	struct control_reply *reply = buffer;
+	uint8_t count;
+
+	if (!devflag_is_set(DEVICE_FLG_USBSTREAM) ||
+	    !devflag_is_set(DEVICE_FLG_USBLOGMSG))
+		return USB_APP_UNHANDLED;
+
+	if (devflag_is_set(DEVICE_FLG_USBLOGTOK)) {
+		count = debug_ringbuf_get_tokens(reply->stream.data,
+						 sizeof(reply->stream.data),
+						 &reply->stream.start);
+		reply->stream.type = STREAM_LOGTOK;
+	} else {
+		count = debug_ringbuf_get(reply->stream.data,
+					  sizeof(reply->stream.data));
+		reply->stream.start = 0;
+		reply->stream.type = STREAM_LOGMSG;
+	}
+	if (!count)
+		return USB_APP_UNHANDLED;
+	init_control_reply(reply, REPLY_STREAM, 0, stream_sequence_number++);
+
+	return (uint8_t)(offsetof(struct control_reply, stream.data) + count);
 }
 
 static bool interface_queue_interrupt(const struct control_interrupt *irq,
-				      uint8_t size, uint8_t count)
+				      uint8_t size, uint8_t count,
+				      bool urgent)
 {
 	struct control_interrupt *irqbuf;
 	struct tx_queue_entry *e;
@@ -378,8 +502,12 @@ static bool interface_queue_interrupt(const struct control_interrupt *irq,
 	e = tqentry_alloc();
 	if (!e) {
 		irq_queue_overflow = 1;
+		irq_restore(sreg);
 		return 0;
 	}
+	stats_irqq_used((uint8_t)(INTERRUPT_QUEUE_MAX_LEN - tx_free_count));
+	if (urgent)
+		tlist_move_head(&e->list, &tx_queued);
 	e->size = size;
 	e->count = count;
 	irqbuf = &e->buffer;
@@ -416,6 +544,7 @@ static bool interface_drop_one_droppable_irq(void)
 		if (e->buffer.flags & IRQ_FLG_DROPPABLE) {
 			/* Dequeue and discard it. */
 			tqentry_free(e);
+			stats_irqq_drop();
 			dropped = 1;
 			break;
 		}
@@ -425,21 +554,24 @@ static bool interface_drop_one_droppable_irq(void)
 	return dropped;
 }
 
-void send_interrupt_count(const struct control_interrupt *irq,
-			  uint8_t size, uint8_t count)
+static void do_send_interrupt(const struct control_interrupt *irq,
+			      uint8_t size, uint8_t count, bool urgent)
 {
 	bool ok, dropped;
 	uint8_t i;
+	struct perf_stamp retry_start;
 
 	while (1) {
 		for (i = 0; i < 5; i++) {
-			ok = interface_queue_interrupt(irq, size, count);
+			ok = interface_queue_interrupt(irq, size, count, urgent);
 			if (likely(ok))
 				return;
 
 			if (irqs_disabled())
 				break; /* Out of luck. */
+			perf_stamp_get(&retry_start);
 			_delay_ms(5);
+			stats_irq_retry(&retry_start);
 		}
 		debug_printf("Control IRQ queue overflow\n");
 
@@ -451,6 +583,20 @@ void send_interrupt_count(const struct control_interrupt *irq,
 			break;
 		debug_printf("Dropped one droppable IRQ\n");
 	}
+	/* This one is lost. */
+	stats_irqq_drop();
+}
+
+void send_interrupt_count(const struct control_interrupt *irq,
+			  uint8_t size, uint8_t count)
+{
+	do_send_interrupt(irq, size, count, 0);
+}
+
+void send_interrupt_urgent(const struct control_interrupt *irq,
+			   uint8_t size, uint8_t count)
+{
+	do_send_interrupt(irq, size, count, 1);
 }
 
 void send_interrupt_discard_old(const struct control_interrupt *irq,
@@ -140,6 +140,11 @@ enum control_id {
 	CONTROL_AXISENABLE,		/* Set the axis-enable mask */
 	CONTROL_ESTOPUPDATE,		/* E-stop status update */
 	CONTROL_SETINCREMENT,		/* Upload an increment definition */
+	CONTROL_GETSTATS,		/* Read the performance counters */
+	CONTROL_GETIRQTRACE,		/* Read an IRQ-disabled tracer entry */
+	CONTROL_GETLOOPHIST,		/* Read a main loop histogram table */
+	CONTROL_GETTIME,		/* Read the device clock */
+	CONTROL_GETSRAM,		/* Read the SRAM usage report */
 
 	/* Bootloader messages */
 	CONTROL_ENTERBOOT = 0xA0,	/* Enter the CPU/coprocessor bootloader */
@@ -147,8 +152,17 @@ enum control_id {
 	CONTROL_BOOT_WRITEBUF,		/* Write to the page buffer */
 	CONTROL_BOOT_FLASHPG,		/* Flash page buffer */
 	CONTROL_BOOT_EEPWRITE,		/* Write page buffer to eeprom */
+	CONTROL_BOOT_STREAMSTART,	/* Start a flash page stream */
+	CONTROL_BOOT_STREAMDATA,	/* Flash page stream data */
+	CONTROL_BOOT_PROGSTATUS,	/* Read the page programming status */
+	CONTROL_BOOT_PAGECRC,		/* Read flash page CRCs */
 };
 
+/* Stream data bytes in one 64 byte EP2 OUT packet */
+#define BOOT_STREAM_MAX_DATA	56
+/* Page CRCs in one 64 byte EP2 IN packet */
+#define BOOT_PAGECRC_MAX	28
+
 enum control_message_flags {
 	CONTROL_FLG_BOOTLOADER = 0x80,	/* Intended message recipient is the bootloader */
 };
@@ -160,6 +174,37 @@ enum device_flags {
 	DEVICE_FLG_TWOHANDEN	= (1ul << 3), /* Twohand switch enabled */
 	DEVICE_FLG_USBLOGMSG	= (1ul << 4), /* Send debug messages through USB */
 	DEVICE_FLG_G53COORDS	= (1ul << 5), /* Use machine coordinates */
+	DEVICE_FLG_USBLOGTOK	= (1ul << 6), /* Tokenized USB debug messages */
+	DEVICE_FLG_USBSTREAM	= (1ul << 7), /* USB debug messages on EP2 IN */
+};
+
+enum irqtrace_flags {
+	IRQTRACE_FLG_RESET	= (1 << 0), /* Clear the table after reading */
+};
+
+enum loophist_table {
+	LOOPHIST_LOOP,			/* Main loop iteration time histogram */
+	LOOPHIST_WDT,			/* Watchdog reset gap histogram */
+	LOOPHIST_CULPRIT,		/* Long iterations per enum loophist_stage */
+	LOOPHIST_NR_TABLES,
+};
+
+/* Histogram bucket 0 is below 64 usec. Bucket n is 2^(n+5) to 2^(n+6) usec.
+ * The last bucket also holds everything above. */
+#define LOOPHIST_NR_BUCKETS	12
+
+enum loophist_stage {
+	LOOPHIST_STAGE_BUTTONS,		/* interpret_buttons() */
+	LOOPHIST_STAGE_LCD,		/* update_lcd() */
+	LOOPHIST_STAGE_LEDS,		/* update_leds() */
+	LOOPHIST_STAGE_DEBUGRING,	/* handle_debug_ringbuffer() */
+	LOOPHIST_STAGE_IRQRETRY,	/* Blocking interrupt queue retries */
+	LOOPHIST_STAGE_OTHER,		/* Everything else */
+	NR_LOOPHIST_STAGES,
+};
+
+enum loophist_flags {
+	LOOPHIST_FLG_RESET	= (1 << 0), /* Clear all tables after reading */
 };
 
 enum enterboot_magic {
@@ -167,6 +212,17 @@ enum enterboot_magic {
 	ENTERBOOT_MAGIC1 = 0x07,
 };
 
+enum boot_prog_status {
+	BOOT_PROG_IDLE,			/* Not programming. No errors */
+	BOOT_PROG_BUSY,			/* Programming a CPU page */
+	BOOT_PROG_FAILED,		/* A page failed to verify */
+};
+
+enum boot_stream_encoding {
+	BOOT_STREAM_RAW,		/* Plain page data */
+	BOOT_STREAM_RLE,		/* Run length encoded page data */
+};
+
 enum mcu_target {
 	TARGET_CPU,			/* Target is the CPU */
 	TARGET_COPROC,			/* Target is the coprocessor */
@@ -214,6 +270,20 @@ struct control_message {
 			fixpt_t increment;
 			uint8_t index;
 		} __packed setincrement;
+		struct {
+		} __packed getstats;
+		struct {
+			uint8_t index;
+			uint8_t flags; /* enum irqtrace_flags */
+		} __packed getirqtrace;
+		struct {
+			uint8_t table; /* enum loophist_table */
+			uint8_t flags; /* enum loophist_flags */
+		} __packed getloophist;
+		struct {
+		} __packed gettime;
+		struct {
+		} __packed getsram;
 
 		/* Bootloader messages */
 		struct {
@@ -238,9 +308,64 @@ struct control_message {
 			uint16_t size;
 			uint8_t target; /* enum mcu_target */
 		} __packed boot_eepwrite;
+		struct {
+			uint8_t target;		/* enum mcu_target */
+			uint8_t encoding;	/* enum boot_stream_encoding */
+		} __packed boot_streamstart;
+		struct {
+			uint16_t address;	/* Flash address of the first decoded byte */
+			uint8_t size;		/* Number of valid (encoded) data bytes */
+			uint8_t crc;		/* Last chunk of a page: Page CRC */
+			uint8_t data[BOOT_STREAM_MAX_DATA];
+		} __packed boot_streamdata;
+		struct {
+		} __packed boot_progstatus;
+		struct {
+			uint16_t address;	/* Flash address of the first page */
+			uint8_t count;		/* Number of pages */
+			uint8_t target;		/* enum mcu_target */
+		} __packed boot_pagecrc;
 	} __packed;
 } __packed;
 
+/* Flash page stream.
+ * CONTROL_BOOT_STREAMSTART selects the target MCU. The following
+ * CONTROL_BOOT_STREAMDATA messages fill the pages in order and must
+ * continue the header seqno of the STREAMSTART message without gaps.
+ * Only the last chunk of a page is replied to.
+ * Pages are programmed in the background. The reply acknowledges
+ * the page data and reports programming errors of the previous page.
+ * CONTROL_BOOT_PROGSTATUS returns the enum boot_prog_status as
+ * REPLY_VAL16. Poll it after the last page, until it is not busy.
+ * Coprocessor pages are transferred to the coprocessor before the reply.
+ * Coprocessor bootloaders without SPI_CONTROL_FLASHBLOCK also flash
+ * them before the reply.
+ * The host may send up to BOOT_STREAM_WINDOW pages without waiting for
+ * their replies. More would block on the device's receive buffers.
+ * After an error reply the stream data is ignored without reply until
+ * the next STREAMSTART. Any other message also ends the stream. */
+#define BOOT_STREAM_WINDOW	2
+
+/* Stream encoding.
+ * The STREAMSTART reply is REPLY_VAL16 with the enum boot_stream_encoding
+ * in use. Bootloaders without encodings reply REPLY_OK and use raw data.
+ * A missing encoding byte selects BOOT_STREAM_RAW.
+ * BOOT_STREAM_RLE data is a sequence of tokens:
+ *   BOOT_RLE_RUN clear:  (token & BOOT_RLE_COUNT) + 1 literal bytes follow.
+ *   BOOT_RLE_RUN set:    The next byte repeats (token & BOOT_RLE_COUNT) + 2
+ *                        times.
+ * Tokens do not cross messages or pages. The page CRC is the CRC of the
+ * decoded data. */
+#define BOOT_RLE_RUN		0x80u
+#define BOOT_RLE_COUNT		0x7Fu
+
+/* CONTROL_BOOT_PAGECRC replies with REPLY_PAGECRC.
+ * The CRC of a page is the CRC16 (polynomial 0xA001, start value 0xFFFF)
+ * of its bytes. See spi_page_crc. The reply is truncated after
+ * the last CRC. The host skips flashing the pages that match.
+ * Coprocessor bootloaders without SPI_CONTROL_PAGECRC reply
+ * CTLERR_COMMAND. */
+
 #define CONTROL_MSG_SIZE(name)	(offsetof(struct control_message, name) +\
 				 sizeof(((struct control_message *)0)->name))
 #define CONTROL_MSG_HDR_SIZE	CONTROL_MSG_SIZE(_header_end)
@@ -257,8 +382,22 @@ enum reply_id {
 	REPLY_OK,
 	REPLY_ERROR,
 	REPLY_VAL16,
+	REPLY_STATS,
+	REPLY_IRQTRACE,
+	REPLY_LOOPHIST,
+	REPLY_STREAM,		/* Unsolicited stream packet. See DEVICE_FLG_USBSTREAM */
+	REPLY_SRAM,
+	REPLY_PAGECRC,
+};
+
+enum stream_type {
+	STREAM_LOGMSG,		/* Debug message text */
+	STREAM_LOGTOK,		/* Tokenized log records */
 };
 
+/* Stream data bytes in one 64 byte EP2 IN packet */
+#define STREAM_MAX_DATA		58
+
 enum reply_error {
 	CTLERR_UNDEFINED,	/* Undefined error */
 	CTLERR_COMMAND,		/* Unknown command */
@@ -269,6 +408,7 @@ enum reply_error {
 	CTLERR_CONTEXT,		/* Invalid context (boot vs app) */
 	CTLERR_CHECKSUM,	/* Checksum/parity error */
 	CTLERR_CMDFAIL,		/* Command failed */
+	CTLERR_SEQUENCE,	/* Lost or reordered stream message */
 };
 
 /* Control reply to the CNC machine. */
@@ -289,9 +429,63 @@ struct control_reply {
 		struct {
 			uint16_t value;
 		} __packed val16;
+		struct {
+			uint16_t mainloop_rate;	/* Main loop iterations per second */
+			uint8_t irqq_hwm;	/* Interrupt queue high-water mark */
+			uint8_t _reserved;
+			uint16_t irqq_drops;	/* Dropped interrupts */
+			uint16_t spi_retries;	/* Coprocessor SPI checksum retries */
+			uint16_t lcd_commits;	/* Number of LCD commits */
+			uint16_t lcd_time_max;	/* Longest LCD commit, in usec */
+			uint16_t usb_irqs;	/* Number of USB interrupts */
+			uint16_t usb_irq_max;	/* Longest USB interrupt, in usec */
+			uint16_t dbg_overruns;	/* Debug ringbuffer overruns */
+			uint16_t uart_drops;	/* Dropped UART TX bytes */
+		} __packed stats;
+		struct {
+			uint8_t index;		/* Table index */
+			uint8_t nr_sites;	/* Number of used table entries */
+			uint16_t lost;		/* Sections not fitting into the table */
+			uint16_t site;		/* Call site word address */
+			uint16_t max_usec;	/* Longest duration with IRQs disabled */
+			uint16_t calls;		/* Number of sections */
+		} __packed irqtrace;
+		struct {
+			uint8_t table;		/* enum loophist_table */
+			uint8_t count;		/* Number of valid values */
+			uint16_t values[LOOPHIST_NR_BUCKETS];
+		} __packed loophist;
+		struct {
+			uint8_t type;		/* enum stream_type */
+			uint8_t start;		/* STREAM_LOGTOK: Offset of the first record start */
+			uint8_t data[STREAM_MAX_DATA];
+		} __packed stream;
+		struct {
+			uint16_t ram_size;	/* Total SRAM */
+			uint16_t static_size;	/* .data and .bss */
+			uint16_t stack_max;	/* Stack high-water mark since boot */
+			uint16_t stack_unused;	/* Never used by the stack */
+			uint16_t irqq_size;	/* Interrupt queue */
+			uint16_t dbg_ring_size;	/* Debug ringbuffer */
+			uint16_t lcd_size;	/* LCD buffer */
+			uint16_t usb_size;	/* USB endpoint buffers */
+			uint16_t uart_size;	/* UART TX ringbuffer */
+		} __packed sram;
+		struct {
+			uint16_t address;	/* Flash address of the first page */
+			uint8_t count;		/* Number of valid CRCs */
+			uint8_t _reserved;
+			uint16_t crc[BOOT_PAGECRC_MAX];
+		} __packed pagecrc;
 	} __packed;
 } __packed;
 
+/* With DEVICE_FLG_USBSTREAM, the debug messages are not sent as interrupts.
+ * The host polls EP2 IN for them instead. Each packet is a REPLY_STREAM
+ * with the data bytes up to the end of the USB packet.
+ * The seqno counts the packets, so the host can detect lost packets.
+ * Stream packets may precede the reply to a control message. */
+
 #define CONTROL_REPLY_SIZE(name)	(offsetof(struct control_reply, name) +\
 					 sizeof(((struct control_reply *)0)->name))
 #define CONTROL_REPLY_HDR_SIZE		CONTROL_REPLY_SIZE(_header_end)
@@ -314,6 +508,7 @@ enum interrupt_id {
 	IRQ_DEVFLAGS,		/* Device flags changed. */
 	IRQ_HALT,		/* Halt motion */
 	IRQ_LOGMSG,		/* Log message */
+	IRQ_LOGTOK,		/* Tokenized log records */
 };
 
 enum control_irq_flags {
@@ -342,6 +537,7 @@ struct control_interrupt {
 			fixpt_t velocity;
 			uint8_t axis;
 			uint8_t flags;
+			uint16_t timestamp;	/* Device time of the input, in jiffies */
 		} __packed jog;
 		struct {
 		} __packed jog_keepalife;
@@ -355,13 +551,31 @@ struct control_interrupt {
 			uint16_t flags;
 		} __packed devflags;
 		struct {
+			uint16_t latency;	/* Button edge to queue, in usec */
+			uint16_t timestamp;	/* Device time of the edge, in jiffies */
 		} __packed halt;
 		struct {
 			uint8_t msg[10];
 		} __packed logmsg;
+		struct {
+			uint8_t start;		/* Offset of the first record start in data */
+			uint8_t data[9];
+		} __packed logtok;
 	} __packed;
 } __packed;
 
+/* Tokenized log records (DEVICE_FLG_USBLOGTOK).
+ * Each debug_printf() call is sent as one record:
+ *   u8  Size of the record, including this byte
+ *   u16 Format ID. The address of the format string in the firmware image
+ *   ... The arguments, little endian:
+ *       %c: 1 byte, %d %i %o %u %x %X %p and '*': 2 bytes,
+ *       %ld ... %lX: 4 bytes, %e %f %g: 4 byte float,
+ *       %s %S: NUL terminated string of up to LOGTOK_MAX_STRLEN chars.
+ * The records are split into IRQ_LOGTOK data chunks. */
+#define LOGTOK_NOSTART		0xFF	/* No record starts in this chunk */
+#define LOGTOK_MAX_STRLEN	32
+
 #define CONTROL_IRQ_SIZE(name)		(offsetof(struct control_interrupt, name) +\
 					 sizeof(((struct control_interrupt *)0)->name))
 #define CONTROL_IRQ_HDR_SIZE		CONTROL_IRQ_SIZE(_header_end)
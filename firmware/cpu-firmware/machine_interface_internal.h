@@ -12,6 +12,9 @@
  */
 uint8_t interrupt_queue_freecount(void);
 
+/** interrupt_queue_ramsize - SRAM size of the TX queue, in bytes. */
+uint16_t interrupt_queue_ramsize(void);
+
 void send_interrupt_count(const struct control_interrupt *irq,
 			  uint8_t size, uint8_t count);
 
@@ -25,6 +28,13 @@ void send_interrupt(const struct control_interrupt *irq,
 	send_interrupt_count(irq, size, 1);
 }
 
+/** send_interrupt_urgent - Send an interrupt to the host.
+ * The interrupt is queued in front of all pending interrupts.
+ * This may be called from IRQ context.
+ */
+void send_interrupt_urgent(const struct control_interrupt *irq,
+			   uint8_t size, uint8_t count);
+
 /** send_interrupt_discard_old - Send an interrupt to the host.
  * Also discard already queued IRQs of the same type.
  * It's not guaranteed that all old IRQs are discarded, though.
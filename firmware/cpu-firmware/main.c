@@ -22,6 +22,7 @@
 #include "4094.h"
 #include "pdiusb.h"
 #include "spi.h"
+#include "stats.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -53,6 +54,15 @@ enum softkey1_states {
 	NR_SK1_STATES,
 };
 
+/* Timestamped button event from the coprocessor */
+struct button_event {
+	uint8_t id;			/* SPI_EVENT_... */
+	jiffies_t time;			/* Time of the edge */
+};
+
+/* Button event queue size. Must be a power of two. */
+#define BUTTON_EVENT_QUEUE_SIZE	8
+
 /* The current state */
 struct device_state {
 	bool rapid;			/* Rapid-jog on */
@@ -86,10 +96,19 @@ struct device_state {
 	bool button_update_required;
 	uint16_t buttons;
 	int8_t jogwheel;
+	jiffies_t jogwheel_time;	/* Arrival of the oldest jogwheel state */
+
+	/* Button events. Use get_button_event() to access these fields. */
+	struct button_event events[BUTTON_EVENT_QUEUE_SIZE];
+	uint8_t events_in;
+	uint8_t events_out;
 
 	/* Softkey states */
 	uint8_t softkey[2];
 
+	/* Time of the input that is being interpreted */
+	jiffies_t event_time;
+
 	/* Emergency stop state (read only). */
 	bool estop;
 };
@@ -250,66 +269,231 @@ static void coprocessor_init(void)
 	GICR |= (1u << SPI_MASTER_TRANSIRQ_INT);
 }
 
-ISR(SPI_MASTER_TRANSIRQ_VECT)
-{
-	ATOMIC_STORE(state.button_update_required, 1);
-}
+/* Number of events fetched from the coprocessor per transfer */
+#define SPI_EVENT_BURST		3
 
 static struct spi_rx_data {
-	uint8_t _undefined;
+	uint8_t _undefined[2];
+	struct spi_rx_event {
+		uint8_t id;
+		uint8_t time_lo;
+		uint8_t time_hi;
+	} __packed events[SPI_EVENT_BURST];
 	uint8_t low;
 	uint8_t high;
 	uint8_t enc;
+	uint8_t time_lo;
+	uint8_t time_hi;
 	uint8_t sum;
 } __packed spi_rx_data;
 
+#define SPI_TX_GETEVENT		\
+	SPI_CONTROL_GETEVENT, SPI_CONTROL_GETEVENT, SPI_CONTROL_GETEVENT
+
 /* Commands sent to the coprocessor (in that order).
- * Must match struct spi_rx_data. */
-static const uint8_t PROGMEM spi_tx_data[] = {
+ * Must match struct spi_rx_data.
+ * The first command acknowledges the previous transfer, if it was good. */
+static uint8_t spi_tx_data[] = {
+	SPI_CONTROL_NOP,
+	SPI_TX_GETEVENT,
+	SPI_TX_GETEVENT,
+	SPI_TX_GETEVENT,
 	SPI_CONTROL_GETLOW,
 	SPI_CONTROL_GETHIGH,
 	SPI_CONTROL_GETENC,
+	SPI_CONTROL_GETTIMELO,
+	SPI_CONTROL_GETTIMEHI,
 	SPI_CONTROL_GETSUM,
 	SPI_CONTROL_NOP,
 };
 
-static void trigger_button_state_fetching(void)
+/* Delay between two bytes sent to the coprocessor, in jiffies.
+ * This gives the coprocessor time to load the reply byte.
+ * A complete transfer takes less than 3.5 ms. */
+#define SPI_BYTE_WAIT		3
+
+/* Start the coprocessor transfer, if it is not running already.
+ * May be called from IRQ context.
+ * 'restart' is set, if a transfer just finished. The coprocessor then
+ * needs the byte delay before the first byte, too. */
+static void trigger_button_state_fetching(bool restart)
 {
+	uint8_t sreg, flags;
+
 	BUILD_BUG_ON(sizeof(spi_tx_data) != sizeof(spi_rx_data));
 
+	sreg = irq_disable_save();
 	if (!spi_async_running()) {
-		ATOMIC_STORE(state.button_update_required, 0);
+		state.button_update_required = 0;
 
-		spi_async_start(&spi_rx_data, (const void *)spi_tx_data,
+		flags = restart ? SPI_ASYNC_DELAYSTART : 0;
+		spi_async_start(&spi_rx_data, spi_tx_data,
 				ARRAY_SIZE(spi_tx_data),
-				SPI_ASYNC_TXPROGMEM, 1);
+				flags, SPI_BYTE_WAIT);
 	}
+	irq_restore(sreg);
+}
+
+ISR(SPI_MASTER_TRANSIRQ_VECT)
+{
+	/* The coprocessor has new data. Fetch it right away.
+	 * If a transfer is running, spi_async_done() restarts it. */
+	ATOMIC_STORE(state.button_update_required, 1);
+	trigger_button_state_fetching(0);
+}
+
+/* The HALT button was pressed at 'time'.
+ * Send the HALT request right away, without waiting for the main loop.
+ * Runs with IRQs disabled. */
+static void halt_button_pressed(jiffies_t time)
+{
+	struct control_interrupt irq = {
+		.id		= IRQ_HALT,
+		.flags		= IRQ_FLG_PRIO,
+	};
+	uint32_t latency;
+
+	if (ATOMIC_LOAD(state.estop))
+		return;
+
+	latency = (uint32_t)(jiffies_t)(get_jiffies() - time) *
+		  (uint32_t)1000000 / JPS;
+	irq.halt.latency = (uint16_t)min(latency, (uint32_t)0xFFFF);
+	irq.halt.timestamp = time;
+
+	send_interrupt_urgent(&irq, CONTROL_IRQ_SIZE(halt), 3);
+}
+
+/* Queue a button event and apply it to the button state.
+ * Runs with IRQs disabled. */
+static void put_button_event(uint8_t id, jiffies_t time)
+{
+	struct button_event *ev;
+	uint16_t mask;
+
+	BUILD_BUG_ON(BUTTON_EVENT_QUEUE_SIZE & (BUTTON_EVENT_QUEUE_SIZE - 1));
+
+	mask = (uint16_t)BIT(id & SPI_EVENT_BUTTON_MASK);
+	if (id & SPI_EVENT_PRESSED) {
+		if ((mask & BTN_HALT) && !(state.buttons & BTN_HALT))
+			halt_button_pressed(time);
+		state.buttons |= mask;
+	} else
+		state.buttons = (uint16_t)(state.buttons & ~mask);
+
+	if ((uint8_t)(state.events_in - state.events_out) >=
+	    BUTTON_EVENT_QUEUE_SIZE) {
+		/* Queue overflow. The edge is still visible
+		 * in the button state. */
+		return;
+	}
+	ev = &state.events[state.events_in & (BUTTON_EVENT_QUEUE_SIZE - 1)];
+	ev->id = id;
+	ev->time = time;
+	state.events_in++;
+}
+
+/* Get the oldest button event. Returns false, if there is none. */
+static bool get_button_event(struct button_event *ev)
+{
+	bool ret = 0;
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	if (state.events_in != state.events_out) {
+		*ev = state.events[state.events_out & (BUTTON_EVENT_QUEUE_SIZE - 1)];
+		state.events_out++;
+		ret = 1;
+	}
+	irq_restore(sreg);
+
+	return ret;
+}
+
+static void flush_button_events(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	state.events_out = state.events_in;
+	irq_restore(sreg);
 }
 
 /* Runs with IRQs disabled */
 void spi_async_done(void)
 {
-	uint8_t expected_sum;
+	uint8_t i, expected_sum;
+	const struct spi_rx_event *rxev;
+	jiffies_t now, age;
+	uint16_t coproc_now, coproc_time, buttons;
+	bool drained = 0;
 
 	/* We got all spi_rx_data */
 
 	expected_sum = spi_rx_data.low ^ spi_rx_data.high ^
-		       spi_rx_data.enc ^ 0xFF;
+		       spi_rx_data.enc ^ spi_rx_data.time_lo ^
+		       spi_rx_data.time_hi ^ 0xFF;
+	for (i = 0; i < ARRAY_SIZE(spi_rx_data.events); i++) {
+		rxev = &spi_rx_data.events[i];
+		expected_sum ^= rxev->id ^ rxev->time_lo ^ rxev->time_hi;
+	}
 	if (unlikely(spi_rx_data.sum != expected_sum)) {
 		if (debug_verbose()) {
 			debug_printf("SPI: button checksum mismatch: "
 				     "was %02X, expected %02X\n",
 				     spi_rx_data.sum, expected_sum);
 		}
-		/* Try again */
-		trigger_button_state_fetching();
+		stats_spi_retry();
+		/* Try again. The coprocessor sends the same data again. */
+		spi_tx_data[0] = SPI_CONTROL_NOP;
+		trigger_button_state_fetching(1);
 		return;
 	}
 
 	/* Update state. */
 	BUG_ON(!irqs_disabled());
-	state.buttons = spi_rx_data.low | ((uint16_t)spi_rx_data.high << 8);
-	state.jogwheel = (int8_t)(state.jogwheel + (int8_t)spi_rx_data.enc);
+	spi_tx_data[0] = SPI_CONTROL_ACKEVENTS;
+
+	/* Convert the event timestamps to our timebase.
+	 * The coprocessor clock was latched during this transfer. */
+	BUILD_BUG_ON(SPI_TIMESTAMP_HZ % JPS != 0);
+	now = get_jiffies();
+	coproc_now = (uint16_t)(spi_rx_data.time_lo |
+				((uint16_t)spi_rx_data.time_hi << 8));
+	for (i = 0; i < ARRAY_SIZE(spi_rx_data.events); i++) {
+		rxev = &spi_rx_data.events[i];
+		if (rxev->id == SPI_EVENT_NONE) {
+			drained = 1;
+			break;
+		}
+		coproc_time = (uint16_t)(rxev->time_lo |
+					 ((uint16_t)rxev->time_hi << 8));
+		age = (jiffies_t)((uint16_t)(coproc_now - coproc_time) /
+				  (uint16_t)(SPI_TIMESTAMP_HZ / JPS));
+		put_button_event(rxev->id, (jiffies_t)(now - age));
+	}
+
+	if (drained) {
+		/* The coprocessor event FIFO is empty.
+		 * So the button state is up to date. */
+		buttons = spi_rx_data.low | ((uint16_t)spi_rx_data.high << 8);
+		if ((buttons & BTN_HALT) && !(state.buttons & BTN_HALT))
+			halt_button_pressed(now);
+		state.buttons = buttons;
+	} else {
+		/* There are more events pending. Fetch them. */
+		state.button_update_required = 1;
+	}
+	/* The encoder steps have no coprocessor timestamp.
+	 * Their time is the arrival of the first unread step. */
+	if (spi_rx_data.enc) {
+		if (!state.jogwheel)
+			state.jogwheel_time = now;
+		state.jogwheel = (int8_t)(state.jogwheel + (int8_t)spi_rx_data.enc);
+	}
+
+	if (state.button_update_required)
+		trigger_button_state_fetching(1);
 }
 
 /* Spindle state may change at any time before or right after this check */
@@ -319,7 +503,7 @@ static inline bool spindle_is_on(void)
 	return state.spindle_on;
 }
 
-static uint16_t get_buttons(int8_t *_jogwheel)
+static uint16_t get_buttons(int8_t *_jogwheel, jiffies_t *_jogwheel_time)
 {
 	uint16_t buttons;
 	int8_t jogwheel;
@@ -334,6 +518,7 @@ static uint16_t get_buttons(int8_t *_jogwheel)
 	 * So we convert the value to "wheel-clicks". */
 	jogwheel = state.jogwheel / 2;
 	state.jogwheel %= 2;
+	*_jogwheel_time = state.jogwheel_time;
 
 	irq_restore(sreg);
 
@@ -558,6 +743,7 @@ static void jog_incremental(int8_t inc_count)
 	irq.jog.axis = state.axis;
 	irq.jog.flags = state.rapid ? IRQ_JOG_RAPID : 0;
 	irq.jog.velocity = state.jog_velocity;
+	irq.jog.timestamp = state.event_time;
 
 	send_interrupt(&irq, CONTROL_IRQ_SIZE(jog));
 }
@@ -575,6 +761,7 @@ static void jog_stop(void)
 	irq.jog.axis = state.axis;
 	irq.jog.flags = IRQ_JOG_CONTINUOUS;
 	irq.jog.increment = INT32_TO_FIXPT(0);
+	irq.jog.timestamp = state.event_time;
 
 	send_interrupt_count(&irq, CONTROL_IRQ_SIZE(jog), 3);
 
@@ -600,6 +787,7 @@ static void jog(int8_t direction)
 				irq.jog.flags |= IRQ_JOG_RAPID;
 			irq.jog.velocity = state.jog_velocity;
 			irq.jog.increment = INT32_TO_FIXPT(direction > 0 ? 1 : -1);
+			irq.jog.timestamp = state.event_time;
 			send_interrupt(&irq, CONTROL_IRQ_SIZE(jog));
 
 			state.jog = direction > 0 ? JOG_RUNNING_POS : JOG_RUNNING_NEG;
@@ -646,16 +834,6 @@ static void handle_jog_keepalife(void)
 	set_jog_keepalife_deadline();
 }
 
-static void halt_motion(void)
-{
-	struct control_interrupt irq = {
-		.id		= IRQ_HALT,
-		.flags		= IRQ_FLG_PRIO,
-	};
-
-	send_interrupt_count(&irq, CONTROL_IRQ_SIZE(halt), 3);
-}
-
 static void interpret_jogwheel(int8_t jogwheel, bool wheel_pressed)
 {
 	fixpt_t mult, increment, velocity;
@@ -734,20 +912,21 @@ static void set_feed_override_keepalife_deadline(void)
 	state.next_fo_keepalife = get_jiffies() + msec2jiffies(100);
 }
 
-static void interpret_buttons(void)
+/* Interpret a button state that became valid at the time 'now'. */
+static void interpret_button_state(uint16_t buttons, int8_t jogwheel,
+				   jiffies_t now)
 {
-	uint16_t buttons, old_buttons, rising, falling;
-	int8_t jogwheel;
+	uint16_t old_buttons, rising, falling;
 
 	static uint16_t prev_buttons;
 
+	state.event_time = now;
+
 #define rising_edge(btn)	(!!(rising & (btn)))
 #define falling_edge(btn)	(!!(falling & (btn)))
 #define pressed(btn)		(!!(buttons & (btn)))
 #define released(btn)		(!pressed(btn))
 
-	buttons = get_buttons(&jogwheel);
-
 	/* Twohand button */
 	if (pressed(BTN_TWOHAND)) {
 		extports_set(EXT_LED_TWOHAND);
@@ -762,7 +941,7 @@ static void interpret_buttons(void)
 			buttons = (uint16_t)(buttons & ~(BTN_JOG_POSITIVE |
 							 BTN_JOG_NEGATIVE));
 			if (old_buttons != buttons || jogwheel) {
-				state.twohand_error_delay = get_jiffies() +
+				state.twohand_error_delay = now +
 						msec2jiffies(200);
 				if (!state.twohand_error) {
 					state.twohand_error = 1;
@@ -801,15 +980,14 @@ static void interpret_buttons(void)
 			turn_spindle_off();
 		} else {
 			state.spindle_delayed_on = 1;
-			state.spindle_change_time = get_jiffies() + msec2jiffies(800);
+			state.spindle_change_time = now + msec2jiffies(800);
 		}
 	}
 	if (falling_edge(BTN_SPINDLE))
 		state.spindle_delayed_on = 0;
 
+	/* The HALT request was already sent by spi_async_done(). */
 	update_button_led(pressed(BTN_HALT), EXT_LED_HALT);
-	if (rising_edge(BTN_HALT))
-		halt_motion();
 
 	/* Next axis selection */
 	update_button_led(pressed(BTN_AXIS_NEXT), EXT_LED_AXIS_NEXT);
@@ -893,6 +1071,33 @@ static void interpret_buttons(void)
 #undef released
 }
 
+static void interpret_buttons(void)
+{
+	struct button_event ev;
+	uint16_t buttons, mask;
+	int8_t jogwheel;
+	jiffies_t jogwheel_time;
+
+	static uint16_t event_buttons;
+
+	/* Replay the queued edges at the time they happened,
+	 * so that short presses are not lost. */
+	while (get_button_event(&ev)) {
+		mask = (uint16_t)BIT(ev.id & SPI_EVENT_BUTTON_MASK);
+		if (ev.id & SPI_EVENT_PRESSED)
+			event_buttons |= mask;
+		else
+			event_buttons = (uint16_t)(event_buttons & ~mask);
+		interpret_button_state(event_buttons, 0, ev.time);
+	}
+
+	buttons = get_buttons(&jogwheel, &jogwheel_time);
+	event_buttons = buttons;
+	/* Jog wheel latency is measured from the arrival of the steps. */
+	interpret_button_state(buttons, jogwheel,
+			       jogwheel ? jogwheel_time : get_jiffies());
+}
+
 static void handle_spindle_change_requests(void)
 {
 	if (state.spindle_delayed_on) {
@@ -1041,19 +1246,30 @@ static void systimer_init(void)
 static void handle_debug_ringbuffer(void)
 {
 	struct control_interrupt irq = {
-		.id		= IRQ_LOGMSG,
 		.flags		= IRQ_FLG_DROPPABLE,
 	};
 	uint8_t count;
 
 	while (debug_ringbuf_count() &&
 	       interrupt_queue_freecount() >= INTERRUPT_QUEUE_MAX_LEN / 2) {
-		memset(irq.logmsg.msg, 0, sizeof(irq.logmsg.msg));
-		count = debug_ringbuf_get(irq.logmsg.msg,
-					  sizeof(irq.logmsg.msg));
-		if (!count)
-			break;
-		send_interrupt(&irq, CONTROL_IRQ_SIZE(logmsg));
+		if (devflag_is_set(DEVICE_FLG_USBLOGTOK)) {
+			irq.id = IRQ_LOGTOK;
+			memset(irq.logtok.data, 0, sizeof(irq.logtok.data));
+			count = debug_ringbuf_get_tokens(irq.logtok.data,
+							 sizeof(irq.logtok.data),
+							 &irq.logtok.start);
+			if (!count)
+				break;
+			send_interrupt(&irq, CONTROL_IRQ_SIZE(logtok));
+		} else {
+			irq.id = IRQ_LOGMSG;
+			memset(irq.logmsg.msg, 0, sizeof(irq.logmsg.msg));
+			count = debug_ringbuf_get(irq.logmsg.msg,
+						  sizeof(irq.logmsg.msg));
+			if (!count)
+				break;
+			send_interrupt(&irq, CONTROL_IRQ_SIZE(logmsg));
+		}
 	}
 }
 
@@ -1084,9 +1300,6 @@ void reset_device_state(void)
 int main(void) _mainfunc;
 int main(void)
 {
-	static jiffies_t next_ms_tick;
-	jiffies_t j;
-
 	irq_disable();
 	wdt_enable(WDTO_500MS);
 	debug_init();
@@ -1104,24 +1317,26 @@ int main(void)
 	override_init();
 	pdiusb_init();
 	systimer_init();
+	stats_init();
 
 	reset_device_state();
 
 	irq_enable();
 	while (1) {
-		j = get_jiffies();
-		if (time_after(j, next_ms_tick)) {
-			next_ms_tick = j + msec2jiffies(1);
-			spi_async_ms_tick();
-		}
+		struct loop_stage stage;
 
 		if (!ATOMIC_LOAD(state.estop)) {
 			if (ATOMIC_LOAD(state.button_update_required))
-				trigger_button_state_fetching();
+				trigger_button_state_fetching(0);
+			stats_stage_begin(&stage);
 			interpret_buttons();
+			stats_stage_end(LOOPHIST_STAGE_BUTTONS, &stage);
 			interpret_feed_override(0);
 			handle_spindle_change_requests();
 			handle_jog_keepalife();
+		} else {
+			/* Don't replay edges from the estop period. */
+			flush_button_events();
 		}
 
 		mb();
@@ -1135,15 +1350,27 @@ int main(void)
 			state.leds_need_update = 0;
 			irq_enable();
 
-			if (lcd)
+			if (lcd) {
+				stats_stage_begin(&stage);
 				update_lcd();
-			if (leds)
+				stats_stage_end(LOOPHIST_STAGE_LCD, &stage);
+			}
+			if (leds) {
+				stats_stage_begin(&stage);
 				update_leds();
+				stats_stage_end(LOOPHIST_STAGE_LEDS, &stage);
+			}
 		}
 
-		if (devflag_is_set(DEVICE_FLG_USBLOGMSG))
+		if (devflag_is_set(DEVICE_FLG_USBLOGMSG) &&
+		    !devflag_is_set(DEVICE_FLG_USBSTREAM)) {
+			stats_stage_begin(&stage);
 			handle_debug_ringbuffer();
+			stats_stage_end(LOOPHIST_STAGE_DEBUGRING, &stage);
+		}
 
+		stats_mainloop();
+		stats_wdt_reset();
 		wdt_reset();
 	}
 }
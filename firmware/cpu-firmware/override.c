@@ -24,24 +24,37 @@
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 
+#include <string.h>
 
-#define ADC_HYST		4
-#define ADC_MINMAX_DEADBAND	4
+
+/* Number of samples to accumulate. Must be 16 (10 bit -> 12 bit). */
+#define ADC_OVERSAMPLE		16
+/* IIR lowpass filter strength. 0 disables the filter. */
+#define ADC_IIR_SHIFT		2
+/* Hysteresis and min/max deadband, in 12 bit units. */
+#define ADC_HYST		16
+#define ADC_MINMAX_DEADBAND	16
 #define ADC_REAL_MIN		0
-#define ADC_REAL_MAX		0x3FF
+#define ADC_REAL_MAX		0xFFF
 #define ADC_MIN			(ADC_REAL_MIN + ADC_MINMAX_DEADBAND)
 #define ADC_MAX			(ADC_REAL_MAX - ADC_MINMAX_DEADBAND)
 
 
-static uint16_t last_override_adc;
-static uint8_t last_override_pos;
+static struct {
+	uint16_t sum;		/* Oversampling accumulator */
+	uint8_t count;		/* Number of accumulated samples */
+	uint16_t iir;		/* IIR filter state (value << ADC_IIR_SHIFT) */
+	uint16_t value;		/* Last published 12 bit value */
+	uint8_t pos;		/* Published position. Use ATOMIC_LOAD. */
+} adc;
 
 
 static void adc_trigger(bool freerunning)
 {
 	/* Start ADC0 with AVCC reference and a prescaler of 128. */
 	ADMUX = (1 << REFS0);
-	ADCSRA = (1 << ADEN) | (0 << ADIE) | (1 << ADSC) |
+	ADCSRA = (1 << ADEN) | (freerunning ? (1 << ADIE) : 0) |
+		 (1 << ADSC) |
 		 (freerunning ? (1 << ADATE) : 0) |
 		 (1 << ADPS0) | (1 << ADPS1) | (1 << ADPS2);
 }
@@ -52,44 +65,68 @@ static inline void adc_busywait(void)
 	ADCSRA |= (1 << ADIF); /* Clear IRQ flag */
 }
 
+/* Publish a new filtered 12 bit value. */
+static void adc_publish(uint16_t value)
+{
+	if (value <= ADC_MIN)
+		value = ADC_REAL_MIN;
+	else if (value >= ADC_MAX)
+		value = ADC_REAL_MAX;
+	else if (abs((int16_t)value - (int16_t)adc.value) <= ADC_HYST)
+		return;
+
+	if (value == adc.value)
+		return;
+	adc.value = value;
+
+	ATOMIC_STORE(adc.pos,
+		     (uint8_t)(((uint32_t)value - (uint32_t)ADC_REAL_MIN) * (uint32_t)0xFF /
+			       ((uint32_t)ADC_REAL_MAX - (uint32_t)ADC_REAL_MIN)));
+}
+
+/* Conversion complete. The ADC runs freerunning at ~9.6 kHz. */
+ISR(ADC_vect)
+{
+	uint16_t value;
+
+	adc.sum = (uint16_t)(adc.sum + ADC);
+	if (++adc.count < ADC_OVERSAMPLE)
+		return;
+
+	/* Decimate 16 x 10 bit to 12 bit. */
+	BUILD_BUG_ON(ADC_OVERSAMPLE != 16);
+	value = adc.sum >> 2;
+	adc.sum = 0;
+	adc.count = 0;
+
+	if (ADC_IIR_SHIFT) {
+		adc.iir = (uint16_t)(adc.iir - (adc.iir >> ADC_IIR_SHIFT) + value);
+		value = adc.iir >> ADC_IIR_SHIFT;
+	}
+
+	adc_publish(value);
+}
+
 void override_init(void)
 {
-	last_override_adc = ADC_REAL_MIN;
-	last_override_pos = 0;
+	uint16_t value;
+
+	memset(&adc, 0, sizeof(adc));
 	/* Discard the first measurement */
 	adc_trigger(0);
 	adc_busywait();
+	/* Seed the filter with the current position */
+	adc_trigger(0);
+	adc_busywait();
+	value = (uint16_t)(ADC << 2);
+	adc.iir = (uint16_t)(value << ADC_IIR_SHIFT);
+	adc.value = ADC_REAL_MAX + 1; /* Force publish */
+	adc_publish(value);
 	/* Start the ADC in freerunning mode. */
 	adc_trigger(1);
 }
 
 uint8_t override_get_pos(void)
 {
-	uint16_t adc;
-	uint8_t pos;
-
-	if (!(ADCSRA & (1 << ADIF))) {
-		/* There was no new conversion */
-		return last_override_pos;
-	}
-	adc = ADC;
-	ADCSRA |= (1 << ADIF); /* Clear IRQ flag */
-
-	if (adc <= ADC_MIN)
-		adc = ADC_REAL_MIN;
-	else if (adc >= ADC_MAX)
-		adc = ADC_REAL_MAX;
-	else if (abs((int16_t)adc - (int16_t)last_override_adc) <= ADC_HYST)
-		adc = last_override_adc;
-
-	if (adc == last_override_adc)
-		return last_override_pos;
-
-	pos = (uint8_t)(((uint32_t)adc - (uint32_t)ADC_REAL_MIN) * (uint32_t)0xFF /
-			((uint32_t)ADC_REAL_MAX - (uint32_t)ADC_REAL_MIN));
-
-	last_override_adc = adc;
-	last_override_pos = pos;
-
-	return pos;
+	return ATOMIC_LOAD(adc.pos);
 }
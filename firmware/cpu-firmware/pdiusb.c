@@ -17,6 +17,7 @@
 #include "util.h"
 #include "main.h"
 #include "usb.h"
+#include "stats.h"
 
 #include <avr/io.h>
 #include <avr/interrupt.h>
@@ -151,6 +152,10 @@ typedef uint16_t trans_stat_t;
 static uint8_t pdiusb_buffer[PDIUSB_MAXSIZE];
 /* Suspend status */
 static uint8_t pdiusb_suspended;
+#if USB_WITH_EP2
+/* EP2 OUT frames might still be waiting in the PDIUSB buffers. */
+static bool pdiusb_ep2out_pending;
+#endif
 
 
 static inline void pdiusb_command_mode(void)
@@ -163,22 +168,22 @@ static inline void pdiusb_data_mode(void)
 	PDIUSB_CTL_PORT = (uint8_t)(PDIUSB_CTL_PORT & ~PDIUSB_CTL_A0);
 }
 
-/* Write data to the controller. */
-static void pdiusb_write(uint8_t data)
+/* Strobe one byte out to the controller.
+ * The bus must already be in output direction. */
+static inline void pdiusb_write_strobe(uint8_t data)
 {
-	raw_data_out_prepare();
 	PDIUSB_CTL_PORT = (uint8_t)(PDIUSB_CTL_PORT & ~PDIUSB_CTL_WR);
 	raw_data_out(data);
 	PDIUSB_CTL_PORT = (uint8_t)(PDIUSB_CTL_PORT | PDIUSB_CTL_WR);
 	raw_data_delay();
 }
 
-/* Read data from the controller. */
-static uint8_t pdiusb_read(void)
+/* Strobe one byte in from the controller.
+ * The bus must already be in input direction. */
+static inline uint8_t pdiusb_read_strobe(void)
 {
 	uint8_t data;
 
-	raw_data_in_prepare();
 	PDIUSB_CTL_PORT = (uint8_t)(PDIUSB_CTL_PORT & ~PDIUSB_CTL_RD);
 	raw_data_delay();
 	data = raw_data_in();
@@ -187,6 +192,57 @@ static uint8_t pdiusb_read(void)
 	return data;
 }
 
+/* Write data to the controller. */
+static void pdiusb_write(uint8_t data)
+{
+	raw_data_out_prepare();
+	pdiusb_write_strobe(data);
+}
+
+/* Read data from the controller. */
+static uint8_t pdiusb_read(void)
+{
+	raw_data_in_prepare();
+	return pdiusb_read_strobe();
+}
+
+/* Burst transfers for the buffer payload.
+ * The bus direction is set up by the caller once per packet.
+ * Per byte this is cbi + 2x nop + in/out + sbi + ld/st, which is
+ * 9 cycles (562 ns at 16 MHz) in the unrolled part. That still satisfies
+ * the 500 ns minimum RD/WR cycle time of the PDIUSBD12.
+ * The cycles are counted by hand. Check the generated code with
+ * avr-objdump after compiler updates. */
+#define PDIUSB_BURST_UNROLL	4
+
+static void pdiusb_read_burst(uint8_t *buf, uint8_t count)
+{
+	while (count >= PDIUSB_BURST_UNROLL) {
+		buf[0] = pdiusb_read_strobe();
+		buf[1] = pdiusb_read_strobe();
+		buf[2] = pdiusb_read_strobe();
+		buf[3] = pdiusb_read_strobe();
+		buf += PDIUSB_BURST_UNROLL;
+		count = (uint8_t)(count - PDIUSB_BURST_UNROLL);
+	}
+	while (count--)
+		*buf++ = pdiusb_read_strobe();
+}
+
+static void pdiusb_write_burst(const uint8_t *buf, uint8_t count)
+{
+	while (count >= PDIUSB_BURST_UNROLL) {
+		pdiusb_write_strobe(buf[0]);
+		pdiusb_write_strobe(buf[1]);
+		pdiusb_write_strobe(buf[2]);
+		pdiusb_write_strobe(buf[3]);
+		buf += PDIUSB_BURST_UNROLL;
+		count = (uint8_t)(count - PDIUSB_BURST_UNROLL);
+	}
+	while (count--)
+		pdiusb_write_strobe(*buf++);
+}
+
 /* Send a command to the controller. */
 static void pdiusb_command(uint8_t command)
 {
@@ -235,17 +291,17 @@ static uint16_t pdiusb_command_r16(uint8_t command)
 
 static uint8_t pdiusb_read_buffer(uint8_t *buf, uint8_t max_size)
 {
-	uint8_t i, data_size;
+	uint8_t data_size;
 
 	pdiusb_command(PDIUSB_CMD_RWBUF);
-	pdiusb_read(); /* Read the reserved byte */
-	data_size = pdiusb_read();
+	raw_data_in_prepare();
+	pdiusb_read_strobe(); /* Read the reserved byte */
+	data_size = pdiusb_read_strobe();
 	if (data_size > max_size) {
 		usb_print1num("PDIUSB: RX buffer overrun", data_size);
 		return 0;
 	}
-	for (i = 0; i < data_size; i++)
-		buf[i] = pdiusb_read();
+	pdiusb_read_burst(buf, data_size);
 
 	DBG(usb_print1num("PDIUSB: Received", data_size));
 	DBG(usb_dumpmem(buf, data_size));
@@ -255,16 +311,14 @@ static uint8_t pdiusb_read_buffer(uint8_t *buf, uint8_t max_size)
 
 static void pdiusb_write_buffer(const uint8_t *buf, uint8_t size)
 {
-	uint8_t i;
-
 	DBG(usb_print1num("PDIUSB: Sending", size));
 	DBG(usb_dumpmem(buf, size));
 
 	pdiusb_command(PDIUSB_CMD_RWBUF);
-	pdiusb_write(0); /* Write the reserved byte */
-	pdiusb_write(size);
-	for (i = 0; i < size; i++)
-		pdiusb_write(buf[i]);
+	raw_data_out_prepare();
+	pdiusb_write_strobe(0); /* Write the reserved byte */
+	pdiusb_write_strobe(size);
+	pdiusb_write_burst(buf, size);
 }
 
 static void stall_ep(uint8_t ep_index)
@@ -377,13 +431,48 @@ static void handle_ep1out_data(uint8_t trans_status, uint8_t size)
 #endif
 
 #if USB_WITH_EP2
-static void handle_ep2out_data(uint8_t trans_status, uint8_t size)
+/* Move the received EP2 OUT frames from the double buffered PDIUSB
+ * main endpoint into the USB stack RX ring.
+ * If the ring is full, the frames stay in the PDIUSB. It NAKs the
+ * host until we come back here after the ring was consumed. */
+static void handle_ep2out_data(void)
+{
+	uint8_t *buf, size, status, res;
+
+	while (1) {
+		buf = usb_ep2_rx_slot();
+		if (!buf) {
+			pdiusb_ep2out_pending = 1;
+			return;
+		}
+		status = pdiusb_command_r8(PDIUSB_CMD_SELEP(PDIUSB_EP_EP2OUT));
+		if (!(status & PDIUSB_SELEPR_FULL))
+			break;
+		size = pdiusb_read_buffer(buf, USBCFG_EP2_MAXSIZE);
+		pdiusb_command(PDIUSB_CMD_CLRBUF);
+
+		res = usb_ep2_rx_commit(size);
+		if (res == USB_RX_ERROR)
+			stall_ep(PDIUSB_EP_EP2OUT);
+	}
+	pdiusb_ep2out_pending = 0;
+}
+
+static void handle_irq_ep2out(void)
 {
-	uint8_t res;
+	uint8_t status;
 
-	res = usb_ep2_rx(pdiusb_buffer, size);
-	if (res == USB_RX_ERROR)
-		stall_ep(PDIUSB_EP_EP2OUT);
+	DBG(usb_printstr("PDIUSB: OUT irq on EP2"));
+
+	status = pdiusb_command_r8(PDIUSB_CMD_TRSTAT(PDIUSB_EP_EP2OUT));
+	if (!(status & PDIUSB_TRSTAT_TRANSOK)) {
+		if (status != PDIUSB_TRERR_NOERR) {
+			usb_print1num("PDIUSB: OUT trans on EP2 failed with",
+				      status & PDIUSB_TRSTAT_ERR);
+			return;
+		}
+	}
+	handle_ep2out_data();
 }
 #endif
 
@@ -391,6 +480,9 @@ static void handle_irq_busrst(void)
 {
 	usb_printstr("PDIUSB: Bus reset detected");
 	pdiusb_suspended = 0;
+#if USB_WITH_EP2
+	pdiusb_ep2out_pending = 0;
+#endif
 	usb_reset();
 }
 
@@ -418,6 +510,7 @@ ISR(PDIUSB_IRQ_VECTOR)
 	bool ok;
 	void *buf;
 	uint8_t size;
+	perf_time_t start = perf_timer_get();
 
 	status = pdiusb_command_r16(PDIUSB_CMD_IRQSTAT);
 
@@ -465,12 +558,10 @@ ISR(PDIUSB_IRQ_VECTOR)
 	}
 
 	if (status & PDIUSB_IST_EP(PDIUSB_EP_EP2OUT)) {
-		trans = handle_irq_ep_out(PDIUSB_EP_EP2OUT);
 #if USB_WITH_EP2
-		if (GET_TRANS_STAT(trans) & PDIUSB_TRSTAT_TRANSOK) {
-			handle_ep2out_data(GET_TRANS_STAT(trans),
-					   GET_TRANS_SIZE(trans));
-		}
+		handle_irq_ep2out();
+#else
+		handle_irq_ep_out(PDIUSB_EP_EP2OUT);
 #endif
 	}
 	if (status & PDIUSB_IST_EP(PDIUSB_EP_EP2IN)) {
@@ -481,8 +572,13 @@ ISR(PDIUSB_IRQ_VECTOR)
 			if (size != USB_TX_POLL_NONE)
 				ep_queue_data(PDIUSB_EP_EP2IN, buf, size);
 		}
+		/* The poll might have freed RX ring space. */
+		if (pdiusb_ep2out_pending)
+			handle_ep2out_data();
 #endif
 	}
+
+	stats_usb_irq(start);
 }
 
 #if MCU_USES_CLKOUT
@@ -582,6 +678,11 @@ uint8_t pdiusb_configure_clkout(void)
 	return 0;
 }
 
+uint16_t pdiusb_ramsize(void)
+{
+	return sizeof(pdiusb_buffer);
+}
+
 uint8_t pdiusb_init(void)
 {
 	uint16_t chipid;
@@ -119,4 +119,7 @@ uint8_t pdiusb_configure_clkout(void);
 uint8_t pdiusb_init(void);
 void pdiusb_exit(void);
 
+/** pdiusb_ramsize - SRAM size of the receive buffer, in bytes. */
+uint16_t pdiusb_ramsize(void);
+
 #endif /* PDIUSB_H_ */
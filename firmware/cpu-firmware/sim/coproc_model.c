@@ -0,0 +1,438 @@
+/*
+ *   CNC-remote-control
+ *   Firmware simulator: Button coprocessor model
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include "coproc_model.h"
+#include "coproc-firmware/spi_interface.h"
+
+
+/* The coprocessor runs the timestamp clock at SPI_TIMESTAMP_HZ. */
+#define COPROC_JIFFY_NSEC	(1000000000ull / SPI_TIMESTAMP_HZ)
+#define COPROC_NR_BUTTONS	14
+#define COPROC_FIFO_SIZE	8
+
+#define msec2cjiffies(ms)	((uint16_t)((uint32_t)(ms) * SPI_TIMESTAMP_HZ / 1000ul))
+#define usec2cjiffies(us)	((uint16_t)((uint32_t)(us) * SPI_TIMESTAMP_HZ / 1000000ul))
+
+#define BUTTON_DEBOUNCE		msec2cjiffies(40)
+#define HALT_PRESS_DEBOUNCE	msec2cjiffies(2)
+#define ENC_DEBOUNCE		usec2cjiffies(3500)
+
+#define ctime_after(a, b)	((int16_t)((uint16_t)(b) - (uint16_t)(a)) < 0)
+
+/* AtMega8 flash. The bootloader section starts at COPROC_BOOT_OFFSET. */
+#define COPROC_FLASH_SIZE	0x2000u
+#define COPROC_BOOT_OFFSET	0x1800u
+#define COPROC_SPM_PAGESIZE	64u
+
+/* Bootloader busy times */
+#define COPROC_PAGECRC_NSEC	200000ull	/* Page CRC calculation */
+#define COPROC_BLOCKCRC_NSEC	250000ull	/* Block data CRC calculation */
+#define COPROC_FLASH_NSEC	9000000ull	/* Page erase, write and verify */
+
+
+/* Mirrors the SPI sequences of the coprocessor bootloader */
+enum coproc_boot_state {
+	BOOT_CMD,		/* Wait for a command */
+	BOOT_ADDR_LO,
+	BOOT_ADDR_HI,
+	BOOT_DATA,		/* Page data */
+	BOOT_CRC,		/* Page data CRC */
+	BOOT_CRC_RESULT,	/* Checksum result is shifted out */
+	BOOT_FLASH_RESULT,	/* Flash result is shifted out */
+	BOOT_PAGECRC_HI,	/* Page CRC low byte is shifted out */
+	BOOT_PAGECRC_SUM,	/* Page CRC high byte is shifted out */
+	BOOT_PAGECRC_END,	/* Page CRC checksum is shifted out */
+};
+
+
+struct coproc_button {
+	bool state;
+	bool synchronized;
+	uint16_t sync_deadline;
+	uint16_t edge_time;
+};
+
+static struct {
+	bool app_running;
+	uint16_t pressed;		/* Host input. Bit n = button n */
+	struct coproc_button buttons[COPROC_NR_BUTTONS];
+	uint16_t swstates;
+
+	int enc_steps;			/* Host input, not yet sampled */
+	uint16_t enc_deadline;
+	int8_t enc_state;
+	int8_t enc_sent;		/* Sent, but not acknowledged, yet */
+
+	struct {
+		uint8_t id;
+		uint16_t time;
+	} fifo[COPROC_FIFO_SIZE];
+	uint8_t fifo_in;
+	uint8_t fifo_out;
+	uint8_t fifo_sent;		/* Sent, but not acknowledged, yet */
+	bool fifo_drained;		/* Empty during this fetch */
+
+	uint8_t reply;			/* Reply for the next transfer */
+	uint8_t checksum;
+	uint8_t event_byte;
+	bool event_fetch;
+	uint8_t event_id;
+	uint16_t event_time;
+	uint16_t time_latch;
+
+	/* Bootloader */
+	uint8_t boot_state;		/* enum coproc_boot_state */
+	uint8_t boot_cmd;
+	uint8_t boot_count;
+	uint8_t boot_crc;
+	bool boot_crc_ok;
+	uint16_t boot_address;
+	uint16_t boot_pagecrc;
+	uint8_t boot_page[COPROC_SPM_PAGESIZE];
+	uint64_t busy_until;		/* Busy line is high until then */
+	uint8_t flash[COPROC_FLASH_SIZE];
+} coproc;
+
+
+static uint16_t coproc_jiffies(uint64_t now)
+{
+	return (uint16_t)(now / COPROC_JIFFY_NSEC);
+}
+
+static void coproc_fifo_put(uint8_t id, uint16_t time)
+{
+	uint8_t index;
+
+	if ((uint8_t)(coproc.fifo_in - coproc.fifo_out) >= COPROC_FIFO_SIZE)
+		return;
+	index = coproc.fifo_in & (COPROC_FIFO_SIZE - 1);
+	coproc.fifo[index].id = id;
+	coproc.fifo[index].time = time;
+	coproc.fifo_in++;
+}
+
+static void coproc_fifo_peek(uint8_t *id, uint16_t *time)
+{
+	uint8_t pos = (uint8_t)(coproc.fifo_out + coproc.fifo_sent);
+	uint8_t index;
+
+	if (coproc.fifo_drained || coproc.fifo_in == pos) {
+		coproc.fifo_drained = 1;
+		*id = SPI_EVENT_NONE;
+		*time = 0;
+		return;
+	}
+	index = pos & (COPROC_FIFO_SIZE - 1);
+	*id = coproc.fifo[index].id;
+	*time = coproc.fifo[index].time;
+	coproc.fifo_sent++;
+}
+
+static void coproc_data_ack(void)
+{
+	coproc.fifo_out = (uint8_t)(coproc.fifo_out + coproc.fifo_sent);
+	coproc.fifo_sent = 0;
+	coproc.enc_state = (int8_t)(coproc.enc_state - coproc.enc_sent);
+	coproc.enc_sent = 0;
+}
+
+uint8_t coproc_model_sample(uint64_t _now)
+{
+	struct coproc_button *b;
+	uint16_t now = coproc_jiffies(_now);
+	bool state, changed = 0;
+	uint8_t i;
+
+	if (!coproc.app_running)
+		return 0;
+
+	for (i = 0; i < COPROC_NR_BUTTONS; i++) {
+		b = &coproc.buttons[i];
+		state = !!(coproc.pressed & (1u << i));
+		if (state != b->state) {
+			if (b->synchronized)
+				b->edge_time = now;
+			b->state = state;
+			b->synchronized = 0;
+			b->sync_deadline = (uint16_t)(now +
+				((state && i == 0) ? HALT_PRESS_DEBOUNCE
+						   : BUTTON_DEBOUNCE));
+		}
+		if (!b->synchronized && ctime_after(now, b->sync_deadline)) {
+			b->synchronized = 1;
+			if (b->state == !!(coproc.swstates & (1u << i)))
+				continue;
+			coproc.swstates ^= (uint16_t)(1u << i);
+			coproc_fifo_put((uint8_t)(i | (b->state ? SPI_EVENT_PRESSED : 0u)),
+					b->edge_time);
+			changed = 1;
+		}
+	}
+
+	if (!coproc.enc_steps) {
+		/* Keep the deadline within the 16 bit clock range. */
+		coproc.enc_deadline = now;
+	} else if (ctime_after(now, coproc.enc_deadline)) {
+		if (coproc.enc_steps > 0) {
+			coproc.enc_steps--;
+			coproc.enc_state++;
+		} else {
+			coproc.enc_steps++;
+			coproc.enc_state--;
+		}
+		coproc.enc_deadline = (uint16_t)(now + ENC_DEBOUNCE);
+		changed = 1;
+	}
+
+	return changed;
+}
+
+static uint16_t coproc_boot_pagecrc(uint16_t address)
+{
+	uint16_t crc = 0xFFFF;
+	uint8_t i;
+
+	for (i = 0; i < COPROC_SPM_PAGESIZE; i++)
+		crc = spi_page_crc(crc, coproc.flash[address + i]);
+
+	return crc;
+}
+
+static uint8_t coproc_boot_write(uint16_t address)
+{
+	if (address >= COPROC_BOOT_OFFSET)
+		return SPI_RESULT_FAIL;
+	memcpy(&coproc.flash[address], coproc.boot_page, COPROC_SPM_PAGESIZE);
+
+	return SPI_RESULT_OK;
+}
+
+/* Mirrors handle_spi() of the coprocessor bootloader.
+ * It answers in the next transfer, like the application. */
+static uint8_t coproc_boot_exchange(uint8_t rx, uint64_t now)
+{
+	uint8_t data = 0;
+
+	switch (coproc.boot_state) {
+	case BOOT_CMD:
+	default:
+		switch (rx) {
+		case SPI_CONTROL_ENTERBOOT:
+		case SPI_CONTROL_ENTERBOOT2:
+			data = SPI_RESULT_OK;
+			break;
+		case SPI_CONTROL_TESTAPP:
+			data = SPI_RESULT_FAIL;
+			break;
+		case SPI_CONTROL_ENTERAPP:
+			coproc.app_running = 1;
+			break;
+		case SPI_CONTROL_STARTFLASH:
+		case SPI_CONTROL_FLASHBLOCK:
+		case SPI_CONTROL_PAGECRC:
+			coproc.boot_cmd = rx;
+			coproc.boot_state = BOOT_ADDR_LO;
+			break;
+		case SPI_CONTROL_BOOTCAPS:
+			data = SPI_BOOTCAP_PAGECRC | SPI_BOOTCAP_FLASHBLOCK;
+			break;
+		}
+		break;
+	case BOOT_ADDR_LO:
+		coproc.boot_address = rx;
+		coproc.boot_crc = spi_crc8(0, rx);
+		coproc.boot_state = BOOT_ADDR_HI;
+		break;
+	case BOOT_ADDR_HI:
+		coproc.boot_address |= (uint16_t)(rx << 8);
+		coproc.boot_address &= (uint16_t)(COPROC_FLASH_SIZE - 1u);
+		coproc.boot_crc = spi_crc8(coproc.boot_crc, rx);
+		if (coproc.boot_cmd == SPI_CONTROL_PAGECRC) {
+			coproc.boot_address &= (uint16_t)~(COPROC_SPM_PAGESIZE - 1u);
+			coproc.boot_pagecrc = coproc_boot_pagecrc(coproc.boot_address);
+			coproc.busy_until = now + COPROC_PAGECRC_NSEC;
+			data = (uint8_t)(coproc.boot_pagecrc & 0xFFu);
+			coproc.boot_state = BOOT_PAGECRC_HI;
+		} else {
+			coproc.boot_count = 0;
+			coproc.boot_state = BOOT_DATA;
+		}
+		break;
+	case BOOT_DATA:
+		coproc.boot_page[coproc.boot_count++] = rx;
+		coproc.boot_crc = spi_crc8(coproc.boot_crc, rx);
+		if (coproc.boot_count >= COPROC_SPM_PAGESIZE) {
+			/* The block data CRC is calculated afterwards. */
+			if (coproc.boot_cmd == SPI_CONTROL_FLASHBLOCK)
+				coproc.busy_until = now + COPROC_BLOCKCRC_NSEC;
+			coproc.boot_state = BOOT_CRC;
+		}
+		break;
+	case BOOT_CRC:
+		coproc.boot_crc ^= 0xFF;
+		coproc.boot_crc_ok = (rx == coproc.boot_crc);
+		data = coproc.boot_crc_ok ? SPI_RESULT_OK : SPI_RESULT_FAIL;
+		coproc.boot_state = BOOT_CRC_RESULT;
+		break;
+	case BOOT_CRC_RESULT:
+		if (coproc.boot_crc_ok) {
+			data = coproc_boot_write(coproc.boot_address &
+				(uint16_t)~(COPROC_SPM_PAGESIZE - 1u));
+			coproc.busy_until = now + COPROC_FLASH_NSEC;
+			coproc.boot_state = BOOT_FLASH_RESULT;
+		} else
+			coproc.boot_state = BOOT_CMD;
+		break;
+	case BOOT_PAGECRC_HI:
+		data = (uint8_t)(coproc.boot_pagecrc >> 8);
+		coproc.boot_state = BOOT_PAGECRC_SUM;
+		break;
+	case BOOT_PAGECRC_SUM:
+		data = spi_crc8(spi_crc8(0, (uint8_t)(coproc.boot_pagecrc & 0xFFu)),
+				(uint8_t)(coproc.boot_pagecrc >> 8)) ^ 0xFF;
+		coproc.boot_state = BOOT_PAGECRC_END;
+		break;
+	case BOOT_FLASH_RESULT:
+	case BOOT_PAGECRC_END:
+		coproc.boot_state = BOOT_CMD;
+		break;
+	}
+
+	return data;
+}
+
+/* Mirrors the coprocessor SPI_STC ISR.
+ * The reply to a command is shifted out in the next transfer. */
+uint8_t coproc_model_exchange(uint8_t cmd, uint64_t now)
+{
+	uint8_t rx = coproc.reply;
+	uint8_t data;
+
+	if (!coproc.app_running) {
+		/* A busy bootloader does not take part in the transfer. */
+		if (now < coproc.busy_until)
+			return cmd;
+		coproc.reply = coproc_boot_exchange(cmd, now);
+		return rx;
+	}
+
+	if (cmd != SPI_CONTROL_GETEVENT) {
+		coproc.event_byte = 0;
+		coproc.event_fetch = 0;
+	}
+
+	switch (cmd) {
+	case SPI_CONTROL_GETLOW:
+		data = (uint8_t)(coproc.swstates & 0xFFu);
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETHIGH:
+		data = (uint8_t)(coproc.swstates >> 8);
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETENC:
+		data = (uint8_t)coproc.enc_state;
+		coproc.enc_sent = coproc.enc_state;
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETEVENT:
+		if (!coproc.event_fetch) {
+			coproc.fifo_sent = 0;
+			coproc.fifo_drained = 0;
+			coproc.event_fetch = 1;
+		}
+		switch (coproc.event_byte) {
+		case 0:
+		default:
+			coproc_fifo_peek(&coproc.event_id, &coproc.event_time);
+			data = coproc.event_id;
+			coproc.event_byte = 1;
+			break;
+		case 1:
+			data = (uint8_t)(coproc.event_time & 0xFFu);
+			coproc.event_byte = 2;
+			break;
+		case 2:
+			data = (uint8_t)(coproc.event_time >> 8);
+			coproc.event_byte = 0;
+			break;
+		}
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETTIMELO:
+		coproc.time_latch = coproc_jiffies(now);
+		data = (uint8_t)(coproc.time_latch & 0xFFu);
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETTIMEHI:
+		data = (uint8_t)(coproc.time_latch >> 8);
+		coproc.checksum ^= data;
+		break;
+	case SPI_CONTROL_GETSUM:
+		data = coproc.checksum ^ 0xFF;
+		coproc.checksum = 0;
+		break;
+	case SPI_CONTROL_TESTAPP:
+		data = coproc.app_running ? SPI_RESULT_OK : 0;
+		coproc.checksum = 0;
+		break;
+	case SPI_CONTROL_ACKEVENTS:
+		coproc_data_ack();
+		data = 0;
+		coproc.checksum = 0;
+		break;
+	case SPI_CONTROL_ENTERBOOT2:
+		coproc.app_running = 0;
+		data = 0;
+		coproc.checksum = 0;
+		break;
+	case SPI_CONTROL_ENTERAPP:
+		coproc.app_running = 1;
+		/* fall through */
+	case SPI_CONTROL_NOP:
+	default:
+		data = 0;
+		coproc.checksum = 0;
+	}
+	coproc.reply = data;
+
+	return rx;
+}
+
+void coproc_model_set_buttons(uint16_t pressed)
+{
+	coproc.pressed = pressed;
+}
+
+void coproc_model_encoder(int steps)
+{
+	coproc.enc_steps += steps;
+}
+
+bool coproc_model_busy(uint64_t now)
+{
+	return coproc.app_running || now < coproc.busy_until;
+}
+
+void coproc_model_reset(void)
+{
+	memset(&coproc, 0, sizeof(coproc));
+	memset(coproc.flash, 0xFF, sizeof(coproc.flash));
+}
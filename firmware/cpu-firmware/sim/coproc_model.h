@@ -0,0 +1,37 @@
+#ifndef SIM_COPROC_MODEL_H_
+#define SIM_COPROC_MODEL_H_
+
+/* Button coprocessor model. This mirrors coproc-firmware/main.c
+ * and the SPI protocol of coproc-firmware/bootloader.c.
+ * Times are in nsec. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+
+/* The coprocessor samples the inputs at 5 kHz. */
+#define COPROC_MODEL_SAMPLE_NSEC	200000ull
+
+void coproc_model_reset(void);
+
+/** coproc_model_sample - Run the input sampler.
+ * Returns 1, if the coprocessor asserts its transfer IRQ line. */
+uint8_t coproc_model_sample(uint64_t now);
+
+/** coproc_model_exchange - One byte on the SPI wire.
+ * Returns the byte the coprocessor shifts out. */
+uint8_t coproc_model_exchange(uint8_t cmd, uint64_t now);
+
+/** coproc_model_busy - The state of the busy line of the bootloader.
+ * The application does not drive it and it reads high. */
+bool coproc_model_busy(uint64_t now);
+
+/** coproc_model_set_buttons - Set the physical button states.
+ * Bit n is the coprocessor button n. 1 = pressed. */
+void coproc_model_set_buttons(uint16_t pressed);
+
+/** coproc_model_encoder - Turn the jog wheel by @steps encoder states.
+ * One wheel detent is two states. */
+void coproc_model_encoder(int steps);
+
+#endif /* SIM_COPROC_MODEL_H_ */
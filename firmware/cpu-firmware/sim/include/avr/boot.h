@@ -0,0 +1,35 @@
+#ifndef SIM_AVR_BOOT_H_
+#define SIM_AVR_BOOT_H_
+
+/* Simulator replacement for <avr/boot.h>.
+ * The flash is a host array. Erase and write take the datasheet
+ * time. The CPU keeps running, like SPM from the NRWW section to the
+ * RWW section does. boot_spm_busy() is set meanwhile. */
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+
+
+enum sim_spm_op {
+	SIM_SPM_ERASE,
+	SIM_SPM_FILL,
+	SIM_SPM_WRITE,
+	SIM_SPM_RWWENABLE,
+};
+
+void sim_spm(enum sim_spm_op op, uint16_t address, uint16_t data);
+/** sim_spm_busy - Erase or write in progress. */
+bool sim_spm_busy(void);
+/** sim_flash_read - Read a byte from the simulated flash. */
+uint8_t sim_flash_read(uint16_t address);
+
+#define boot_page_erase(address)	sim_spm(SIM_SPM_ERASE, (uint16_t)(address), 0)
+#define boot_page_fill(address, data)	sim_spm(SIM_SPM_FILL, (uint16_t)(address), (data))
+#define boot_page_write(address)	sim_spm(SIM_SPM_WRITE, (uint16_t)(address), 0)
+#define boot_rww_enable()		sim_spm(SIM_SPM_RWWENABLE, 0, 0)
+#define boot_spm_busy()			sim_spm_busy()
+#define boot_spm_busy_wait()		do { } while (boot_spm_busy())
+
+#endif /* SIM_AVR_BOOT_H_ */
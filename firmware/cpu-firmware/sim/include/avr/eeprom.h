@@ -0,0 +1,21 @@
+#ifndef SIM_AVR_EEPROM_H_
+#define SIM_AVR_EEPROM_H_
+
+/* Simulator replacement for <avr/eeprom.h>. */
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+#define EEMEM
+
+uint8_t eeprom_read_byte(const uint8_t *addr);
+void eeprom_write_byte(uint8_t *addr, uint8_t value);
+void eeprom_update_byte(uint8_t *addr, uint8_t value);
+void eeprom_read_block(void *dst, const void *src, size_t size);
+void eeprom_update_block(const void *src, void *dst, size_t size);
+void eeprom_write_block(const void *src, void *dst, size_t size);
+
+#define eeprom_busy_wait()	do { } while (0)
+
+#endif /* SIM_AVR_EEPROM_H_ */
@@ -0,0 +1,24 @@
+#ifndef SIM_AVR_INTERRUPT_H_
+#define SIM_AVR_INTERRUPT_H_
+
+/* Simulator replacement for <avr/interrupt.h>.
+ * Interrupt handlers are plain functions called by the simulator core. */
+
+#include <avr/io.h>
+
+
+#define ISR(vector, ...)	void vector(void); void vector(void)
+#define EMPTY_INTERRUPT(vector)	ISR(vector) { }
+
+#define INT0_vect		sim_vect_int0
+#define INT1_vect		sim_vect_int1
+#define TIMER0_OVF_vect		sim_vect_timer0_ovf
+#define TIMER1_COMPB_vect	sim_vect_timer1_compb
+#define SPI_STC_vect		sim_vect_spi_stc
+#define ADC_vect		sim_vect_adc
+#define USART_UDRE_vect		sim_vect_usart_udre
+
+void cli(void);
+void sei(void);
+
+#endif /* SIM_AVR_INTERRUPT_H_ */
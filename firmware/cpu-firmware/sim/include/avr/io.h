@@ -0,0 +1,239 @@
+#ifndef SIM_AVR_IO_H_
+#define SIM_AVR_IO_H_
+
+/* Simulator replacement for <avr/io.h> (ATmega32).
+ * Every register access goes through sim_io8() or sim_io16().
+ * These advance the virtual clock, run the peripheral models
+ * and dispatch pending interrupts. */
+
+#include <stdint.h>
+
+
+#define SIM_IO8_REGS(X)						\
+	X(PORTA) X(PORTB) X(PORTC) X(PORTD)			\
+	X(DDRA) X(DDRB) X(DDRC) X(DDRD)				\
+	X(PINA) X(PINB) X(PINC) X(PIND)				\
+	X(SREG) X(SPL) X(SPH) X(MCUCR) X(MCUCSR)		\
+	X(GICR) X(GIFR) X(TIMSK) X(TIFR)			\
+	X(TCCR0) X(TCNT0) X(OCR0)				\
+	X(TCCR1A) X(TCCR1B)					\
+	X(TCCR2) X(TCNT2) X(OCR2) X(ASSR)			\
+	X(SPCR) X(SPSR) X(SPDR)					\
+	X(ADMUX) X(ADCSRA) X(ADCL) X(ADCH) X(SFIOR) X(ACSR)	\
+	X(UCSRA) X(UCSRB) X(UCSRC) X(UBRRL) X(UBRRH) X(UDR)	\
+	X(SPMCR) X(WDTCR) X(EECR) X(TWCR)
+
+#define SIM_IO16_REGS(X)					\
+	X(TCNT1) X(OCR1A) X(OCR1B) X(ICR1) X(ADC) X(SP)
+
+#define __SIM_REG_ENUM(name)	SIM_REG_##name,
+enum sim_io8_reg {
+	SIM_IO8_REGS(__SIM_REG_ENUM)
+	NR_SIM_IO8_REGS
+};
+enum sim_io16_reg {
+	SIM_IO16_REGS(__SIM_REG_ENUM)
+	NR_SIM_IO16_REGS
+};
+
+volatile uint8_t * sim_io8(enum sim_io8_reg reg);
+volatile uint16_t * sim_io16(enum sim_io16_reg reg);
+
+/* Firmware hooks for code that cannot run natively. */
+/** sim_halt - Spin with IRQs off until the watchdog fires. */
+void sim_halt(void) __attribute__((__noreturn__));
+/** sim_enter_bootloader - Jump from the application to the bootloader. */
+void sim_enter_bootloader(void) __attribute__((__noreturn__));
+/** sim_exit_bootloader - Jump from the bootloader to the application. */
+void sim_exit_bootloader(void) __attribute__((__noreturn__));
+
+
+#define PORTA		(*sim_io8(SIM_REG_PORTA))
+#define PORTB		(*sim_io8(SIM_REG_PORTB))
+#define PORTC		(*sim_io8(SIM_REG_PORTC))
+#define PORTD		(*sim_io8(SIM_REG_PORTD))
+#define DDRA		(*sim_io8(SIM_REG_DDRA))
+#define DDRB		(*sim_io8(SIM_REG_DDRB))
+#define DDRC		(*sim_io8(SIM_REG_DDRC))
+#define DDRD		(*sim_io8(SIM_REG_DDRD))
+#define PINA		(*sim_io8(SIM_REG_PINA))
+#define PINB		(*sim_io8(SIM_REG_PINB))
+#define PINC		(*sim_io8(SIM_REG_PINC))
+#define PIND		(*sim_io8(SIM_REG_PIND))
+#define SREG		(*sim_io8(SIM_REG_SREG))
+#define SPL		(*sim_io8(SIM_REG_SPL))
+#define SPH		(*sim_io8(SIM_REG_SPH))
+#define MCUCR		(*sim_io8(SIM_REG_MCUCR))
+#define MCUCSR		(*sim_io8(SIM_REG_MCUCSR))
+#define GICR		(*sim_io8(SIM_REG_GICR))
+#define GIFR		(*sim_io8(SIM_REG_GIFR))
+#define TIMSK		(*sim_io8(SIM_REG_TIMSK))
+#define TIFR		(*sim_io8(SIM_REG_TIFR))
+#define TCCR0		(*sim_io8(SIM_REG_TCCR0))
+#define TCNT0		(*sim_io8(SIM_REG_TCNT0))
+#define OCR0		(*sim_io8(SIM_REG_OCR0))
+#define TCCR1A		(*sim_io8(SIM_REG_TCCR1A))
+#define TCCR1B		(*sim_io8(SIM_REG_TCCR1B))
+#define TCCR2		(*sim_io8(SIM_REG_TCCR2))
+#define TCNT2		(*sim_io8(SIM_REG_TCNT2))
+#define OCR2		(*sim_io8(SIM_REG_OCR2))
+#define ASSR		(*sim_io8(SIM_REG_ASSR))
+#define SPCR		(*sim_io8(SIM_REG_SPCR))
+#define SPSR		(*sim_io8(SIM_REG_SPSR))
+#define SPDR		(*sim_io8(SIM_REG_SPDR))
+#define ADMUX		(*sim_io8(SIM_REG_ADMUX))
+#define ADCSRA		(*sim_io8(SIM_REG_ADCSRA))
+#define ADCL		(*sim_io8(SIM_REG_ADCL))
+#define ADCH		(*sim_io8(SIM_REG_ADCH))
+#define SFIOR		(*sim_io8(SIM_REG_SFIOR))
+#define ACSR		(*sim_io8(SIM_REG_ACSR))
+#define UCSRA		(*sim_io8(SIM_REG_UCSRA))
+#define UCSRB		(*sim_io8(SIM_REG_UCSRB))
+#define UCSRC		(*sim_io8(SIM_REG_UCSRC))
+#define UBRRL		(*sim_io8(SIM_REG_UBRRL))
+#define UBRRH		(*sim_io8(SIM_REG_UBRRH))
+#define UDR		(*sim_io8(SIM_REG_UDR))
+#define SPMCR		(*sim_io8(SIM_REG_SPMCR))
+#define WDTCR		(*sim_io8(SIM_REG_WDTCR))
+#define EECR		(*sim_io8(SIM_REG_EECR))
+#define TWCR		(*sim_io8(SIM_REG_TWCR))
+
+#define TCNT1		(*sim_io16(SIM_REG_TCNT1))
+#define OCR1A		(*sim_io16(SIM_REG_OCR1A))
+#define OCR1B		(*sim_io16(SIM_REG_OCR1B))
+#define ICR1		(*sim_io16(SIM_REG_ICR1))
+#define ADC		(*sim_io16(SIM_REG_ADC))
+#define SP		(*sim_io16(SIM_REG_SP))
+
+
+/* SREG */
+#define SREG_I		7
+/* SPCR, SPSR */
+#define SPIE		7
+#define SPE		6
+#define DORD		5
+#define MSTR		4
+#define CPOL		3
+#define CPHA		2
+#define SPR1		1
+#define SPR0		0
+#define SPIF		7
+#define SPI2X		0
+/* MCUCR, MCUCSR, GICR, GIFR */
+#define SE		7
+#define SM2		6
+#define SM1		5
+#define SM0		4
+#define ISC11		3
+#define ISC10		2
+#define ISC01		1
+#define ISC00		0
+#define JTRF		4
+#define WDRF		3
+#define BORF		2
+#define EXTRF		1
+#define PORF		0
+#define INT1		7
+#define INT0		6
+#define IVSEL		1
+#define IVCE		0
+#define INTF1		7
+#define INTF0		6
+/* TIMSK, TIFR */
+#define OCIE2		7
+#define TOIE2		6
+#define TICIE1		5
+#define OCIE1A		4
+#define OCIE1B		3
+#define TOIE1		2
+#define OCIE0		1
+#define TOIE0		0
+#define OCF2		7
+#define TOV2		6
+#define ICF1		5
+#define OCF1A		4
+#define OCF1B		3
+#define TOV1		2
+#define OCF0		1
+#define TOV0		0
+/* Timers */
+#define WGM00		6
+#define COM01		5
+#define COM00		4
+#define WGM01		3
+#define CS02		2
+#define CS01		1
+#define CS00		0
+#define WGM13		4
+#define WGM12		3
+#define CS12		2
+#define CS11		1
+#define CS10		0
+#define WGM20		6
+#define COM21		5
+#define COM20		4
+#define WGM21		3
+#define CS22		2
+#define CS21		1
+#define CS20		0
+/* ADC */
+#define REFS1		7
+#define REFS0		6
+#define ADLAR		5
+#define MUX4		4
+#define MUX3		3
+#define MUX2		2
+#define MUX1		1
+#define MUX0		0
+#define ADEN		7
+#define ADSC		6
+#define ADATE		5
+#define ADFR		5
+#define ADIF		4
+#define ADIE		3
+#define ADPS2		2
+#define ADPS1		1
+#define ADPS0		0
+#define ADTS2		7
+#define ADTS1		6
+#define ADTS0		5
+/* USART */
+#define RXC		7
+#define TXC		6
+#define UDRE		5
+#define FE		4
+#define DOR		3
+#define PE		2
+#define U2X		1
+#define RXCIE		7
+#define TXCIE		6
+#define UDRIE		5
+#define RXEN		4
+#define TXEN		3
+#define UCSZ2		2
+#define URSEL		7
+#define UPM1		5
+#define UPM0		4
+#define USBS		3
+#define UCSZ1		2
+#define UCSZ0		1
+/* SPMCR */
+#define SPMIE		7
+#define RWWSB		6
+#define RWWSRE		4
+#define BLBSET		3
+#define PGWRT		2
+#define PGERS		1
+#define SPMEN		0
+/* EECR */
+#define EEMWE		2
+#define EEWE		1
+#define EERE		0
+
+#define SPM_PAGESIZE	128
+#define RAMSTART	0x60
+#define RAMEND		0x85F
+#define E2END		0x3FF
+#define FLASHEND	0x7FFF
+
+#endif /* SIM_AVR_IO_H_ */
@@ -0,0 +1,26 @@
+#ifndef SIM_AVR_PGMSPACE_H_
+#define SIM_AVR_PGMSPACE_H_
+
+/* Simulator replacement for <avr/pgmspace.h>.
+ * Program memory is ordinary host memory. */
+
+#include <stdint.h>
+#include <string.h>
+
+
+#define PROGMEM
+#define PGM_P			const char *
+#define PSTR(s)			(s)
+
+#define pgm_read_byte(p)	(*(const uint8_t *)(p))
+#define pgm_read_word(p)	(*(const uint16_t *)(p))
+#define pgm_read_dword(p)	(*(const uint32_t *)(p))
+
+#define memcpy_P		memcpy
+#define strlen_P		strlen
+#define strcmp_P		strcmp
+
+/* See the <stdio.h> wrapper. */
+#define vfprintf_P		sim_vfprintf
+
+#endif /* SIM_AVR_PGMSPACE_H_ */
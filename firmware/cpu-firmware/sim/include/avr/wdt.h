@@ -0,0 +1,23 @@
+#ifndef SIM_AVR_WDT_H_
+#define SIM_AVR_WDT_H_
+
+/* Simulator replacement for <avr/wdt.h>.
+ * A watchdog timeout resets the simulated device. */
+
+#include <stdint.h>
+
+
+#define WDTO_15MS	0
+#define WDTO_30MS	1
+#define WDTO_60MS	2
+#define WDTO_120MS	3
+#define WDTO_250MS	4
+#define WDTO_500MS	5
+#define WDTO_1S		6
+#define WDTO_2S		7
+
+void wdt_enable(uint8_t timeout);
+void wdt_disable(void);
+void wdt_reset(void);
+
+#endif /* SIM_AVR_WDT_H_ */
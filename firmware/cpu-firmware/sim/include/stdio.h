@@ -0,0 +1,39 @@
+#ifndef SIM_STDIO_H_
+#define SIM_STDIO_H_
+
+/* Wrapper around the host <stdio.h>.
+ * The firmware uses avr-libc FDEV_SETUP_STREAM output streams.
+ * Map them to a small put-character stream.
+ * The simulator core defines SIM_NATIVE_STDIO to get the host FILE. */
+
+#include_next <stdio.h>
+
+#ifndef SIM_NATIVE_STDIO
+
+#include <stdarg.h>
+
+
+struct sim_avr_file {
+	int (*put)(char c, struct sim_avr_file *stream);
+};
+
+#undef FILE
+#define FILE			struct sim_avr_file
+
+#define _FDEV_SETUP_READ	1
+#define _FDEV_SETUP_WRITE	2
+#define _FDEV_SETUP_RW		3
+#define FDEV_SETUP_STREAM(p, g, f)	{ .put = (p), }
+
+int sim_vfprintf(struct sim_avr_file *stream, const char *fmt, va_list ap);
+
+/* The firmware's standard streams must not replace the host ones. */
+extern struct sim_avr_file *sim_stdout;
+extern struct sim_avr_file *sim_stderr;
+#undef stdout
+#undef stderr
+#define stdout			sim_stdout
+#define stderr			sim_stderr
+
+#endif /* SIM_NATIVE_STDIO */
+#endif /* SIM_STDIO_H_ */
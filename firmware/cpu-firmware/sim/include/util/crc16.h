@@ -0,0 +1,40 @@
+#ifndef SIM_UTIL_CRC16_H_
+#define SIM_UTIL_CRC16_H_
+
+/* Simulator replacement for <util/crc16.h>.
+ * Same algorithms as the avr-libc reference code. */
+
+#include <stdint.h>
+
+
+static inline uint16_t _crc16_update(uint16_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	crc ^= data;
+	for (i = 0; i < 8; i++) {
+		if (crc & 1)
+			crc = (uint16_t)((crc >> 1) ^ 0xA001u);
+		else
+			crc = (uint16_t)(crc >> 1);
+	}
+
+	return crc;
+}
+
+static inline uint8_t _crc_ibutton_update(uint8_t crc, uint8_t data)
+{
+	uint8_t i;
+
+	crc ^= data;
+	for (i = 0; i < 8; i++) {
+		if (crc & 1)
+			crc = (uint8_t)((crc >> 1) ^ 0x8Cu);
+		else
+			crc = (uint8_t)(crc >> 1);
+	}
+
+	return crc;
+}
+
+#endif /* SIM_UTIL_CRC16_H_ */
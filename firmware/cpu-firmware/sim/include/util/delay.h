@@ -0,0 +1,10 @@
+#ifndef SIM_UTIL_DELAY_H_
+#define SIM_UTIL_DELAY_H_
+
+/* Simulator replacement for <util/delay.h>.
+ * Busy delays advance the virtual clock. */
+
+void _delay_us(double us);
+void _delay_ms(double ms);
+
+#endif /* SIM_UTIL_DELAY_H_ */
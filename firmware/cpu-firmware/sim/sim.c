@@ -0,0 +1,763 @@
+/*
+ *   CNC-remote-control
+ *   Firmware simulator core
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#define SIM_NATIVE_STDIO
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <ucontext.h>
+
+#include "sim.h"
+#include "lcd.h"
+
+#include <avr/interrupt.h>
+#include <avr/wdt.h>
+#include <avr/eeprom.h>
+#include <avr/boot.h>
+
+
+/* Timer0 runs at F_CPU/64 and overflows every 1024 usec. */
+#define T0_TICK_NSEC		4000ull
+#define T0_OVF_NSEC		(T0_TICK_NSEC * 256u)
+/* Timer1 (jiffies) runs at F_CPU/1024. */
+#define T1_TICK_NSEC		64000ull
+/* ADC conversion at prescaler 128: 13 ADC cycles */
+#define ADC_CONV_NSEC		104000ull
+/* One UART frame. 10 bits at 115200 baud */
+#define UART_BYTE_NSEC		86806ull
+/* Flash page erase or write */
+#define SPM_NSEC		4000000ull
+
+/* Firmware context stack. Generous, because the host libc
+ * formats the firmware's printf output on it. */
+#define SIM_STACK_SIZE		(512u * 1024u)
+
+
+uint8_t sim_regs8[NR_SIM_IO8_REGS];
+uint16_t sim_regs16[NR_SIM_IO16_REGS];
+
+int sim_firmware_main(void);
+
+/* Interrupt handlers defined by the firmware */
+void INT0_vect(void) __attribute__((__weak__));
+void TIMER0_OVF_vect(void) __attribute__((__weak__));
+void ADC_vect(void) __attribute__((__weak__));
+void USART_UDRE_vect(void) __attribute__((__weak__));
+
+static struct {
+	bool initialized;
+	const char *reset_reason;	/* Non-NULL, if the device is dead */
+	enum sim_jump jump;		/* Where the firmware went, if dead */
+
+	uint64_t now;			/* Virtual clock, in nsec */
+	uint64_t run_until;		/* End of the current sim_run() slice */
+	ucontext_t host_ctx;
+	ucontext_t fw_ctx;
+	void *fw_stack;
+
+	uint8_t irq_pending;		/* Bitmask of enum sim_irq */
+	uint64_t timer_at[NR_SIM_TIMERS];
+	uint64_t next_timer;
+
+	uint64_t wdt_period;		/* 0, if disabled */
+	uint64_t wdt_deadline;
+
+	uint16_t adc_value;		/* 10 bit */
+	uint64_t adc_done;
+
+	bool uart_tx;			/* UDR was written */
+	uint8_t uart_shift;		/* Byte being transmitted */
+	bool uart_busy;			/* The shift register is busy */
+	bool uart_udr_full;		/* A byte waits in UDR */
+	bool uart_echo;
+	char uart_line[128];
+	unsigned int uart_len;
+
+	uint8_t flash[FLASHEND + 1];
+	uint16_t spm_buf[SPM_PAGESIZE / 2];	/* Temporary page buffer */
+	uint64_t spm_done;			/* End of erase or write */
+	uint8_t eeprom[E2END + 1];
+} sim;
+
+/* HD44780 model */
+static struct {
+	bool e;				/* E pin level */
+	bool eight_bit;			/* 8 bit interface mode */
+	bool nibble_pending;
+	uint8_t nibble;
+	bool display_on;
+	bool increment;
+	bool cgram;			/* Data goes to CGRAM */
+	uint8_t addr;			/* DDRAM address */
+	uint8_t cgaddr;			/* CGRAM address */
+	uint8_t ddram[0x80];
+	uint8_t cgram_data[0x40];
+} lcd;
+
+
+void sim_log(const char *fmt, ...)
+{
+	va_list ap;
+
+	fprintf(stderr, "[sim %8.3f ms] ", (double)sim.now / SIM_NSEC_PER_MSEC);
+	va_start(ap, fmt);
+	vfprintf(stderr, fmt, ap);
+	va_end(ap);
+	fputc('\n', stderr);
+}
+
+uint64_t sim_now(void)
+{
+	return sim.now;
+}
+
+void sim_irq_raise(enum sim_irq irq)
+{
+	sim.irq_pending = (uint8_t)(sim.irq_pending | (1u << irq));
+}
+
+void sim_timer_arm(enum sim_timer timer, uint64_t at)
+{
+	sim.timer_at[timer] = at;
+	if (at < sim.next_timer)
+		sim.next_timer = at;
+}
+
+void sim_device_reset(const char *reason)
+{
+	sim.reset_reason = reason;
+	sim_log("Device reset: %s", reason);
+	while (1)
+		swapcontext(&sim.fw_ctx, &sim.host_ctx);
+}
+
+static void sim_timer0_event(void)
+{
+	if (SIM_REG8(TCCR0) & ((1 << CS02) | (1 << CS01) | (1 << CS00)))
+		sim_irq_raise(SIM_IRQ_TIMER0_OVF);
+	sim_timer_arm(SIM_TIMER_TIMER0, sim.now - sim.now % T0_OVF_NSEC + T0_OVF_NSEC);
+}
+
+static void sim_adc_event(void)
+{
+	const uint8_t run = (1 << ADEN) | (1 << ADATE);
+
+	if ((SIM_REG8(ADCSRA) & run) == run) {
+		SIM_REG16(ADC) = sim.adc_value;
+		sim_irq_raise(SIM_IRQ_ADC);
+	}
+	sim_timer_arm(SIM_TIMER_ADC, sim.now + ADC_CONV_NSEC);
+}
+
+static void sim_uart_flush(void)
+{
+	if (sim.uart_echo) {
+		sim.uart_line[sim.uart_len] = '\0';
+		fprintf(stderr, "[fw uart] %s\n", sim.uart_line);
+	}
+	sim.uart_len = 0;
+}
+
+static void sim_uart_tx(uint8_t c)
+{
+	if (c == '\r')
+		return;
+	if (c == '\n') {
+		sim_uart_flush();
+		return;
+	}
+	sim.uart_line[sim.uart_len++] = (char)c;
+	if (sim.uart_len >= sizeof(sim.uart_line) - 1)
+		sim_uart_flush();
+}
+
+/* UDR was written. The byte moves to the shift register,
+ * if it is free. Otherwise it waits in UDR. */
+static void sim_uart_udr_written(void)
+{
+	if (!sim.uart_busy) {
+		sim.uart_busy = 1;
+		sim.uart_shift = SIM_REG8(UDR);
+		sim_timer_arm(SIM_TIMER_UART, sim.now + UART_BYTE_NSEC);
+	} else {
+		sim.uart_udr_full = 1;
+	}
+	SIM_REG8(UCSRA) = (uint8_t)(SIM_REG8(UCSRA) & ~(1u << TXC));
+}
+
+/* UDRE is level triggered.
+ * It is read-only, so restore it after firmware writes to UCSRA. */
+static void sim_uart_update(void)
+{
+	if (sim.uart_tx) {
+		sim.uart_tx = 0;
+		sim_uart_udr_written();
+	}
+	if (sim.uart_udr_full)
+		SIM_REG8(UCSRA) = (uint8_t)(SIM_REG8(UCSRA) & ~(1u << UDRE));
+	else
+		SIM_REG8(UCSRA) |= (1u << UDRE);
+	if (SIM_REG8(UCSRA) & (1u << UDRE))
+		sim.irq_pending |= (1u << SIM_IRQ_UDRE);
+	else
+		sim.irq_pending = (uint8_t)(sim.irq_pending & ~(1u << SIM_IRQ_UDRE));
+}
+
+static void sim_uart_timer(void)
+{
+	sim_uart_tx(sim.uart_shift);
+	if (sim.uart_udr_full) {
+		sim.uart_shift = SIM_REG8(UDR);
+		sim.uart_udr_full = 0;
+		SIM_REG8(UCSRA) |= (1u << UDRE);
+		sim_timer_arm(SIM_TIMER_UART, sim.now + UART_BYTE_NSEC);
+	} else {
+		sim.uart_busy = 0;
+		SIM_REG8(UCSRA) |= (1u << TXC);
+	}
+}
+
+static void sim_run_timers(void)
+{
+	static void (* const handlers[NR_SIM_TIMERS])(void) = {
+		[SIM_TIMER_TIMER0]	= sim_timer0_event,
+		[SIM_TIMER_ADC]		= sim_adc_event,
+		[SIM_TIMER_SPI]		= sim_spi_timer,
+		[SIM_TIMER_COPROC]	= sim_coproc_timer,
+		[SIM_TIMER_UART]	= sim_uart_timer,
+	};
+	unsigned int i;
+
+	for (i = 0; i < NR_SIM_TIMERS; i++) {
+		if (sim.timer_at[i] <= sim.now) {
+			sim.timer_at[i] = SIM_NEVER;
+			handlers[i]();
+		}
+	}
+	sim.next_timer = SIM_NEVER;
+	for (i = 0; i < NR_SIM_TIMERS; i++)
+		sim.next_timer = min(sim.next_timer, sim.timer_at[i]);
+}
+
+static bool sim_irq_enabled(enum sim_irq irq)
+{
+	switch (irq) {
+	case SIM_IRQ_INT0:
+		return !!(SIM_REG8(GICR) & (1 << INT0));
+	case SIM_IRQ_INT1:
+		return sim_usb_irq_enabled();
+	case SIM_IRQ_TIMER0_OVF:
+		return !!(SIM_REG8(TIMSK) & (1 << TOIE0));
+	case SIM_IRQ_SPI:
+		return 1;
+	case SIM_IRQ_ADC:
+		return !!(SIM_REG8(ADCSRA) & (1 << ADIE));
+	case SIM_IRQ_UDRE:
+		return !!(SIM_REG8(UCSRB) & (1 << UDRIE));
+	case NR_SIM_IRQS:
+		break;
+	}
+	return 0;
+}
+
+static void sim_irq_handle(enum sim_irq irq)
+{
+	switch (irq) {
+	case SIM_IRQ_INT0:
+		if (INT0_vect)
+			INT0_vect();
+		break;
+	case SIM_IRQ_INT1:
+		sim_usb_irq();
+		break;
+	case SIM_IRQ_TIMER0_OVF:
+		if (TIMER0_OVF_vect)
+			TIMER0_OVF_vect();
+		break;
+	case SIM_IRQ_SPI:
+		sim_spi_irq();
+		break;
+	case SIM_IRQ_ADC:
+		if (ADC_vect)
+			ADC_vect();
+		break;
+	case SIM_IRQ_UDRE:
+		if (USART_UDRE_vect)
+			USART_UDRE_vect();
+		break;
+	case NR_SIM_IRQS:
+		break;
+	}
+}
+
+/* Run the pending interrupt handlers.
+ * Handlers run with the I flag cleared, so they don't nest. */
+static void sim_dispatch_irqs(void)
+{
+	enum sim_irq irq;
+
+	while (SIM_REG8(SREG) & (1 << SREG_I)) {
+		sim_uart_update();
+		if (!sim.irq_pending)
+			break;
+		for (irq = 0; irq < NR_SIM_IRQS; irq++) {
+			if ((sim.irq_pending & (1u << irq)) &&
+			    sim_irq_enabled(irq))
+				break;
+		}
+		if (irq >= NR_SIM_IRQS)
+			break;
+
+		sim.irq_pending = (uint8_t)(sim.irq_pending & ~(1u << irq));
+		SIM_REG8(SREG) = (uint8_t)(SIM_REG8(SREG) & ~(1u << SREG_I));
+		sim.now += SIM_IRQ_NSEC;
+		sim_irq_handle(irq);
+		SIM_REG8(SREG) = (uint8_t)(SIM_REG8(SREG) | (1u << SREG_I));
+	}
+}
+
+/* Advance the virtual clock in firmware context. */
+static void sim_tick(uint64_t ns)
+{
+	sim.now += ns;
+
+	sim_uart_update();
+	if (sim.now >= sim.next_timer)
+		sim_run_timers();
+	if (sim.wdt_period && sim.now >= sim.wdt_deadline)
+		sim_device_reset("watchdog timeout");
+	if (sim.now >= sim.run_until)
+		swapcontext(&sim.fw_ctx, &sim.host_ctx);
+	sim_dispatch_irqs();
+}
+
+void sim_delay_ns(uint64_t ns)
+{
+	uint64_t step;
+
+	while (ns) {
+		step = min(ns, SIM_NSEC_PER_USEC);
+		sim_tick(step);
+		ns -= step;
+	}
+}
+
+static void sim_lcd_byte(uint8_t data, bool rs)
+{
+	if (rs) {
+		if (lcd.cgram) {
+			lcd.cgram_data[lcd.cgaddr] = data;
+			lcd.cgaddr = (lcd.cgaddr + 1u) & 0x3Fu;
+		} else {
+			lcd.ddram[lcd.addr] = data;
+			lcd.addr = (uint8_t)((lcd.addr + (lcd.increment ? 1u : 0x7Fu)) & 0x7Fu);
+		}
+		return;
+	}
+
+	if (data & 0x80) {		/* Set DDRAM address */
+		lcd.addr = data & 0x7F;
+		lcd.cgram = 0;
+	} else if (data & 0x40) {	/* Set CGRAM address */
+		lcd.cgaddr = data & 0x3F;
+		lcd.cgram = 1;
+	} else if (data & 0x20) {	/* Function set */
+		lcd.eight_bit = !!(data & 0x10);
+		lcd.nibble_pending = 0;
+	} else if (data & 0x10) {	/* Cursor or display shift */
+		if (!(data & 0x08))
+			lcd.addr = (uint8_t)((lcd.addr + ((data & 0x04) ? 1u : 0x7Fu)) & 0x7Fu);
+	} else if (data & 0x08) {	/* Display control */
+		lcd.display_on = !!(data & 0x04);
+	} else if (data & 0x04) {	/* Entry mode */
+		lcd.increment = !!(data & 0x02);
+	} else if (data & 0x02) {	/* Return home */
+		lcd.addr = 0;
+		lcd.cgram = 0;
+	} else if (data & 0x01) {	/* Clear display */
+		memset(lcd.ddram, ' ', sizeof(lcd.ddram));
+		lcd.addr = 0;
+		lcd.cgram = 0;
+		lcd.increment = 1;
+	}
+}
+
+/* Called before each access to the LCD port.
+ * The data and RS lines are sampled on the rising edge of E. */
+static void sim_lcd_port(void)
+{
+	uint8_t port = SIM_REG8(PORTA);
+	uint8_t nibble = (uint8_t)((port >> LCD_DATA_SHIFT) & 0xFu);
+	bool rs = !!(port & LCD_PIN_RS);
+	bool e = !!(port & LCD_PIN_E);
+
+	if (e && !lcd.e) {
+		if (lcd.eight_bit) {
+			sim_lcd_byte((uint8_t)(nibble << 4), rs);
+		} else if (!lcd.nibble_pending) {
+			lcd.nibble = nibble;
+			lcd.nibble_pending = 1;
+		} else {
+			lcd.nibble_pending = 0;
+			sim_lcd_byte((uint8_t)((lcd.nibble << 4) | nibble), rs);
+		}
+	}
+	lcd.e = e;
+}
+
+static void sim_adc_status(void)
+{
+	if (!(SIM_REG8(ADCSRA) & (1 << ADSC)))
+		return;
+	if (sim.adc_done == SIM_NEVER) {
+		sim.adc_done = sim.now + ADC_CONV_NSEC;
+	} else if (sim.now >= sim.adc_done) {
+		sim.adc_done = SIM_NEVER;
+		SIM_REG16(ADC) = sim.adc_value;
+		SIM_REG8(ADCSRA) = (uint8_t)((SIM_REG8(ADCSRA) & ~(1u << ADSC)) |
+					     (1u << ADIF));
+	}
+}
+
+volatile uint8_t * sim_io8(enum sim_io8_reg reg)
+{
+	sim_tick(SIM_IO_NSEC);
+
+	switch (reg) {
+	case SIM_REG_PORTA:
+		sim_lcd_port();
+		break;
+	case SIM_REG_TCNT0:
+		SIM_REG8(TCNT0) = (uint8_t)(sim.now / T0_TICK_NSEC);
+		break;
+	case SIM_REG_TIFR:
+		if (sim.irq_pending & (1u << SIM_IRQ_TIMER0_OVF))
+			SIM_REG8(TIFR) |= (1u << TOV0);
+		else
+			SIM_REG8(TIFR) = (uint8_t)(SIM_REG8(TIFR) & ~(1u << TOV0));
+		break;
+	case SIM_REG_ADCSRA:
+		sim_adc_status();
+		break;
+	case SIM_REG_PIND:
+		sim_coproc_pins();
+		break;
+	case SIM_REG_UDR:
+		sim.uart_tx = 1;
+		break;
+	default:
+		break;
+	}
+
+	return &sim_regs8[reg];
+}
+
+volatile uint16_t * sim_io16(enum sim_io16_reg reg)
+{
+	sim_tick(SIM_IO_NSEC);
+
+	switch (reg) {
+	case SIM_REG_TCNT1:
+		SIM_REG16(TCNT1) = (uint16_t)(sim.now / T1_TICK_NSEC);
+		break;
+	default:
+		break;
+	}
+
+	return &sim_regs16[reg];
+}
+
+void cli(void)
+{
+	SIM_REG8(SREG) = (uint8_t)(SIM_REG8(SREG) & ~(1u << SREG_I));
+}
+
+void sei(void)
+{
+	SIM_REG8(SREG) = (uint8_t)(SIM_REG8(SREG) | (1u << SREG_I));
+}
+
+void _delay_us(double us)
+{
+	sim_delay_ns((uint64_t)(us * SIM_NSEC_PER_USEC));
+}
+
+void _delay_ms(double ms)
+{
+	sim_delay_ns((uint64_t)(ms * SIM_NSEC_PER_MSEC));
+}
+
+void wdt_enable(uint8_t timeout)
+{
+	/* 16.3 msec, doubled for each step */
+	sim.wdt_period = 16300ull * SIM_NSEC_PER_USEC << min(timeout, WDTO_2S);
+	sim.wdt_deadline = sim.now + sim.wdt_period;
+	sim_tick(SIM_IO_NSEC);
+}
+
+void wdt_disable(void)
+{
+	sim.wdt_period = 0;
+	sim_tick(SIM_IO_NSEC);
+}
+
+void wdt_reset(void)
+{
+	sim.wdt_deadline = sim.now + sim.wdt_period;
+	sim_tick(SIM_IO_NSEC);
+}
+
+void sim_halt(void)
+{
+	while (1)
+		sim_tick(SIM_NSEC_PER_USEC);
+}
+
+void sim_enter_bootloader(void)
+{
+	sim.jump = SIM_JUMP_BOOTLOADER;
+	sim_device_reset("jumped to the bootloader");
+}
+
+void sim_exit_bootloader(void)
+{
+	sim.jump = SIM_JUMP_APPLICATION;
+	sim_device_reset("jumped to the application");
+}
+
+void sim_spm(enum sim_spm_op op, uint16_t address, uint16_t data)
+{
+	uint16_t page = (uint16_t)(address & FLASHEND & ~(SPM_PAGESIZE - 1u));
+	unsigned int i;
+
+	if (sim_spm_busy())
+		sim_log("SPM while busy. Ignored.");
+	else switch (op) {
+	case SIM_SPM_ERASE:
+		sim.spm_done = sim.now + SPM_NSEC;
+		memset(&sim.flash[page], 0xFF, SPM_PAGESIZE);
+		break;
+	case SIM_SPM_FILL:
+		sim.spm_buf[(address % SPM_PAGESIZE) / 2u] = data;
+		sim_tick(SIM_IO_NSEC);
+		break;
+	case SIM_SPM_WRITE:
+		sim.spm_done = sim.now + SPM_NSEC;
+		/* Programming only clears bits. */
+		for (i = 0; i < SPM_PAGESIZE / 2u; i++) {
+			sim.flash[page + i * 2u] &= (uint8_t)sim.spm_buf[i];
+			sim.flash[page + i * 2u + 1u] &= (uint8_t)(sim.spm_buf[i] >> 8);
+		}
+		memset(sim.spm_buf, 0xFF, sizeof(sim.spm_buf));
+		break;
+	case SIM_SPM_RWWENABLE:
+		sim_tick(SIM_IO_NSEC);
+		break;
+	}
+}
+
+bool sim_spm_busy(void)
+{
+	sim_tick(SIM_IO_NSEC);
+	return sim.now < sim.spm_done;
+}
+
+uint8_t sim_flash_read(uint16_t address)
+{
+	sim_tick(SIM_IO_NSEC);
+	return sim.flash[address & FLASHEND];
+}
+
+/* The application's EEMEM variables are plain host variables.
+ * The bootloader addresses the EEPROM by its raw address. */
+static uint8_t * sim_eeprom_ptr(const void *addr)
+{
+#ifdef BOOTLOADER
+	return &sim.eeprom[(uintptr_t)addr & E2END];
+#else
+	return (uint8_t *)addr;
+#endif
+}
+
+uint8_t eeprom_read_byte(const uint8_t *addr)
+{
+	return *sim_eeprom_ptr(addr);
+}
+
+void eeprom_write_byte(uint8_t *addr, uint8_t value)
+{
+	*sim_eeprom_ptr(addr) = value;
+}
+
+void eeprom_update_byte(uint8_t *addr, uint8_t value)
+{
+	*sim_eeprom_ptr(addr) = value;
+}
+
+void eeprom_read_block(void *dst, const void *src, size_t size)
+{
+	memcpy(dst, sim_eeprom_ptr(src), size);
+}
+
+void eeprom_update_block(const void *src, void *dst, size_t size)
+{
+	memcpy(sim_eeprom_ptr(dst), src, size);
+}
+
+void eeprom_write_block(const void *src, void *dst, size_t size)
+{
+	memcpy(sim_eeprom_ptr(dst), src, size);
+}
+
+struct sim_avr_file {
+	int (*put)(char c, struct sim_avr_file *stream);
+};
+
+struct sim_avr_file *sim_stdout;
+struct sim_avr_file *sim_stderr;
+
+int sim_vfprintf(struct sim_avr_file *stream, const char *fmt, va_list ap)
+{
+	char buf[256];
+	int i, count;
+
+	count = vsnprintf(buf, sizeof(buf), fmt, ap);
+	count = min(count, (int)sizeof(buf) - 1);
+	for (i = 0; i < count; i++)
+		stream->put(buf[i], stream);
+
+	return count;
+}
+
+static void sim_firmware_entry(void)
+{
+	sim_firmware_main();
+	sim_device_reset("main() returned");
+}
+
+/*** Host interface ***/
+
+SIM_EXPORT int sim_init(void)
+{
+	unsigned int i;
+
+	if (sim.initialized)
+		return -1;
+
+	memset(&sim, 0, sizeof(sim));
+	memset(&lcd, 0, sizeof(lcd));
+	memset(lcd.ddram, ' ', sizeof(lcd.ddram));
+	lcd.eight_bit = 1;
+	lcd.increment = 1;
+
+	SIM_REG8(PINA) = 0xFF;
+	SIM_REG8(PINB) = 0xFF;
+	SIM_REG8(PINC) = 0xFF;
+	SIM_REG8(PIND) = 0xFF;
+	SIM_REG8(UCSRA) = (1u << UDRE);
+	SIM_REG16(SP) = RAMEND;
+	memset(sim.flash, 0xFF, sizeof(sim.flash));
+	memset(sim.spm_buf, 0xFF, sizeof(sim.spm_buf));
+	memset(sim.eeprom, 0xFF, sizeof(sim.eeprom));
+
+	sim.adc_value = 0x3FF;
+	sim.adc_done = SIM_NEVER;
+	for (i = 0; i < NR_SIM_TIMERS; i++)
+		sim.timer_at[i] = SIM_NEVER;
+	sim.next_timer = SIM_NEVER;
+	sim_timer_arm(SIM_TIMER_TIMER0, T0_OVF_NSEC);
+	sim_timer_arm(SIM_TIMER_ADC, ADC_CONV_NSEC);
+	sim_coproc_init();
+	sim_usb_init();
+
+	sim.fw_stack = malloc(SIM_STACK_SIZE);
+	if (!sim.fw_stack)
+		return -1;
+	getcontext(&sim.fw_ctx);
+	sim.fw_ctx.uc_stack.ss_sp = sim.fw_stack;
+	sim.fw_ctx.uc_stack.ss_size = SIM_STACK_SIZE;
+	sim.fw_ctx.uc_link = NULL;
+	makecontext(&sim.fw_ctx, sim_firmware_entry, 0);
+
+	sim.initialized = 1;
+
+	return 0;
+}
+
+/** sim_run - Run the firmware for @usec of virtual time.
+ * Returns -1, if the device is dead. */
+SIM_EXPORT int sim_run(uint32_t usec)
+{
+	if (!sim.initialized || sim.reset_reason)
+		return -1;
+	sim.run_until = sim.now + usec * SIM_NSEC_PER_USEC;
+	swapcontext(&sim.host_ctx, &sim.fw_ctx);
+
+	return sim.reset_reason ? -1 : 0;
+}
+
+SIM_EXPORT uint64_t sim_time_us(void)
+{
+	return sim.now / SIM_NSEC_PER_USEC;
+}
+
+SIM_EXPORT const char * sim_reset_reason(void)
+{
+	return sim.reset_reason;
+}
+
+/** sim_jump_target - The firmware image the dead device jumped to.
+ * Returns enum sim_jump. */
+SIM_EXPORT int sim_jump_target(void)
+{
+	return sim.jump;
+}
+
+SIM_EXPORT void sim_uart_echo(int enable)
+{
+	sim.uart_echo = !!enable;
+}
+
+/** sim_adc_set - Set the feed override potentiometer (10 bit). */
+SIM_EXPORT void sim_adc_set(uint16_t value)
+{
+	sim.adc_value = min(value, 0x3FFu);
+}
+
+/** sim_lcd_read - Read the visible LCD contents.
+ * @buf: Buffer for LCD_NR_LINES lines, separated by newlines.
+ * Returns 1, if the display is on. */
+SIM_EXPORT int sim_lcd_read(char *buf, unsigned int size)
+{
+	static const uint8_t line_addr[] = { 0x00, 0x40, 0x14, 0x54, };
+	unsigned int line, col, pos = 0;
+
+	for (line = 0; line < LCD_NR_LINES; line++) {
+		for (col = 0; col < LCD_NR_COLUMNS; col++) {
+			if (pos + 1 >= size)
+				goto out;
+			buf[pos++] = (char)lcd.ddram[(line_addr[line] + col) & 0x7F];
+		}
+		if (line + 1 < LCD_NR_LINES && pos + 1 < size)
+			buf[pos++] = '\n';
+	}
+out:
+	if (size)
+		buf[pos] = '\0';
+
+	return lcd.display_on;
+}
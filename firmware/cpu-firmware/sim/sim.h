@@ -0,0 +1,89 @@
+#ifndef SIM_H_
+#define SIM_H_
+
+#include "util.h"
+
+#include <avr/io.h>
+
+#include <stdint.h>
+
+
+/* Symbols exported to the host (Python ctypes). */
+#define SIM_EXPORT		__attribute__((__visibility__("default")))
+
+#define SIM_NSEC_PER_USEC	1000ull
+#define SIM_NSEC_PER_MSEC	1000000ull
+#define SIM_NEVER		UINT64_MAX
+
+/* Virtual CPU time of one I/O register access, in nsec.
+ * This is 8 CPU cycles. It roughly accounts for the
+ * plain C code around the access. */
+#define SIM_IO_NSEC		500u
+/* Virtual CPU time of an interrupt entry and exit, in nsec. */
+#define SIM_IRQ_NSEC		1000u
+
+/** enum sim_irq - Simulated interrupt sources, in priority order. */
+enum sim_irq {
+	SIM_IRQ_INT0,		/* Coprocessor TRANSIRQ */
+	SIM_IRQ_INT1,		/* PDIUSBD12 */
+	SIM_IRQ_TIMER0_OVF,	/* Perf timer */
+	SIM_IRQ_SPI,		/* Coprocessor SPI transfer */
+	SIM_IRQ_ADC,		/* Feed override potentiometer */
+	SIM_IRQ_UDRE,		/* UART data register empty */
+
+	NR_SIM_IRQS,
+};
+
+/** enum sim_jump - Jumps between the firmware images.
+ * Each image runs in its own simulator library. */
+enum sim_jump {
+	SIM_JUMP_NONE,
+	SIM_JUMP_APPLICATION,	/* libcnccsim.so */
+	SIM_JUMP_BOOTLOADER,	/* libcnccsim-boot.so */
+};
+
+/** enum sim_timer - Timed peripheral events. */
+enum sim_timer {
+	SIM_TIMER_TIMER0,	/* Timer0 overflow */
+	SIM_TIMER_ADC,		/* Freerunning ADC conversion */
+	SIM_TIMER_SPI,		/* SPI byte transfer done */
+	SIM_TIMER_COPROC,	/* Coprocessor input sampler */
+	SIM_TIMER_UART,		/* UART byte transmitted */
+
+	NR_SIM_TIMERS,
+};
+
+/* Raw register state. Does not advance the virtual clock. */
+extern uint8_t sim_regs8[NR_SIM_IO8_REGS];
+extern uint16_t sim_regs16[NR_SIM_IO16_REGS];
+#define SIM_REG8(name)		sim_regs8[SIM_REG_##name]
+#define SIM_REG16(name)		sim_regs16[SIM_REG_##name]
+
+/** sim_now - The virtual clock, in nsec since power-on. */
+uint64_t sim_now(void);
+/** sim_delay_ns - Busy-wait in firmware context. */
+void sim_delay_ns(uint64_t ns);
+
+/** sim_irq_raise - Set the pending flag of an interrupt. */
+void sim_irq_raise(enum sim_irq irq);
+/** sim_timer_arm - Run the @timer event at virtual time @at.
+ * SIM_NEVER disarms the timer. */
+void sim_timer_arm(enum sim_timer timer, uint64_t at);
+
+/** sim_device_reset - The device has reset. Never returns to the firmware. */
+void sim_device_reset(const char *reason) __attribute__((__noreturn__));
+
+/** sim_log - Print a simulator message. */
+void sim_log(const char *fmt, ...) __attribute__((__format__(__printf__, 1, 2)));
+
+/* Peripheral models */
+void sim_coproc_init(void);
+void sim_coproc_timer(void);
+void sim_coproc_pins(void);
+void sim_spi_timer(void);
+void sim_spi_irq(void);
+void sim_usb_init(void);
+bool sim_usb_irq_enabled(void);
+void sim_usb_irq(void);
+
+#endif /* SIM_H_ */
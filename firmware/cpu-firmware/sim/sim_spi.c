@@ -0,0 +1,198 @@
+/*
+ *   CNC-remote-control
+ *   Firmware simulator: SPI master and button coprocessor
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "sim.h"
+#include "spi.h"
+#include "coproc_model.h"
+
+
+/* One byte at SCK = F_CPU/@div */
+#define SPI_BYTE_NSEC(div)	((div) * 8ull * 1000000000ull / F_CPU)
+/* Timer1 tick, the unit of the spi_async_start() wait. */
+#define T1_TICK_NSEC		64000ull
+
+/* CPU side of the asynchronous transfer */
+static struct {
+	uint8_t flags;
+	uint8_t wait;
+	uint8_t bytes_left;
+	const uint8_t *txbuf;
+	uint8_t *rxbuf;
+	uint8_t txbyte;
+} async_state;
+
+
+/* The coprocessor input sampler */
+void sim_coproc_timer(void)
+{
+	sim_timer_arm(SIM_TIMER_COPROC, sim_now() + COPROC_MODEL_SAMPLE_NSEC);
+	if (coproc_model_sample(sim_now()))
+		sim_irq_raise(SIM_IRQ_INT0);
+}
+
+static uint8_t coproc_exchange(uint8_t cmd)
+{
+	return coproc_model_exchange(cmd, sim_now());
+}
+
+/* The coprocessor bootloader busy line */
+void sim_coproc_pins(void)
+{
+	if (coproc_model_busy(sim_now()))
+		SIM_REG8(PIND) |= (1u << SPI_MASTER_TRANSIRQ_BIT);
+	else
+		SIM_REG8(PIND) = (uint8_t)(SIM_REG8(PIND) &
+					   ~(1u << SPI_MASTER_TRANSIRQ_BIT));
+}
+
+/* The byte time at the SCK rate selected in SPCR and SPSR */
+static uint64_t spi_byte_nsec(void)
+{
+	static const uint8_t div[] = { 4, 16, 64, 128 };
+	uint64_t nsec;
+
+	nsec = SPI_BYTE_NSEC(div[SIM_REG8(SPCR) & ((1u << SPR1) | (1u << SPR0))]);
+	if (SIM_REG8(SPSR) & (1u << SPI2X))
+		nsec /= 2;
+
+	return nsec;
+}
+
+void sim_coproc_init(void)
+{
+	coproc_model_reset();
+	memset(&async_state, 0, sizeof(async_state));
+	sim_timer_arm(SIM_TIMER_COPROC, COPROC_MODEL_SAMPLE_NSEC);
+}
+
+/*** CPU side. Replaces spi.c ***/
+
+#if SPI_HAVE_ASYNC
+
+/* Put the next byte on the wire after @delay nsec. */
+static void spi_transfer_async(uint64_t delay)
+{
+	async_state.txbyte = *async_state.txbuf;
+	async_state.txbuf++;
+	async_state.bytes_left--;
+	sim_timer_arm(SIM_TIMER_SPI, sim_now() + delay + spi_byte_nsec());
+}
+
+/* The byte is on the wire */
+void sim_spi_timer(void)
+{
+	sim_irq_raise(SIM_IRQ_SPI);
+}
+
+/* SPI_STC and TIMER1_COMPB in one */
+void sim_spi_irq(void)
+{
+	if (!(async_state.flags & SPI_ASYNC_RUNNING))
+		return;
+
+	*async_state.rxbuf = coproc_exchange(async_state.txbyte);
+	async_state.rxbuf++;
+	if (async_state.bytes_left) {
+		spi_transfer_async(async_state.wait * T1_TICK_NSEC);
+	} else {
+		spi_slave_select(0);
+		async_state.flags = (uint8_t)(async_state.flags & ~SPI_ASYNC_RUNNING);
+		spi_async_done();
+	}
+}
+
+void spi_async_start(void *rxbuf, const void *txbuf,
+		     uint8_t nr_bytes, uint8_t flags, uint8_t wait)
+{
+	BUG_ON(!irqs_disabled());
+	BUG_ON(async_state.flags & SPI_ASYNC_RUNNING);
+	BUG_ON(!nr_bytes);
+
+	async_state.flags = flags | SPI_ASYNC_RUNNING;
+	async_state.bytes_left = nr_bytes;
+	async_state.wait = wait;
+	async_state.txbuf = txbuf;
+	async_state.rxbuf = rxbuf;
+
+	spi_slave_select(1);
+	if (flags & SPI_ASYNC_DELAYSTART)
+		spi_transfer_async(wait * T1_TICK_NSEC);
+	else
+		spi_transfer_async(0);
+}
+
+bool spi_async_running(void)
+{
+	return !!(ATOMIC_LOAD(async_state.flags) & SPI_ASYNC_RUNNING);
+}
+
+#else /* SPI_HAVE_ASYNC */
+
+void sim_spi_timer(void)
+{
+}
+
+void sim_spi_irq(void)
+{
+}
+
+#endif /* SPI_HAVE_ASYNC */
+
+uint8_t spi_transfer_sync(uint8_t tx)
+{
+	sim_delay_ns(spi_byte_nsec());
+	return coproc_exchange(tx);
+}
+
+uint8_t spi_transfer_slowsync(uint8_t tx)
+{
+	_delay_ms(10);
+	return spi_transfer_sync(tx);
+}
+
+void spi_lowlevel_exit(void)
+{
+	SPCR = 0;
+	SPSR = 0;
+}
+
+void spi_lowlevel_init(void)
+{
+	spi_slave_select(0);
+	SPCR = (1u << SPE) | (1u << MSTR) |
+	       (0u << CPOL) | (0u << CPHA) |
+	       (0u << SPR0) | (1u << SPR1);
+	SPSR = 0u;
+	long_delay_ms(150);
+}
+
+/*** Host interface ***/
+
+/** sim_coproc_set_buttons - Set the physical button states.
+ * Bit n is the coprocessor button n. 1 = pressed. */
+SIM_EXPORT void sim_coproc_set_buttons(uint16_t pressed)
+{
+	coproc_model_set_buttons(pressed);
+}
+
+/** sim_coproc_encoder - Turn the jog wheel by @steps encoder states.
+ * One wheel detent is two states. */
+SIM_EXPORT void sim_coproc_encoder(int steps)
+{
+	coproc_model_encoder(steps);
+}
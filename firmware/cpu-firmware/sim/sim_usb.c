@@ -0,0 +1,322 @@
+/*
+ *   CNC-remote-control
+ *   Firmware simulator: PDIUSBD12 endpoint model
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include <string.h>
+
+#include "sim.h"
+#include "pdiusb.h"
+#include "usb.h"
+#include "stats.h"
+
+
+/* The model works on whole frames. The host side calls below
+ * stand in for the USB bus. Replaces pdiusb.c */
+
+#define EP1_MAXSIZE		16
+#define EP2_MAXSIZE		64
+/* The main OUT endpoint is double buffered */
+#define EP2OUT_NR_BUFFERS	2
+
+/* Host interface return codes */
+#define SIM_USB_NAK		-1
+#define SIM_USB_NODEV		-2
+
+enum {
+	IRQ_BUSRST	= 1 << 0,
+	IRQ_SETUP	= 1 << 1,
+	IRQ_EP1IN	= 1 << 2,
+	IRQ_EP2OUT	= 1 << 3,
+	IRQ_EP2IN	= 1 << 4,
+};
+
+struct frame {
+	uint8_t size;
+	uint8_t data[EP2_MAXSIZE];
+};
+
+static struct {
+	bool connected;			/* SOFTCONN */
+	bool irq_enabled;
+	uint8_t irq_status;
+	uint8_t address;
+	bool endpoints_enabled;
+	uint8_t stalled;		/* Bit per enum pdiusb_ep_index */
+	struct usb_ctrl setup;
+
+	struct frame ep2out[EP2OUT_NR_BUFFERS];
+	uint8_t ep2out_count;
+	bool ep2out_pending;		/* Waiting for RX ring space */
+
+	struct frame ep2in;
+	struct frame ep1in;
+} usb;
+
+
+static void usb_raise(uint8_t status)
+{
+	usb.irq_status |= status;
+	sim_irq_raise(SIM_IRQ_INT1);
+}
+
+bool sim_usb_irq_enabled(void)
+{
+	return usb.irq_enabled;
+}
+
+static void handle_ep2out_data(void)
+{
+	uint8_t *buf, res;
+
+	while (usb.ep2out_count) {
+		buf = usb_ep2_rx_slot();
+		if (!buf) {
+			usb.ep2out_pending = 1;
+			return;
+		}
+		memcpy(buf, usb.ep2out[0].data, usb.ep2out[0].size);
+		res = usb_ep2_rx_commit(usb.ep2out[0].size);
+		if (res == USB_RX_ERROR)
+			usb_stall_endpoint(USB_ENDPOINT_OUT | 2);
+		usb.ep2out[0] = usb.ep2out[1];
+		usb.ep2out_count--;
+	}
+	usb.ep2out_pending = 0;
+}
+
+static void ep_queue_data(struct frame *f, const void *data, uint8_t size)
+{
+	memcpy(f->data, data, size);
+	f->size = size;
+}
+
+/* The PDIUSB interrupt (INT1) */
+void sim_usb_irq(void)
+{
+	perf_time_t start = perf_timer_get();
+	uint8_t status, size;
+	void *buf;
+
+	status = usb.irq_status;
+	usb.irq_status = 0;
+
+	if (status & IRQ_BUSRST) {
+		memset(&usb.ep2in, 0, sizeof(usb.ep2in));
+		memset(&usb.ep1in, 0, sizeof(usb.ep1in));
+		usb.ep2out_count = 0;
+		usb.ep2out_pending = 0;
+		usb_reset();
+	}
+	if (status & IRQ_SETUP)
+		usb_control_setup_rx(&usb.setup);
+
+#if USB_WITH_EP1
+	if ((status & IRQ_EP1IN) && !usb.ep1in.size) {
+		size = usb_ep1_tx_poll(&buf, EP1_MAXSIZE);
+		if (size != USB_TX_POLL_NONE && size)
+			ep_queue_data(&usb.ep1in, buf, size);
+	}
+#endif
+
+	if (status & IRQ_EP2OUT)
+		handle_ep2out_data();
+	if ((status & IRQ_EP2IN) && !usb.ep2in.size) {
+		size = usb_ep2_tx_poll(&buf, EP2_MAXSIZE);
+		if (size != USB_TX_POLL_NONE && size)
+			ep_queue_data(&usb.ep2in, buf, size);
+		/* The poll might have freed RX ring space. */
+		if (usb.ep2out_pending)
+			handle_ep2out_data();
+	}
+
+	stats_usb_irq(start);
+}
+
+void sim_usb_init(void)
+{
+	memset(&usb, 0, sizeof(usb));
+}
+
+uint8_t pdiusb_configure_clkout(void)
+{
+	return 0;
+}
+
+uint8_t pdiusb_init(void)
+{
+	usb_reset();
+	_delay_ms(50);
+	usb.connected = 1;
+	usb.stalled = 0;
+	usb.irq_status = 0;
+	usb.irq_enabled = 1;
+
+	return 0;
+}
+
+uint16_t pdiusb_ramsize(void)
+{
+	return 0; /* The model has no receive buffer. */
+}
+
+void pdiusb_exit(void)
+{
+	usb.irq_enabled = 0;
+	usb.stalled = (1u << PDIUSB_EP_COUNT) - 1u;
+	usb_set_address(0);
+	usb.connected = 0;
+
+	long_delay_ms(500);
+}
+
+void usb_set_address(uint8_t address)
+{
+	usb.address = address & 0x7F;
+}
+
+void usb_enable_endpoints(uint8_t enable)
+{
+	usb.endpoints_enabled = !!enable;
+}
+
+static uint8_t ep_addr_to_ep_index(uint8_t ep)
+{
+	uint8_t ep_index;
+
+	switch (ep & ~0x80) {
+	case 0:
+		ep_index = PDIUSB_EP_CTLOUT;
+		break;
+	case 1:
+		ep_index = PDIUSB_EP_EP1OUT;
+		break;
+	case 2:
+		ep_index = PDIUSB_EP_EP2OUT;
+		break;
+	default:
+		return 0xFF;
+	}
+	if (usb_ep_is_in(ep))
+		ep_index = PDIUSB_EPIDX_IN(ep_index);
+
+	return ep_index;
+}
+
+void usb_stall_endpoint(uint8_t ep)
+{
+	uint8_t ep_index = ep_addr_to_ep_index(ep);
+
+	if (ep_index != 0xFF)
+		usb.stalled = (uint8_t)(usb.stalled | (1u << ep_index));
+}
+
+void usb_unstall_endpoint(uint8_t ep)
+{
+	uint8_t ep_index = ep_addr_to_ep_index(ep);
+
+	if (ep_index != 0xFF)
+		usb.stalled = (uint8_t)(usb.stalled & ~(1u << ep_index));
+}
+
+uint8_t usb_endpoint_is_stalled(uint8_t ep)
+{
+	uint8_t ep_index = ep_addr_to_ep_index(ep);
+
+	if (ep_index == 0xFF)
+		return 1;
+	return !!(usb.stalled & (1u << ep_index));
+}
+
+/*** Host interface ***/
+
+SIM_EXPORT int sim_usb_connected(void)
+{
+	return usb.connected;
+}
+
+SIM_EXPORT int sim_usb_bus_reset(void)
+{
+	if (!usb.connected)
+		return SIM_USB_NODEV;
+	usb_raise(IRQ_BUSRST);
+	return 0;
+}
+
+/** sim_usb_set_configuration - Send a SET_CONFIGURATION request. */
+SIM_EXPORT int sim_usb_set_configuration(uint8_t configuration)
+{
+	if (!usb.connected)
+		return SIM_USB_NODEV;
+	memset(&usb.setup, 0, sizeof(usb.setup));
+	usb.setup.bRequestType = USB_TYPE_STANDARD | USB_RECIP_DEVICE;
+	usb.setup.bRequest = USB_REQ_SET_CONFIGURATION;
+	usb.setup.wValue = cpu_to_le16(configuration);
+	usb_raise(IRQ_SETUP);
+	return 0;
+}
+
+/** sim_usb_ep2_write - Bulk OUT frame to EP2.
+ * Returns the size, SIM_USB_NAK or SIM_USB_NODEV. */
+SIM_EXPORT int sim_usb_ep2_write(const void *data, unsigned int size)
+{
+	struct frame *f;
+
+	if (!usb.connected)
+		return SIM_USB_NODEV;
+	if (usb.stalled & (1u << PDIUSB_EP_EP2OUT))
+		return SIM_USB_NODEV;
+	if (usb.ep2out_count >= EP2OUT_NR_BUFFERS)
+		return SIM_USB_NAK;
+	size = min(size, EP2_MAXSIZE);
+	f = &usb.ep2out[usb.ep2out_count++];
+	memcpy(f->data, data, size);
+	f->size = (uint8_t)size;
+	usb_raise(IRQ_EP2OUT);
+
+	return (int)size;
+}
+
+/* An IN token. Take the frame, if there is one.
+ * The endpoint interrupt lets the firmware queue the next one. */
+static int usb_read_in(struct frame *f, uint8_t irq,
+		       void *data, unsigned int size)
+{
+	int ret = SIM_USB_NAK;
+
+	if (!usb.connected)
+		return SIM_USB_NODEV;
+	if (f->size) {
+		ret = min(f->size, size);
+		memcpy(data, f->data, (size_t)ret);
+		f->size = 0;
+	}
+	usb_raise(irq);
+
+	return ret;
+}
+
+/** sim_usb_ep2_read - Bulk IN frame from EP2.
+ * Returns the size, SIM_USB_NAK or SIM_USB_NODEV. */
+SIM_EXPORT int sim_usb_ep2_read(void *data, unsigned int size)
+{
+	return usb_read_in(&usb.ep2in, IRQ_EP2IN, data, size);
+}
+
+/** sim_usb_ep1_read - Interrupt IN frame from EP1.
+ * Returns the size, SIM_USB_NAK or SIM_USB_NODEV. */
+SIM_EXPORT int sim_usb_ep1_read(void *data, unsigned int size)
+{
+	return usb_read_in(&usb.ep1in, IRQ_EP1IN, data, size);
+}
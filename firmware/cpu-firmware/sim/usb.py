@@ -0,0 +1,343 @@
+"""
+# CNC-remote-control
+# Firmware simulator: drop-in replacement for the PyUSB 0.x module
+#
+# Copyright (C) 2026 agent <agent@local>
+#
+# This program is free software; you can redistribute it and/or
+# modify it under the terms of the GNU General Public License
+# version 2 as published by the Free Software Foundation.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+"""
+
+# Put this directory first in PYTHONPATH to run the host driver
+# against the simulated firmware instead of a real device:
+#
+#   PYTHONPATH=firmware/cpu-firmware/sim ./driver/admin.py --noinit ...
+#
+# Environment variables:
+#   CNCC_SIM_LIB	Path to libcnccsim.so
+#   CNCC_SIM_BOOTLIB	Path to libcnccsim-boot.so
+#   CNCC_SIM_FAST	Set to 1 to run as fast as possible instead
+#			of pacing the virtual clock to the wall clock.
+#			time.sleep() then runs the simulation instead
+#			of sleeping.
+#   CNCC_SIM_UART	Set to 1 to print the firmware debug UART.
+#   CNCC_SIM_USB_USEC	Virtual bus time per bulk transfer, in usec.
+#			Default 0. A real full speed bus takes about
+#			one 1 ms frame per transfer.
+
+import ctypes
+import _ctypes
+import errno
+import os
+import time
+
+
+IDVENDOR	= 0x6666
+IDPRODUCT	= 0xC8CC
+
+EP_IRQ		= 0x81
+EP_IN		= 0x82
+EP_OUT		= 0x02
+
+# Host interface return codes. See sim_usb.c
+SIM_USB_NAK	= -1
+SIM_USB_NODEV	= -2
+
+# Firmware images. See enum sim_jump in sim.h
+SIM_JUMP_NONE		= 0
+SIM_JUMP_APPLICATION	= 1
+SIM_JUMP_BOOTLOADER	= 2
+
+
+class USBError(IOError):
+	def __init__(self, message, errno=None):
+		IOError.__init__(self, message)
+		self.errno = errno
+
+class Simulator(object):
+	"""The simulated device.
+	The application and the bootloader are separate libraries.
+	A jump from one image to the other loads the other library."""
+
+	# Virtual time step while waiting for the device, in usec.
+	POLL_USEC	= 50
+	# Maximum wall clock lag that is caught up at once, in usec.
+	MAX_CATCHUP_USEC = 100000
+	# Virtual time the device gets to attach to the bus, in usec.
+	BOOT_USEC	= 5000000
+
+	# Coprocessor button numbers. See main.h
+	BUTTONS = {
+		"halt"		: 0,
+		"spindle"	: 1,
+		"axis+"		: 2,
+		"axis-"		: 3,
+		"toggle"	: 4,
+		"twohand"	: 5,
+		"jog+"		: 6,
+		"rapid"		: 7,
+		"jog-"		: 8,
+		"inc"		: 9,
+		"soft0"		: 10,
+		"onoff"		: 11,
+		"soft1"		: 12,
+		"encpush"	: 13,
+	}
+
+	def __init__(self, libPath=None, bootLibPath=None):
+		simDir = os.path.dirname(os.path.abspath(__file__))
+		self.libPaths = {
+			SIM_JUMP_APPLICATION : libPath or\
+				os.environ.get("CNCC_SIM_LIB",
+					os.path.join(simDir, "libcnccsim.so")),
+			SIM_JUMP_BOOTLOADER : bootLibPath or\
+				os.environ.get("CNCC_SIM_BOOTLIB",
+					os.path.join(simDir, "libcnccsim-boot.so")),
+		}
+		self.lib = None
+		self.timeBase = 0
+		self.realtime = not int(os.environ.get("CNCC_SIM_FAST", "0"))
+		self.uartEcho = int(os.environ.get("CNCC_SIM_UART", "0"))
+		self.busUsec = int(os.environ.get("CNCC_SIM_USB_USEC", "0"))
+		self.buttons = 0
+		self.adcValue = 0x3FF
+		self.buf = ctypes.create_string_buffer(64)
+
+		self.__load(SIM_JUMP_APPLICATION)
+		if not self.attach():
+			raise USBError("Simulated device did not attach",
+				       errno.ENODEV)
+		self.wallStart = time.time() - self.now() / 1e6
+		if not self.realtime:
+			# The host sleeps to wait for the device.
+			time.sleep = self.sleep
+
+	def __load(self, image):
+		"Power up the firmware image. The virtual clock continues."
+		if self.lib:
+			self.timeBase += self.lib.sim_time_us()
+			# Unload, so that the image starts with fresh memory.
+			_ctypes.dlclose(self.lib._handle)
+		lib = ctypes.CDLL(self.libPaths[image])
+		lib.sim_time_us.restype = ctypes.c_uint64
+		lib.sim_reset_reason.restype = ctypes.c_char_p
+		lib.sim_run.argtypes = [ ctypes.c_uint32 ]
+		lib.sim_adc_set.argtypes = [ ctypes.c_uint16 ]
+		lib.sim_coproc_set_buttons.argtypes = [ ctypes.c_uint16 ]
+		lib.sim_coproc_encoder.argtypes = [ ctypes.c_int ]
+		lib.sim_usb_set_configuration.argtypes = [ ctypes.c_uint8 ]
+		self.lib = lib
+		self.image = image
+
+		if lib.sim_init():
+			raise USBError("Simulator init failed")
+		lib.sim_uart_echo(self.uartEcho)
+		lib.sim_coproc_set_buttons(self.buttons)
+		lib.sim_adc_set(self.adcValue)
+
+	def attach(self):
+		"""Run the firmware until it attaches to the bus.
+		Returns False on timeout."""
+		deadline = self.now() + self.BOOT_USEC
+		while not self.lib.sim_usb_connected():
+			if self.now() >= deadline:
+				return False
+			self.run(10000)
+		return True
+
+	def now(self):
+		"Get the virtual time, in usec."
+		return self.timeBase + self.lib.sim_time_us()
+
+	def alive(self):
+		return self.lib.sim_reset_reason() is None
+
+	def resetReason(self):
+		reason = self.lib.sim_reset_reason()
+		return reason.decode("UTF-8") if reason else None
+
+	def run(self, usec):
+		"Run the firmware for usec of virtual time."
+		end = self.now() + int(usec)
+		while self.lib.sim_run(max(end - self.now(), 0)):
+			image = self.lib.sim_jump_target()
+			if image == SIM_JUMP_NONE:
+				raise USBError("No such device (%s)" % self.resetReason(),
+					       errno.ENODEV)
+			self.__load(image)
+
+	def sleep(self, seconds):
+		"Run the firmware for the host sleep time."
+		try:
+			self.run(seconds * 1e6)
+		except USBError:
+			pass
+
+	def catchUp(self):
+		"Run the firmware up to the wall clock."
+		if not self.realtime:
+			return
+		lag = (time.time() - self.wallStart) * 1e6 - self.now()
+		if lag > self.MAX_CATCHUP_USEC:
+			self.wallStart += (lag - self.MAX_CATCHUP_USEC) / 1e6
+			lag = self.MAX_CATCHUP_USEC
+		if lag > 0:
+			self.run(lag)
+
+	def pace(self):
+		"Let the wall clock catch up with the virtual clock."
+		if not self.realtime:
+			return
+		ahead = self.now() / 1e6 - (time.time() - self.wallStart)
+		if ahead > 0.001:
+			time.sleep(ahead)
+
+	def wait(self, func, timeoutMs):
+		"Run the firmware until func() returns a result or the timeout."
+		self.catchUp()
+		deadline = self.now() + timeoutMs * 1000
+		while True:
+			ret = func()
+			if ret == SIM_USB_NODEV:
+				raise USBError("No such device", errno.ENODEV)
+			if ret != SIM_USB_NAK:
+				return ret
+			if self.now() >= deadline:
+				raise USBError("Connection timed out")
+			self.run(self.POLL_USEC)
+			self.pace()
+
+	def setButtons(self, mask):
+		"Set the pressed buttons. Bit n is coprocessor button n."
+		self.buttons = mask & 0x3FFF
+		self.lib.sim_coproc_set_buttons(self.buttons)
+
+	def press(self, button, pressed=True):
+		bit = 1 << self.BUTTONS.get(button, button)
+		self.setButtons((self.buttons | bit) if pressed else\
+				(self.buttons & ~bit))
+
+	def jog(self, detents):
+		"Turn the jog wheel."
+		self.lib.sim_coproc_encoder(detents * 2)
+
+	def setOverride(self, value):
+		"Set the feed override potentiometer. 0.0 - 1.0"
+		self.adcValue = int(round(max(0.0, min(value, 1.0)) * 0x3FF))
+		self.lib.sim_adc_set(self.adcValue)
+
+	def lcd(self):
+		"Get the LCD text lines."
+		buf = ctypes.create_string_buffer(128)
+		self.lib.sim_lcd_read(buf, len(buf))
+		return [ "".join(chr(c) if 0x20 <= c < 0x7F else "?"
+				 for c in bytearray(line))
+			 for line in buf.value.split(b"\n") ]
+
+_simulator = None
+
+def simulator():
+	"Get the simulated device. Boots it on first use."
+	global _simulator
+	if _simulator is None:
+		_simulator = Simulator()
+	return _simulator
+
+class Endpoint(object):
+	def __init__(self, address):
+		self.address = address
+
+class Interface(object):
+	def __init__(self):
+		self.interfaceNumber = 0
+		self.alternateSetting = 0
+		self.endpoints = [ Endpoint(EP_IRQ),
+				   Endpoint(EP_IN),
+				   Endpoint(EP_OUT), ]
+
+class Configuration(object):
+	def __init__(self):
+		self.value = 1
+		self.interfaces = [ [ Interface(), ], ]
+
+class DeviceHandle(object):
+	def __init__(self, sim):
+		self.sim = sim
+
+	def reset(self):
+		self.sim.catchUp()
+		if self.sim.lib.sim_usb_bus_reset():
+			raise USBError("No such device", errno.ENODEV)
+		self.sim.run(1000)
+
+	def setConfiguration(self, configuration):
+		value = getattr(configuration, "value", configuration)
+		if self.sim.lib.sim_usb_set_configuration(value):
+			raise USBError("No such device", errno.ENODEV)
+		self.sim.run(1000)
+
+	def claimInterface(self, interface):
+		pass
+
+	def releaseInterface(self):
+		pass
+
+	def setAltInterface(self, interface):
+		pass
+
+	def clearHalt(self, endpoint):
+		pass
+
+	def bulkWrite(self, endpoint, data, timeout=100):
+		data = bytes(bytearray(data))
+		self.sim.run(self.sim.busUsec)
+		return self.sim.wait(lambda: self.sim.lib.sim_usb_ep2_write(
+					data, len(data)), timeout)
+
+	def __read(self, funcName, size, timeout):
+		# Look the function up on each try. The firmware might
+		# jump to the other image while we wait.
+		buf = self.sim.buf
+		size = min(size, len(buf))
+		self.sim.run(self.sim.busUsec)
+		ret = self.sim.wait(lambda: getattr(self.sim.lib, funcName)(buf, size),
+				    timeout)
+		return bytes(buf.raw[:ret])
+
+	def bulkRead(self, endpoint, size, timeout=100):
+		return self.__read("sim_usb_ep2_read", size, timeout)
+
+	def interruptRead(self, endpoint, size, timeout=100):
+		return self.__read("sim_usb_ep1_read", size, timeout)
+
+class Device(object):
+	def __init__(self, sim):
+		self.sim = sim
+		self.idVendor = IDVENDOR
+		self.idProduct = IDPRODUCT
+		self.configurations = [ Configuration(), ]
+
+	def open(self):
+		return DeviceHandle(self.sim)
+
+class Bus(object):
+	def __init__(self, devices):
+		self.dirname = "sim"
+		self.devices = devices
+
+def busses():
+	sim = simulator()
+	sim.catchUp()
+	if not sim.realtime:
+		# The host does not wait in virtual time.
+		# Give a device that is about to attach the time to do so.
+		sim.attach()
+	if not sim.alive() or not sim.lib.sim_usb_connected():
+		return [ Bus([]), ]
+	return [ Bus([ Device(sim), ]), ]
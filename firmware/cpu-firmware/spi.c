@@ -24,8 +24,7 @@
 
 static struct spi_async_state {
 	uint8_t flags;
-	uint8_t wait_ms;
-	uint8_t wait_ms_left;
+	uint8_t wait;
 	uint8_t bytes_left;
 	const uint8_t *txbuf;
 	uint8_t *rxbuf;
@@ -48,6 +47,15 @@ static void spi_transfer_async(void)
 	SPDR = txbyte;
 }
 
+/* Send the next byte from the Timer1 compare-B IRQ.
+ * Timer1 is the free running system timer. */
+static void spi_transfer_async_delayed(void)
+{
+	OCR1B = (uint16_t)(TCNT1 + async_state.wait);
+	TIFR = (1 << OCF1B);
+	TIMSK = (uint8_t)(TIMSK | (1u << OCIE1B));
+}
+
 ISR(SPI_STC_vect)
 {
 	uint8_t rxbyte;
@@ -57,9 +65,8 @@ ISR(SPI_STC_vect)
 	*async_state.rxbuf = rxbyte;
 	async_state.rxbuf++;
 	if (async_state.bytes_left) {
-		if (async_state.wait_ms)
-			async_state.wait_ms_left =
-				(uint8_t)(async_state.wait_ms + 1u);
+		if (async_state.wait)
+			spi_transfer_async_delayed();
 		else
 			spi_transfer_async();
 	} else {
@@ -71,16 +78,22 @@ ISR(SPI_STC_vect)
 	}
 }
 
+ISR(TIMER1_COMPB_vect)
+{
+	TIMSK = (uint8_t)(TIMSK & ~(1u << OCIE1B));
+	spi_transfer_async();
+}
+
 void spi_async_start(void *rxbuf, const void *txbuf,
-		     uint8_t nr_bytes, uint8_t flags, uint8_t wait_ms)
+		     uint8_t nr_bytes, uint8_t flags, uint8_t wait)
 {
-	BUG_ON(ATOMIC_LOAD(async_state.flags) & SPI_ASYNC_RUNNING);
+	BUG_ON(!irqs_disabled());
+	BUG_ON(async_state.flags & SPI_ASYNC_RUNNING);
 	BUG_ON(!nr_bytes);
 
 	async_state.flags = flags | SPI_ASYNC_RUNNING;
 	async_state.bytes_left = nr_bytes;
-	async_state.wait_ms = wait_ms;
-	async_state.wait_ms_left = 0;
+	async_state.wait = wait;
 	async_state.txbuf = txbuf;
 	async_state.rxbuf = rxbuf;
 	mb();
@@ -89,7 +102,10 @@ void spi_async_start(void *rxbuf, const void *txbuf,
 	(void)SPDR; /* clear state */
 	SPCR |= (1 << SPIE);
 	spi_slave_select(1);
-	spi_transfer_async();
+	if ((flags & SPI_ASYNC_DELAYSTART) && wait)
+		spi_transfer_async_delayed();
+	else
+		spi_transfer_async();
 }
 
 bool spi_async_running(void)
@@ -97,29 +113,6 @@ bool spi_async_running(void)
 	return !!(ATOMIC_LOAD(async_state.flags) & SPI_ASYNC_RUNNING);
 }
 
-void spi_async_ms_tick(void)
-{
-	bool send_next = 0;
-
-	irq_disable();
-
-	if (!(async_state.flags & SPI_ASYNC_RUNNING)) {
-		irq_enable();
-		return;
-	}
-	if (async_state.wait_ms_left == 0) {
-		irq_enable();
-		return;
-	}
-	async_state.wait_ms_left--;
-	if (async_state.wait_ms_left == 0)
-		send_next = 1;
-	irq_enable();
-
-	if (send_next)
-		spi_transfer_async();
-}
-
 #endif /* SPI_HAVE_ASYNC */
 
 uint8_t spi_transfer_sync(uint8_t tx)
@@ -19,12 +19,16 @@
 enum spi_async_flags {
 	SPI_ASYNC_RUNNING	= (1 << 0),
 	SPI_ASYNC_TXPROGMEM	= (1 << 1), /* TX buffer is in progmem */
+	SPI_ASYNC_DELAYSTART	= (1 << 2), /* Wait before the first byte, too */
 };
 
+/** spi_async_start - Start an interrupt driven transfer.
+ * Must be called with IRQs disabled.
+ * wait is the delay between two bytes, in Timer1 ticks.
+ * spi_async_done() is called in IRQ context after the last byte. */
 void spi_async_start(void *rxbuf, const void *txbuf,
-		     uint8_t nr_bytes, uint8_t flags, uint8_t wait_ms);
+		     uint8_t nr_bytes, uint8_t flags, uint8_t wait);
 bool spi_async_running(void);
-void spi_async_ms_tick(void);
 extern void spi_async_done(void);
 
 
@@ -36,6 +40,15 @@ static inline void spi_slave_select(bool select)
 		PORTB = (uint8_t)(PORTB | (1u << 4/*SS*/));
 }
 
+/* Select SCK = F_CPU/16 (fast) or the default F_CPU/64. */
+static inline void spi_fastclock(bool fast)
+{
+	if (fast)
+		SPCR = (uint8_t)((SPCR & ~(1u << SPR1)) | (1u << SPR0));
+	else
+		SPCR = (uint8_t)((SPCR & ~(1u << SPR0)) | (1u << SPR1));
+}
+
 uint8_t spi_transfer_sync(uint8_t tx);
 uint8_t spi_transfer_slowsync(uint8_t tx);
 
@@ -0,0 +1,453 @@
+/*
+ *   CNC-remote-control
+ *   Device performance counters
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#include "stats.h"
+#include "main.h"
+#include "util.h"
+#include "uart.h"
+#include "debug.h"
+#include "lcd.h"
+#include "usb.h"
+#include "pdiusb.h"
+#include "machine_interface_internal.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include <string.h>
+
+
+static struct device_stats stats;
+static uint16_t mainloop_count;
+static jiffies_t mainloop_next;
+static uint8_t perf_timer_hi;
+
+/* Main loop histograms */
+static struct {
+	uint16_t hist[LOOPHIST_NR_TABLES][LOOPHIST_NR_BUCKETS];
+	struct perf_stamp loop_start;
+	struct perf_stamp last_wdt;
+	uint16_t stage_usec[NR_LOOPHIST_STAGES];
+	uint16_t retry_usec;
+} loophist;
+
+#ifdef IRQTRACE
+static struct irqtrace_entry irqtrace_table[IRQTRACE_NR_SITES];
+static uint8_t irqtrace_used;
+static uint16_t irqtrace_lost;
+static bool irqtrace_active;
+static uint16_t irqtrace_site;
+static struct perf_stamp irqtrace_start;
+#endif
+
+
+/* Fill pattern of the unused SRAM */
+#define STACK_PAINT		0xC5
+
+#ifndef SIMULATOR
+/* End of .data and .bss. From the linker script. */
+extern uint8_t _end;
+
+/* Paint everything from the end of .bss up to RAMEND.
+ * This runs before main() and before .data and .bss are initialized.
+ * The stack is still empty. It must not be used here, so do it in
+ * assembly to keep the compiler from emitting a memset() call. */
+static void __attribute__((__naked__, __used__, __section__(".init3")))
+stack_paint(void)
+{
+	__asm__ __volatile__(
+	"	ldi r30, lo8(_end)	\n"
+	"	ldi r31, hi8(_end)	\n"
+	"	ldi r24, %[paint]	\n"
+	"	ldi r25, hi8(%[end])	\n"
+	"1:	st Z+, r24		\n"
+	"	cpi r30, lo8(%[end])	\n"
+	"	cpc r31, r25		\n"
+	"	brne 1b			\n"
+	: /* outputs */
+	: [paint]	"M" (STACK_PAINT),
+	  [end]		"i" (RAMEND + 1)
+	: "r24", "r25", "r30", "r31", "memory"
+	);
+}
+#endif /* SIMULATOR */
+
+
+ISR(TIMER0_OVF_vect)
+{
+	perf_timer_hi++;
+}
+
+perf_time_t perf_timer_get(void)
+{
+	uint8_t sreg, lo, hi;
+
+	sreg = irq_disable_save();
+	hi = perf_timer_hi;
+	lo = TCNT0;
+	/* Account for an overflow that is not handled, yet. */
+	if ((TIFR & (1 << TOV0)) && lo < 0x80)
+		hi++;
+	irq_restore(sreg);
+
+	return (perf_time_t)(lo | ((uint16_t)hi << 8));
+}
+
+uint16_t perf_timer_usec(perf_time_t start)
+{
+	perf_time_t delta;
+
+	delta = (perf_time_t)(perf_timer_get() - start);
+	if (delta >= 0xFFFFu / PERF_TIMER_USEC)
+		return 0xFFFFu;
+	return (uint16_t)(delta * PERF_TIMER_USEC);
+}
+
+void perf_stamp_get(struct perf_stamp *s)
+{
+	s->jiffies = get_jiffies();
+	s->perf = perf_timer_get();
+}
+
+uint16_t perf_stamp_usec(const struct perf_stamp *s)
+{
+	jiffies_t jdelta;
+
+	/* The perf timer wraps after 262 msec and its high byte does
+	 * not advance with IRQs disabled. Use jiffies for long durations. */
+	jdelta = (jiffies_t)(get_jiffies() - s->jiffies);
+	if (jdelta >= msec2jiffies(1))
+		return (uint16_t)min((uint32_t)jdelta * (1000000ul / JPS), 0xFFFFul);
+	return perf_timer_usec(s->perf);
+}
+
+/* Bucket 0 is below 64 usec.
+ * Bucket n is 2^(n+5) to 2^(n+6) usec.
+ * The last bucket also holds everything above. */
+static uint8_t loophist_bucket(uint16_t usec)
+{
+	uint8_t bucket = 0;
+
+	if (usec == 0xFFFFu)
+		return LOOPHIST_NR_BUCKETS - 1;
+	usec >>= 6;
+	while (usec) {
+		bucket++;
+		usec >>= 1;
+	}
+
+	return min(bucket, LOOPHIST_NR_BUCKETS - 1);
+}
+
+/* Saturating add */
+static uint16_t add_sat16(uint16_t a, uint16_t b)
+{
+	return (uint16_t)min((uint32_t)a + b, 0xFFFFul);
+}
+
+static void loophist_inc(uint8_t table, uint8_t index)
+{
+	uint16_t *count = &loophist.hist[table][index];
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	*count = add_sat16(*count, 1);
+	irq_restore(sreg);
+}
+
+void stats_stage_begin(struct loop_stage *st)
+{
+	perf_stamp_get(&st->start);
+	st->retry_usec = loophist.retry_usec;
+}
+
+void stats_stage_end(uint8_t stage, const struct loop_stage *st)
+{
+	uint16_t usec, retry;
+
+	/* Blocking IRQ queue retries are accounted separately. */
+	usec = perf_stamp_usec(&st->start);
+	retry = (uint16_t)(loophist.retry_usec - st->retry_usec);
+	usec = (uint16_t)(usec - min(usec, retry));
+	loophist.stage_usec[stage] = add_sat16(loophist.stage_usec[stage], usec);
+}
+
+void stats_irq_retry(const struct perf_stamp *start)
+{
+	if (irqs_disabled())
+		return; /* Not in the main loop */
+	loophist.retry_usec = add_sat16(loophist.retry_usec,
+					perf_stamp_usec(start));
+}
+
+void stats_wdt_reset(void)
+{
+	loophist_inc(LOOPHIST_WDT,
+		     loophist_bucket(perf_stamp_usec(&loophist.last_wdt)));
+	perf_stamp_get(&loophist.last_wdt);
+}
+
+static void loophist_iteration_end(void)
+{
+	uint16_t usec, other;
+	uint8_t i, culprit;
+
+	usec = perf_stamp_usec(&loophist.loop_start);
+	perf_stamp_get(&loophist.loop_start);
+	loophist_inc(LOOPHIST_LOOP, loophist_bucket(usec));
+
+	loophist.stage_usec[LOOPHIST_STAGE_IRQRETRY] = loophist.retry_usec;
+	other = usec;
+	for (i = 0; i < LOOPHIST_STAGE_OTHER; i++)
+		other = (uint16_t)(other - min(other, loophist.stage_usec[i]));
+	loophist.stage_usec[LOOPHIST_STAGE_OTHER] = other;
+
+	if (usec >= LOOPHIST_LONG_USEC) {
+		culprit = 0;
+		for (i = 1; i < NR_LOOPHIST_STAGES; i++) {
+			if (loophist.stage_usec[i] > loophist.stage_usec[culprit])
+				culprit = i;
+		}
+		loophist_inc(LOOPHIST_CULPRIT, culprit);
+	}
+
+	memset(loophist.stage_usec, 0, sizeof(loophist.stage_usec));
+	loophist.retry_usec = 0;
+}
+
+uint8_t stats_loophist_get(uint8_t table, void *values)
+{
+	uint8_t sreg, count;
+
+	BUILD_BUG_ON(NR_LOOPHIST_STAGES > LOOPHIST_NR_BUCKETS);
+
+	if (table >= LOOPHIST_NR_TABLES)
+		return 0;
+	count = (table == LOOPHIST_CULPRIT) ? NR_LOOPHIST_STAGES
+					    : LOOPHIST_NR_BUCKETS;
+	sreg = irq_disable_save();
+	memcpy(values, loophist.hist[table], count * sizeof(uint16_t));
+	irq_restore(sreg);
+
+	return count;
+}
+
+void stats_loophist_reset(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	memset(loophist.hist, 0, sizeof(loophist.hist));
+	irq_restore(sreg);
+}
+
+void stats_mainloop(void)
+{
+	jiffies_t now = get_jiffies();
+	uint8_t sreg;
+
+	loophist_iteration_end();
+
+	mainloop_count++;
+	if (time_after(now, mainloop_next)) {
+		sreg = irq_disable_save();
+		stats.mainloop_rate = mainloop_count;
+		irq_restore(sreg);
+		mainloop_count = 0;
+		mainloop_next = (jiffies_t)(now + JPS);
+	}
+}
+
+void stats_irqq_used(uint8_t used)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.irqq_hwm = max(stats.irqq_hwm, used);
+	irq_restore(sreg);
+}
+
+void stats_irqq_drop(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.irqq_drops++;
+	irq_restore(sreg);
+}
+
+void stats_spi_retry(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.spi_retries++;
+	irq_restore(sreg);
+}
+
+void stats_lcd_commit(perf_time_t start)
+{
+	uint16_t usec = perf_timer_usec(start);
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.lcd_commits++;
+	stats.lcd_time_max = max(stats.lcd_time_max, usec);
+	irq_restore(sreg);
+}
+
+void stats_usb_irq(perf_time_t start)
+{
+	uint16_t usec = perf_timer_usec(start);
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.usb_irqs++;
+	stats.usb_irq_max = max(stats.usb_irq_max, usec);
+	irq_restore(sreg);
+}
+
+void stats_dbg_overrun(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	stats.dbg_overruns++;
+	irq_restore(sreg);
+}
+
+void stats_snapshot(struct device_stats *s)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	*s = stats;
+	s->uart_drops = uart_tx_drops();
+	stats.irqq_hwm = 0;
+	stats.lcd_time_max = 0;
+	stats.usb_irq_max = 0;
+	irq_restore(sreg);
+}
+
+void stats_sram(struct sram_usage *u)
+{
+#ifndef SIMULATOR
+	const uint8_t *p = &_end;
+
+	/* The stack did never grow below the first overwritten byte. */
+	while (p <= (const uint8_t *)RAMEND && *p == STACK_PAINT)
+		p++;
+
+	u->static_size = (uint16_t)(&_end - (const uint8_t *)RAMSTART);
+	u->stack_unused = (uint16_t)(p - &_end);
+	u->stack_max = (uint16_t)((const uint8_t *)RAMEND + 1 - p);
+#else
+	u->static_size = 0;
+	u->stack_unused = 0;
+	u->stack_max = 0;
+#endif
+	u->ram_size = RAMEND + 1 - RAMSTART;
+	u->irqq_size = interrupt_queue_ramsize();
+	u->dbg_ring_size = debug_ringbuf_ramsize();
+	u->lcd_size = lcd_ramsize();
+	u->usb_size = (uint16_t)(usb_ramsize() + pdiusb_ramsize());
+	u->uart_size = uart_ramsize();
+}
+
+#ifdef IRQTRACE
+/* Called with IRQs disabled. @sreg is the state before disabling. */
+void irqtrace_off(uint8_t sreg)
+{
+	if (__irqs_disabled(sreg))
+		return; /* Nested section or IRQ context. */
+
+	irqtrace_site = (uint16_t)__builtin_return_address(0);
+	perf_stamp_get(&irqtrace_start);
+	irqtrace_active = 1;
+}
+
+/* Called with IRQs disabled. @sreg is the state about to be restored. */
+void irqtrace_on(uint8_t sreg)
+{
+	struct irqtrace_entry *e;
+	uint16_t usec;
+	uint8_t i;
+
+	if (__irqs_disabled(sreg) || !irqtrace_active)
+		return;
+	irqtrace_active = 0;
+
+	usec = perf_stamp_usec(&irqtrace_start);
+
+	for (i = 0; i < irqtrace_used; i++) {
+		e = &irqtrace_table[i];
+		if (e->site == irqtrace_site)
+			goto found;
+	}
+	if (irqtrace_used >= ARRAY_SIZE(irqtrace_table)) {
+		if (irqtrace_lost < 0xFFFFu)
+			irqtrace_lost++;
+		return;
+	}
+	e = &irqtrace_table[irqtrace_used++];
+	e->site = irqtrace_site;
+found:
+	e->max_usec = max(e->max_usec, usec);
+	if (e->calls < 0xFFFFu)
+		e->calls++;
+}
+
+uint8_t irqtrace_get(uint8_t index, struct irqtrace_entry *e,
+		     uint16_t *lost)
+{
+	uint8_t sreg, used;
+
+	sreg = irq_disable_save();
+	used = irqtrace_used;
+	if (index < used)
+		*e = irqtrace_table[index];
+	*lost = irqtrace_lost;
+	irq_restore(sreg);
+
+	return used;
+}
+
+void irqtrace_reset(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	memset(irqtrace_table, 0, sizeof(irqtrace_table));
+	irqtrace_used = 0;
+	irqtrace_lost = 0;
+	irq_restore(sreg);
+}
+#endif /* IRQTRACE */
+
+void stats_init(void)
+{
+	BUILD_BUG_ON(F_CPU / 64 != 1000000ul / PERF_TIMER_USEC);
+
+	/* Perf timer: Timer0, free running, prescaler 64 */
+	TCCR0 = (1 << CS00) | (1 << CS01) | (0 << CS02);
+	TCNT0 = 0;
+	TIFR = (1 << TOV0);
+	TIMSK = (uint8_t)(TIMSK | (1 << TOIE0));
+
+	mainloop_next = (jiffies_t)(get_jiffies() + JPS);
+	perf_stamp_get(&loophist.loop_start);
+	loophist.last_wdt = loophist.loop_start;
+}
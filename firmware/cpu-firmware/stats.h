@@ -0,0 +1,166 @@
+/*
+ *   CNC-remote-control
+ *   Device performance counters
+ *
+ *   Copyright (C) 2026 agent <agent@local>
+ *
+ *   This program is free software; you can redistribute it and/or
+ *   modify it under the terms of the GNU General Public License
+ *   version 2 as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ */
+
+#ifndef DEVICE_STATS_H_
+#define DEVICE_STATS_H_
+
+#include "util.h"
+#include "main.h"
+#include "machine_interface.h"
+
+#include <stdint.h>
+
+
+/* The perf timer runs at 4 usec per tick and wraps after 262 msec. */
+#define PERF_TIMER_USEC		4u
+
+typedef uint16_t perf_time_t;
+
+/** struct perf_stamp - Start time for durations of unbounded length. */
+struct perf_stamp {
+	perf_time_t perf;
+	jiffies_t jiffies;
+};
+
+/** struct loop_stage - Start time of a main loop stage. */
+struct loop_stage {
+	struct perf_stamp start;
+	uint16_t retry_usec;
+};
+
+/* Main loop iterations at least this long are attributed to a stage. */
+#define LOOPHIST_LONG_USEC	2000u
+
+/** struct device_stats - Device performance counters.
+ * Counters are free running and wrap around.
+ * Maxima are reset by stats_snapshot(). */
+struct device_stats {
+	uint16_t mainloop_rate;	/* Main loop iterations per second */
+	uint8_t irqq_hwm;	/* Interrupt queue high-water mark */
+	uint16_t irqq_drops;	/* Dropped interrupts */
+	uint16_t spi_retries;	/* Coprocessor SPI checksum retries */
+	uint16_t lcd_commits;	/* Number of LCD commits */
+	uint16_t lcd_time_max;	/* Longest LCD commit, in usec */
+	uint16_t usb_irqs;	/* Number of PDIUSB interrupts */
+	uint16_t usb_irq_max;	/* Longest PDIUSB interrupt, in usec */
+	uint16_t dbg_overruns;	/* Debug ringbuffer overruns */
+	uint16_t uart_drops;	/* Dropped UART TX bytes */
+};
+
+/** struct irqtrace_entry - Critical section tracer call site.
+ * Only available in IRQTRACE builds. */
+struct irqtrace_entry {
+	uint16_t site;		/* Word address of the irq_disable call site */
+	uint16_t max_usec;	/* Longest duration with IRQs disabled */
+	uint16_t calls;		/* Number of sections. Saturates. */
+};
+
+/* Number of call sites that can be traced. */
+#define IRQTRACE_NR_SITES	16
+
+/** struct sram_usage - SRAM usage report. All sizes in bytes.
+ * The stack values are 0 in the simulator. */
+struct sram_usage {
+	uint16_t ram_size;	/* Total SRAM */
+	uint16_t static_size;	/* .data and .bss */
+	uint16_t stack_max;	/* Stack high-water mark since boot */
+	uint16_t stack_unused;	/* Never used bytes between .bss and the stack */
+	uint16_t irqq_size;	/* Interrupt queue */
+	uint16_t dbg_ring_size;	/* Debug ringbuffer */
+	uint16_t lcd_size;	/* LCD buffer */
+	uint16_t usb_size;	/* USB endpoint buffers */
+	uint16_t uart_size;	/* UART TX ringbuffer */
+};
+
+#ifndef BOOTLOADER
+
+void stats_init(void);
+
+/** perf_timer_get - Get the current perf timer count. */
+perf_time_t perf_timer_get(void);
+/** perf_timer_usec - Get the usec elapsed since @start. Saturates. */
+uint16_t perf_timer_usec(perf_time_t start);
+
+/** perf_stamp_get - Take a time stamp. */
+void perf_stamp_get(struct perf_stamp *s);
+/** perf_stamp_usec - Get the usec elapsed since @s. Saturates. */
+uint16_t perf_stamp_usec(const struct perf_stamp *s);
+
+/** stats_stage_begin - Start timing a main loop stage. */
+void stats_stage_begin(struct loop_stage *st);
+/** stats_stage_end - Account the time since @st to @stage.
+ * @stage: enum loophist_stage */
+void stats_stage_end(uint8_t stage, const struct loop_stage *st);
+/** stats_irq_retry - Account a blocking interrupt queue retry
+ * that started at @start. */
+void stats_irq_retry(const struct perf_stamp *start);
+/** stats_wdt_reset - Account a watchdog reset. Call next to wdt_reset(). */
+void stats_wdt_reset(void);
+
+/** stats_loophist_get - Read a main loop histogram table.
+ * @table: enum loophist_table
+ * @values: Buffer for LOOPHIST_NR_BUCKETS uint16_t values.
+ * Returns the number of values. */
+uint8_t stats_loophist_get(uint8_t table, void *values);
+/** stats_loophist_reset - Clear all main loop histogram tables. */
+void stats_loophist_reset(void);
+
+void stats_mainloop(void);
+void stats_irqq_used(uint8_t used);
+void stats_irqq_drop(void);
+void stats_spi_retry(void);
+void stats_lcd_commit(perf_time_t start);
+void stats_usb_irq(perf_time_t start);
+void stats_dbg_overrun(void);
+
+/** stats_snapshot - Read the counters and reset the maxima. */
+void stats_snapshot(struct device_stats *s);
+
+/** stats_sram - Get the SRAM usage report.
+ * This scans the unused stack area and takes some time. */
+void stats_sram(struct sram_usage *u);
+
+#ifdef IRQTRACE
+/** irqtrace_get - Read a call site entry from the tracer table.
+ * @index: The table index.
+ * @e: Entry buffer. Only written, if @index is valid.
+ * @lost: Returns the number of sections from call sites
+ *        that did not fit into the table.
+ * Returns the number of used table entries. */
+uint8_t irqtrace_get(uint8_t index, struct irqtrace_entry *e,
+		     uint16_t *lost);
+/** irqtrace_reset - Clear the tracer table. */
+void irqtrace_reset(void);
+#endif
+
+#else /* BOOTLOADER */
+
+static inline perf_time_t perf_timer_get(void)
+{
+	return 0;
+}
+
+static inline void stats_usb_irq(perf_time_t start)
+{
+}
+
+static inline void stats_wdt_reset(void)
+{
+}
+
+#endif /* BOOTLOADER */
+
+#endif /* DEVICE_STATS_H_ */
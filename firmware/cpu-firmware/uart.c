@@ -19,10 +19,102 @@
 #include "util.h"
 
 #include <avr/io.h>
+#include <avr/interrupt.h>
 
 
 static bool uart_enabled;
 
+#if UART_TX_ASYNC
+static uint8_t uart_txbuf[UART_TXBUF_SIZE];
+static uint8_t uart_txbuf_in;
+static uint8_t uart_txbuf_out;
+static bool uart_tx_sync;
+static uint16_t uart_txbuf_drops;
+#endif
+
+
+static void uart_tx_wait(uint8_t byte)
+{
+	while (!(UCSRA & (1 << UDRE)));
+	UDR = byte;
+}
+
+#if UART_TX_ASYNC
+ISR(USART_UDRE_vect)
+{
+	UDR = uart_txbuf[uart_txbuf_out & (UART_TXBUF_SIZE - 1)];
+	uart_txbuf_out++;
+	if (uart_txbuf_in == uart_txbuf_out)
+		UCSRB = (uint8_t)(UCSRB & ~(1 << UDRIE));
+}
+
+static void uart_tx(uint8_t byte)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	if (uart_tx_sync) {
+		uart_tx_wait(byte);
+	} else if ((uint8_t)(uart_txbuf_in - uart_txbuf_out) >= UART_TXBUF_SIZE) {
+		uart_txbuf_drops++;
+	} else {
+		uart_txbuf[uart_txbuf_in & (UART_TXBUF_SIZE - 1)] = byte;
+		uart_txbuf_in++;
+		UCSRB |= (1 << UDRIE);
+	}
+	irq_restore(sreg);
+}
+
+uint16_t uart_ramsize(void)
+{
+	return sizeof(uart_txbuf);
+}
+
+uint16_t uart_tx_drops(void)
+{
+	uint16_t drops;
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	drops = uart_txbuf_drops;
+	irq_restore(sreg);
+
+	return drops;
+}
+
+void uart_sync(void)
+{
+	uint8_t sreg;
+
+	sreg = irq_disable_save();
+	UCSRB = (uint8_t)(UCSRB & ~(1 << UDRIE));
+	while (uart_txbuf_in != uart_txbuf_out) {
+		uart_tx_wait(uart_txbuf[uart_txbuf_out & (UART_TXBUF_SIZE - 1)]);
+		uart_txbuf_out++;
+	}
+	uart_tx_sync = 1;
+	irq_restore(sreg);
+}
+#else /* UART_TX_ASYNC */
+static void uart_tx(uint8_t byte)
+{
+	uart_tx_wait(byte);
+}
+
+uint16_t uart_ramsize(void)
+{
+	return 0;
+}
+
+uint16_t uart_tx_drops(void)
+{
+	return 0;
+}
+
+void uart_sync(void)
+{
+}
+#endif /* UART_TX_ASYNC */
 
 void uart_putchar(char c)
 {
@@ -31,9 +123,8 @@ void uart_putchar(char c)
 	mb();
 
 	if (c == '\n')
-		uart_putchar('\r');
-	while (!(UCSRA & (1 << UDRE)));
-	UDR = (uint8_t)c;
+		uart_tx('\r');
+	uart_tx((uint8_t)c);
 }
 
 void uart_puthex(uint8_t val)
@@ -74,12 +165,18 @@ void uart_init(void)
 	/* Enable transmitter */
 	UCSRB = (0 << RXEN) | (1 << TXEN) | (0 << RXCIE);
 
+#if UART_TX_ASYNC
+	uart_txbuf_in = 0;
+	uart_txbuf_out = 0;
+	uart_tx_sync = 0;
+#endif
 	mb();
 	uart_enabled = 1;
 }
 
 void uart_exit(void)
 {
+	uart_sync();
 	uart_enabled = 0;
 	mb();
 
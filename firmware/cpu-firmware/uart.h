@@ -8,6 +8,16 @@
 #define UART_BAUD	115200
 #define UART_USE_2X	0
 
+/* The application transmits from a ringbuffer in the UDRE interrupt.
+ * The bootloader transmits synchronously. */
+#ifndef BOOTLOADER
+# define UART_TX_ASYNC		1
+#else
+# define UART_TX_ASYNC		0
+#endif
+/* TX ringbuffer size. Must be a power of two <= 128. */
+#define UART_TXBUF_SIZE		128
+
 
 void uart_putchar(char c) noinstrument;
 void _uart_putstr(const char PROGPTR *pstr) noinstrument;
@@ -17,4 +27,15 @@ void uart_puthex(uint8_t val) noinstrument;
 void uart_init(void) noinstrument;
 void uart_exit(void) noinstrument;
 
+/** uart_sync - Switch to synchronous transmission.
+ * Transmits the buffered bytes and then waits for each further byte.
+ * For the panic and reboot paths, which run with interrupts disabled. */
+void uart_sync(void) noinstrument;
+
+/** uart_tx_drops - Number of bytes dropped, because the TX ringbuffer was full. */
+uint16_t uart_tx_drops(void) noinstrument;
+
+/** uart_ramsize - SRAM size of the TX ringbuffer, in bytes. */
+uint16_t uart_ramsize(void);
+
 #endif /* UART_DRIVER_H_ */
@@ -48,6 +48,14 @@ static uint8_t usb_ep1_len;
 static uint8_t usb_ep2_buf[USBCFG_EP2_MAXSIZE];
 static uint8_t usb_ep2_ptr;
 static uint8_t usb_ep2_len;
+
+struct usb_ep2_rxframe {
+	uint8_t size;
+	uint8_t data[USBCFG_EP2_MAXSIZE];
+};
+static struct usb_ep2_rxframe usb_ep2_rxring[USBCFG_EP2_RXRING_SIZE];
+static uint8_t usb_ep2_rxring_in;
+static uint8_t usb_ep2_rxring_out;
 #endif /* WITH_EP2 */
 
 /* Current USB_DEVICE_... bits. */
@@ -56,6 +64,20 @@ static uint16_t usb_device_status;
 static uint8_t usb_active_configuration;
 
 
+uint16_t usb_ramsize(void)
+{
+	uint16_t size = sizeof(usb_control_buf);
+
+#if USB_WITH_EP1
+	size += sizeof(usb_ep1_buf);
+#endif
+#if USB_WITH_EP2
+	size += sizeof(usb_ep2_buf) + sizeof(usb_ep2_rxring);
+#endif
+
+	return size;
+}
+
 void usb_reset(void)
 {
 	usb_control_len = 0;
@@ -65,6 +87,8 @@ void usb_reset(void)
 #endif
 #if USB_WITH_EP2
 	usb_ep2_len = 0;
+	usb_ep2_rxring_in = 0;
+	usb_ep2_rxring_out = 0;
 #endif
 	usb_device_status = ((!!USBCFG_SELFPOWERED) << USB_DEVICE_SELF_POWERED);
 	usb_active_configuration = 0;
@@ -471,21 +495,55 @@ uint8_t usb_ep1_tx_poll(void **data, uint8_t chunksize)
 #endif /* WITH_EP1 */
 
 #if USB_WITH_EP2
-uint8_t usb_ep2_rx(void *data, uint8_t size)
+#define USB_EP2_RXRING_MASK	(USBCFG_EP2_RXRING_SIZE - 1u)
+
+static inline uint8_t usb_ep2_rxring_count(void)
+{
+	return (uint8_t)(usb_ep2_rxring_in - usb_ep2_rxring_out);
+}
+
+/* Hand the queued EP2 frames to the application.
+ * A frame is only processed, if the reply to the previous one
+ * was completely sent. Otherwise it would overwrite the reply. */
+static void usb_ep2_rx_process(void)
 {
+	struct usb_ep2_rxframe *frame;
 	uint8_t res;
 
-	usb_ep2_len = 0;
-	usb_ep2_ptr = 0;
+	while (usb_ep2_len == 0 && usb_ep2_rxring_count()) {
+		frame = &usb_ep2_rxring[usb_ep2_rxring_out & USB_EP2_RXRING_MASK];
+		usb_ep2_rxring_out++;
 
-	res = usb_app_ep2_rx(data, size, usb_ep2_buf);
-	if (res != USB_APP_UNHANDLED) {
-		usb_ep2_len = res;
-		return USB_RX_DONE;
+		usb_ep2_ptr = 0;
+		res = usb_app_ep2_rx(frame->data, frame->size, usb_ep2_buf);
+		if (res != USB_APP_UNHANDLED) {
+			usb_ep2_len = res;
+			continue;
+		}
+
+		usb_printstr("USB: Unhandled EP2 frame:");
+		usb_dumpmem(frame->data, frame->size);
 	}
+}
 
-	usb_printstr("USB: Unhandled EP2 frame:");
-	usb_dumpmem(data, size);
+uint8_t * usb_ep2_rx_slot(void)
+{
+	BUILD_BUG_ON(USBCFG_EP2_RXRING_SIZE & USB_EP2_RXRING_MASK);
+
+	if (usb_ep2_rxring_count() >= USBCFG_EP2_RXRING_SIZE)
+		return NULL;
+	return usb_ep2_rxring[usb_ep2_rxring_in & USB_EP2_RXRING_MASK].data;
+}
+
+uint8_t usb_ep2_rx_commit(uint8_t size)
+{
+	if (usb_ep2_rxring_count() >= USBCFG_EP2_RXRING_SIZE ||
+	    size > USBCFG_EP2_MAXSIZE)
+		return USB_RX_ERROR;
+
+	usb_ep2_rxring[usb_ep2_rxring_in & USB_EP2_RXRING_MASK].size = size;
+	usb_ep2_rxring_in++;
+	usb_ep2_rx_process();
 
 	return USB_RX_DONE;
 }
@@ -494,6 +552,7 @@ uint8_t usb_ep2_tx_poll(void **data, uint8_t chunksize)
 {
 	uint8_t res;
 
+	usb_ep2_rx_process();
 	if (usb_ep2_len == 0) {
 		res = usb_app_ep2_tx_poll(usb_ep2_buf);
 		if (res == USB_APP_UNHANDLED)
@@ -271,16 +271,25 @@ uint8_t usb_ep1_rx(void *data, uint8_t size);
  * Called by the lowlevel device driver. */
 uint8_t usb_ep1_tx_poll(void **data, uint8_t chunksize);
 
-/** usb_ep2_rx - Received data on EP2.
+/** usb_ep2_rx_slot - Get the next free EP2 RX ring buffer.
+ * Returns a buffer of USBCFG_EP2_MAXSIZE octets or NULL, if the
+ * ring is full. The driver must then keep the frame in hardware.
+ * Called by the lowlevel device driver. */
+uint8_t * usb_ep2_rx_slot(void);
+
+/** usb_ep2_rx_commit - Received data on EP2 into the usb_ep2_rx_slot() buffer.
  * Returns enum usb_rx_returncode.
  * Called by the lowlevel device driver. */
-uint8_t usb_ep2_rx(void *data, uint8_t size);
+uint8_t usb_ep2_rx_commit(uint8_t size);
 
 /** usb_ep2_tx_poll - Poll TX data on EP2.
  * Returns the number of octets or USB_TX_POLL_NONE on error.
  * Called by the lowlevel device driver. */
 uint8_t usb_ep2_tx_poll(void **data, uint8_t chunksize);
 
+/** usb_ramsize - SRAM size of the endpoint buffers, in bytes. */
+uint16_t usb_ramsize(void);
+
 /** enum usb_rx_returncode - Returncode to usb_*_rx() */
 enum usb_rx_returncode {
 	USB_RX_DONE,		/* Everything is done */
@@ -45,6 +45,11 @@
 #define USBCFG_EP1_MAXSIZE	64
 #define USBCFG_EP2_MAXSIZE	64
 
+/* Number of received EP2 frames that can be queued while
+ * the reply to the previous frame is still being sent.
+ * Must be a power of two. */
+#define USBCFG_EP2_RXRING_SIZE	2
+
 /* Power control
  * Set to 1, if the device is selfpowered.
  * Set to 0, if the device is buspowered. */
@@ -18,6 +18,7 @@
 #include "debug.h"
 #include "lcd.h"
 #include "uart.h"
+#include "stats.h"
 
 #include <avr/io.h>
 #include <avr/wdt.h>
@@ -27,6 +28,7 @@ void long_delay_ms(uint16_t ms)
 {
 	while (ms) {
 		_delay_ms(50);
+		stats_wdt_reset();
 		wdt_reset();
 		ms = (ms >= 50) ? ms - 50 : 0;
 	}
@@ -46,10 +48,9 @@ char hexdigit_to_ascii(uint8_t digit)
 void do_panic(const char PROGPTR *msg)
 {
 	irq_disable();
+	uart_sync();
 
-	debug_printf("*** PANIC :( ***\n");
-	_debug_printf(msg);
-	debug_printf("\n");
+	uart_printf("*** PANIC :( ***\n%S\n", msg);
 
 	lcd_clear_buffer();
 	lcd_printf("*** PANIC :( ***\n");
@@ -62,8 +63,12 @@ void do_panic(const char PROGPTR *msg)
 void reboot(void)
 {
 	irq_disable();
-	debug_printf("*** REBOOTING ***\n");
+	uart_sync();
+	uart_printf("*** REBOOTING ***\n");
 	wdt_enable(WDTO_15MS);
+#ifdef SIMULATOR
+	sim_halt();
+#endif
 	while (1);
 }
 
@@ -116,15 +116,30 @@ void long_delay_ms(uint16_t ms);
 typedef _Bool		bool;
 
 
+#ifdef IRQTRACE
+/* Critical section tracer hooks. See stats.c */
+void irqtrace_off(uint8_t sreg) noinline noinstrument;
+void irqtrace_on(uint8_t sreg) noinline noinstrument;
+#endif
+
 static inline void irq_disable(void)
 {
+#ifdef IRQTRACE
+	uint8_t sreg = SREG;
+#endif
 	cli();
 	mb();
+#ifdef IRQTRACE
+	irqtrace_off(sreg);
+#endif
 }
 
 static inline void irq_enable(void)
 {
 	mb();
+#ifdef IRQTRACE
+	irqtrace_on((uint8_t)(1 << SREG_I));
+#endif
 	sei();
 }
 
@@ -133,12 +148,18 @@ static inline uint8_t irq_disable_save(void)
 	uint8_t sreg = SREG;
 	cli();
 	mb();
+#ifdef IRQTRACE
+	irqtrace_off(sreg);
+#endif
 	return sreg;
 }
 
 static inline void irq_restore(uint8_t sreg_flags)
 {
 	mb();
+#ifdef IRQTRACE
+	irqtrace_on(sreg_flags);
+#endif
 	SREG = sreg_flags;
 }
 
@@ -151,6 +172,10 @@ char hexdigit_to_ascii(uint8_t digit) noinstrument;
 
 
 /* Smart program memory read */
+#ifdef SIMULATOR
+/* Program memory is ordinary memory in the host simulator. */
+# define pgm_read(ptr)	(*(ptr))
+#else
 #define pgm_read(ptr)	({						\
 		typeof(*(ptr)) *_pgm_ptr = (ptr);			\
 		uint32_t _pgm_ret;					\
@@ -164,6 +189,7 @@ char hexdigit_to_ascii(uint8_t digit) noinstrument;
 			_pgm_read_invalid_type_size();			\
 		_pgm_ret;						\
 	})
+#endif
 extern void _pgm_read_invalid_type_size(void);
 
 